@@ -0,0 +1,535 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Benchmarking sockets on the loopback  device.   Where  stresssocket.pl
+verifies correctness, this program measures  the throughput and latency
+of library(socket), such that changes  to   nonblockio.c  and socket.c
+can be compared. Each run performs these steps:
+
+        * Create a server with an accepting thread and a pool of workers
+          (TCP and AF_UNIX) or a pool of receivers (UDP).
+        * Start a number of client threads that each run the requested
+          workload and wait for all of them to finish.
+        * Destroy the server and print the results as a single line.
+
+Workloads (mode) are:
+
+        * rr
+          Request/response.  Each client opens one connection and sends
+          `requests` messages of `size` bytes, waiting for the echo of
+          each message.
+        * connect
+          As `rr`, but each request uses a new connection.
+        * stream
+          Each client sends `requests` blocks of `size` bytes and waits
+          for a single acknowledgement.  Only for TCP and AF_UNIX.
+
+Results are printed as JSON  (default)  or   as  a  Prolog  term using
+format(prolog). Run all predefined benchmarks using
+
+        ?- bench.
+
+or a single configuration from the shell using e.g.
+
+        swipl -g bench_main -t halt benchsocket.pl -- \
+              --protocol=tcp --mode=rr --clients=8 --size=64
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+:- module(benchsocket,
+          [ bench/0,
+            bench/1,                    % +Options
+            bench_main/0
+          ]).
+:- use_module(library(socket)).
+:- use_module(library(debug)).
+:- use_module(library(error)).
+:- use_module(library(option)).
+:- use_module(library(lists)).
+:- use_module(library(apply)).
+:- use_module(library(readutil)).
+:- use_module(library(main)).
+
+                 /*******************************
+                 *             TOPLEVEL         *
+                 *******************************/
+
+bench :-
+    forall(bench_def(Options),
+           bench(Options)).
+
+bench_def([protocol(tcp),  mode(rr),      clients(1), size(64)]).
+bench_def([protocol(tcp),  mode(rr),      clients(8), size(64)]).
+bench_def([protocol(tcp),  mode(rr),      clients(8), size(16384)]).
+bench_def([protocol(tcp),  mode(connect), clients(4), size(64), requests(2000)]).
+bench_def([protocol(tcp),  mode(stream),  clients(1), size(65536)]).
+bench_def([protocol(tcp),  mode(stream),  clients(4), size(65536)]).
+bench_def([protocol(unix), mode(rr),      clients(8), size(64)]).
+bench_def([protocol(unix), mode(stream),  clients(4), size(65536)]).
+bench_def([protocol(udp),  mode(rr),      clients(1), size(512)]).
+bench_def([protocol(udp),  mode(rr),      clients(4), size(512)]).
+
+%!  bench(+Options) is det.
+%
+%   Run a single benchmark.  Options:
+%
+%     - protocol(+Protocol)
+%       One of `tcp` (default), `udp` or `unix`.
+%     - mode(+Mode)
+%       One of `rr` (default), `connect` or `stream`.
+%     - clients(+Count)
+%       Number of client threads.  Default 1.
+%     - server_threads(+Count)
+%       Number of server threads.  Default is the number of clients.
+%     - size(+Bytes)
+%       Message size in bytes.  Default 64.
+%     - requests(+Count)
+%       Number of messages per client.  Default 10,000.
+%     - format(+Format)
+%       One of `json` (default) or `prolog`.
+
+bench(Options) :-
+    option(protocol(Protocol), Options, tcp),
+    option(mode(Mode), Options, rr),
+    option(clients(Clients), Options, 1),
+    option(server_threads(Workers), Options, Clients),
+    option(size(Size), Options, 64),
+    option(requests(Requests), Options, 10000),
+    must_be(oneof([tcp,udp,unix]), Protocol),
+    must_be(oneof([rr,connect,stream]), Mode),
+    must_be(positive_integer, Clients),
+    must_be(positive_integer, Workers),
+    must_be(positive_integer, Size),
+    must_be(positive_integer, Requests),
+    check_mode(Protocol, Mode),
+    setup_call_cleanup(
+        start_server(Protocol, Workers, Server),
+        run_clients(Server, Mode, Clients, Size, Requests, Stats),
+        stop_server(Server)),
+    Config = [ protocol-Protocol, mode-Mode, clients-Clients,
+               server_threads-Workers, size-Size, requests-Requests
+             ],
+    option(format(Format), Options, json),
+    report(Format, Config, Stats).
+
+check_mode(udp, Mode) :-
+    Mode \== rr,
+    !,
+    domain_error(udp_bench_mode, Mode).
+check_mode(_, _).
+
+%!  bench_main
+%
+%   Entry point to run from the  shell.   Without  options  runs all
+%   predefined benchmarks.
+
+bench_main :-
+    current_prolog_flag(argv, [_Program|Argv]),
+    argv_options(Argv, _Positional, Options),
+    (   Options == []
+    ->  bench
+    ;   bench(Options)
+    ).
+
+
+                 /*******************************
+                 *             SERVER           *
+                 *******************************/
+
+%!  start_server(+Protocol, +Workers, -Server) is det.
+%!  stop_server(+Server) is det.
+
+start_server(udp, Workers, udp(Socket, Address, Threads)) :-
+    !,
+    udp_socket(Socket),
+    tcp_bind(Socket, ip(127,0,0,1):Port),
+    Address = ip(127,0,0,1):Port,
+    length(Threads, Workers),
+    maplist(udp_server_thread(Socket), Threads).
+start_server(Protocol, Workers,
+             stream(Protocol, Socket, Address, Acceptor, Queue, Threads)) :-
+    listen_socket(Protocol, Socket, Address),
+    message_queue_create(Queue),
+    length(Threads, Workers),
+    maplist(stream_server_thread(Protocol, Queue), Threads),
+    thread_create(acceptor(Socket, Queue), Acceptor, []).
+
+listen_socket(tcp, Socket, ip(127,0,0,1):Port) :-
+    tcp_socket(Socket),
+    tcp_setopt(Socket, reuseaddr),
+    tcp_bind(Socket, ip(127,0,0,1):Port),
+    tcp_listen(Socket, 1024).
+listen_socket(unix, Socket, Path) :-
+    tmp_file(bench, Path),
+    socket_create(Socket, [domain(unix)]),
+    tcp_bind(Socket, Path),
+    tcp_listen(Socket, 1024).
+
+stop_server(udp(Socket, Address, Threads)) :-
+    setup_call_cleanup(
+        udp_socket(S),
+        forall(member(_, Threads),
+               udp_send(S, stop, Address, [])),
+        tcp_close_socket(S)),
+    maplist(thread_join, Threads),
+    tcp_close_socket(Socket).
+stop_server(stream(Protocol, Socket, Address, Acceptor, Queue, Threads)) :-
+    thread_send_message(Acceptor, stop),
+    connect(Address, Stream),           % make accept return
+    close(Stream),
+    thread_join(Acceptor),
+    forall(member(_, Threads),
+           thread_send_message(Queue, stop)),
+    maplist(thread_join, Threads),
+    message_queue_destroy(Queue),
+    tcp_close_socket(Socket),
+    (   Protocol == unix
+    ->  delete_file(Address)
+    ;   true
+    ).
+
+acceptor(Socket, Queue) :-
+    tcp_accept(Socket, Client, _Peer),
+    (   thread_peek_message(stop)
+    ->  tcp_close_socket(Client)
+    ;   thread_send_message(Queue, connection(Client)),
+        acceptor(Socket, Queue)
+    ).
+
+stream_server_thread(Protocol, Queue, Id) :-
+    thread_create(stream_worker(Protocol, Queue), Id, []).
+
+stream_worker(Protocol, Queue) :-
+    thread_get_message(Queue, Msg),
+    (   Msg = connection(Socket)
+    ->  catch(serve_connection(Protocol, Socket), E,
+              print_message(warning, E)),
+        stream_worker(Protocol, Queue)
+    ;   true
+    ).
+
+serve_connection(Protocol, Socket) :-
+    (   Protocol == tcp
+    ->  tcp_setopt(Socket, nodelay)
+    ;   true
+    ),
+    setup_call_cleanup(
+        tcp_open_socket(Socket, Stream),
+        serve_stream(Stream),
+        close(Stream, [force(true)])).
+
+%   The first line of a connection is "Mode Size".  Subsequent data
+%   are messages of exactly Size bytes.
+
+serve_stream(Stream) :-
+    read_line_to_string(Stream, Header),
+    (   Header == end_of_file
+    ->  true
+    ;   split_string(Header, " ", "", [ModeS, SizeS]),
+        atom_string(Mode, ModeS),
+        number_string(Size, SizeS),
+        serve(Mode, Stream, Size)
+    ).
+
+serve(stream, Stream, _Size) :-
+    !,
+    setup_call_cleanup(
+        open_null_stream(Null),
+        copy_stream_data(Stream, Null),
+        close(Null)),
+    format(Stream, 'ok~n', []),
+    flush_output(Stream).
+serve(Mode, Stream, Size) :-
+    read_string(Stream, Size, Msg),
+    (   string_length(Msg, Size)
+    ->  write(Stream, Msg),
+        flush_output(Stream),
+        serve(Mode, Stream, Size)
+    ;   true
+    ).
+
+udp_server_thread(Socket, Id) :-
+    thread_create(udp_server(Socket), Id, []).
+
+udp_server(Socket) :-
+    udp_receive(Socket, Data, From,
+                [ as(string),
+                  max_message_size(65535)
+                ]),
+    (   Data == "stop"
+    ->  true
+    ;   udp_send(Socket, Data, From, []),
+        udp_server(Socket)
+    ).
+
+
+                 /*******************************
+                 *            CLIENTS           *
+                 *******************************/
+
+%!  run_clients(+Server, +Mode, +Clients, +Size, +Requests, -Stats)
+%
+%   Run Clients client threads. The clock  starts when all threads are
+%   created and stops when the last one has reported.
+
+run_clients(Server, Mode, Clients, Size, Requests, Stats) :-
+    server_address(Server, Protocol, Address),
+    thread_self(Me),
+    length(Threads, Clients),
+    maplist(client_thread(Me, Protocol, Mode, Address, Size, Requests),
+            Threads),
+    get_time(T0),
+    forall(member(Id, Threads),
+           thread_send_message(Id, go)),
+    length(Results, Clients),
+    maplist(client_result, Results),
+    get_time(T1),
+    maplist(thread_join, Threads),
+    Wall is T1-T0,
+    merge_results(Results, Wall, Stats).
+
+server_address(udp(_, Address, _), udp, Address).
+server_address(stream(Protocol, _, Address, _, _, _), Protocol, Address).
+
+client_thread(Parent, Protocol, Mode, Address, Size, Requests, Id) :-
+    thread_create(client(Parent, Protocol, Mode, Address, Size, Requests),
+                  Id, []).
+
+client(Parent, Protocol, Mode, Address, Size, Requests) :-
+    thread_get_message(go),
+    payload(Size, Msg),
+    (   catch(client(Protocol, Mode, Address, Msg, Size, Requests, Result),
+              E, true)
+    ->  true
+    ;   E = failed
+    ),
+    (   var(E)
+    ->  thread_send_message(Parent, result(Result))
+    ;   thread_send_message(Parent, error(E))
+    ).
+
+client_result(Result) :-
+    thread_get_message(Msg),
+    (   Msg = result(Result)
+    ->  true
+    ;   Msg = error(E),
+        throw(E)
+    ).
+
+payload(Size, Msg) :-
+    length(Codes, Size),
+    maplist(=(0'x), Codes),
+    string_codes(Msg, Codes).
+
+%!  client(+Protocol, +Mode, +Address, +Msg, +Size, +Requests, -Result)
+%
+%   Result is a term result(Requests, Bytes, Connections, Lost,
+%   Latencies), where Latencies is a list of round trip times in
+%   microseconds.  Requests and Bytes only count requests that were
+%   answered.
+
+client(udp, rr, Address, Msg, _Size, Requests,
+       result(Answered, Bytes, 0, Lost, Latencies)) :-
+    !,
+    setup_call_cleanup(
+        udp_socket(S),
+        ( tcp_getopt(S, file_no(Fd)),
+          udp_rr(Requests, S, Fd, Address, Msg, Latencies,
+                 0-0, Lost-Bytes)
+        ),
+        tcp_close_socket(S)),
+    Answered is Requests-Lost.
+client(_, rr, Address, Msg, Size, Requests,
+       result(Requests, Bytes, 1, 0, Latencies)) :-
+    setup_call_cleanup(
+        connect(Address, Stream),
+        ( format(Stream, 'rr ~d~n', [Size]),
+          rr(Requests, Stream, Msg, Size, Latencies)
+        ),
+        close(Stream)),
+    Bytes is Requests*Size.
+client(_, connect, Address, Msg, Size, Requests,
+       result(Requests, Bytes, Requests, 0, Latencies)) :-
+    connect_rr(Requests, Address, Msg, Size, Latencies),
+    Bytes is Requests*Size.
+client(_, stream, Address, Msg, Size, Requests,
+       result(Requests, Bytes, 1, 0, [])) :-
+    setup_call_cleanup(
+        connect(Address, Stream),
+        ( format(Stream, 'stream ~d~n', [Size]),
+          forall(between(1, Requests, _),
+                 write(Stream, Msg)),
+          stream_pair(Stream, In, Out),
+          close(Out),
+          read_line_to_string(In, Ack),
+          assertion(Ack == "ok")
+        ),
+        close(Stream, [force(true)])),
+    Bytes is Requests*Size.
+
+connect(Address, Stream) :-
+    (   Address = _:_
+    ->  Options = [bypass_proxy(true), nodelay(true)]
+    ;   Options = [bypass_proxy(true)]
+    ),
+    tcp_connect(Address, Stream, Options).
+
+rr(0, _, _, _, []) :- !.
+rr(N, Stream, Msg, Size, [L|Ls]) :-
+    get_time(T0),
+    write(Stream, Msg),
+    flush_output(Stream),
+    read_string(Stream, Size, _Reply),
+    get_time(T1),
+    L is (T1-T0)*1000000,
+    N1 is N-1,
+    rr(N1, Stream, Msg, Size, Ls).
+
+connect_rr(0, _, _, _, []) :- !.
+connect_rr(N, Address, Msg, Size, [L|Ls]) :-
+    get_time(T0),
+    setup_call_cleanup(
+        connect(Address, Stream),
+        ( format(Stream, 'connect ~d~n', [Size]),
+          write(Stream, Msg),
+          flush_output(Stream),
+          read_string(Stream, Size, _Reply)
+        ),
+        close(Stream)),
+    get_time(T1),
+    L is (T1-T0)*1000000,
+    N1 is N-1,
+    connect_rr(N1, Address, Msg, Size, Ls).
+
+%   Each datagram is prefixed with its sequence number.  A reply that
+%   arrives after its request was counted as lost would otherwise be
+%   taken as the reply to the next request, so replies with another
+%   sequence number are discarded.  Only answered requests count, where
+%   Bytes is the size of the datagrams that were echoed, including the
+%   sequence number.
+
+udp_rr(0, _, _, _, _, [], Stats, Stats) :- !.
+udp_rr(N, S, Fd, Address, Msg, Ls, Lost0-Bytes0, Stats) :-
+    format(string(Datagram), '~d:~s', [N, Msg]),
+    get_time(T0),
+    Deadline is T0+1.0,
+    udp_send(S, Datagram, Address, []),
+    (   udp_await_reply(S, Fd, N, Deadline)
+    ->  get_time(T1),
+        L is (T1-T0)*1000000,
+        Ls = [L|Ls1],
+        string_length(Datagram, Len),
+        Lost1 = Lost0,
+        Bytes1 is Bytes0+Len
+    ;   Ls = Ls1,
+        Lost1 is Lost0+1,
+        Bytes1 = Bytes0
+    ),
+    N1 is N-1,
+    udp_rr(N1, S, Fd, Address, Msg, Ls1, Lost1-Bytes1, Stats).
+
+udp_await_reply(S, Fd, Seq, Deadline) :-
+    get_time(Now),
+    Wait is Deadline-Now,
+    Wait > 0,
+    wait_for_input([Fd], [_], Wait),
+    udp_receive(S, Reply, _From, [as(string), max_message_size(65535)]),
+    (   sub_string(Reply, Before, _, _, ":"),
+        sub_string(Reply, 0, Before, _, SeqString),
+        number_string(Seq, SeqString)
+    ->  true
+    ;   udp_await_reply(S, Fd, Seq, Deadline)
+    ).
+
+                 /*******************************
+                 *            REPORT            *
+                 *******************************/
+
+merge_results(Results, Wall, Stats) :-
+    foldl(merge_result, Results, r(0,0,0,0,[]), r(Req,Bytes,Conn,Lost,LLs)),
+    append(LLs, Latencies0),
+    msort(Latencies0, Latencies),
+    ReqPerSec  is Req/Wall,
+    MBPerSec   is Bytes/Wall/1000000,
+    ConnPerSec is Conn/Wall,
+    percentile(Latencies, 0.5,   P50),
+    percentile(Latencies, 0.99,  P99),
+    percentile(Latencies, 0.999, P999),
+    Stats = [ seconds-Wall,
+              requests_per_sec-ReqPerSec,
+              mb_per_sec-MBPerSec,
+              connections_per_sec-ConnPerSec,
+              lost-Lost,
+              latency_p50_us-P50,
+              latency_p99_us-P99,
+              latency_p999_us-P999
+            ].
+
+merge_result(result(Req,Bytes,Conn,Lost,Ls), r(Req0,Bytes0,Conn0,Lost0,LLs),
+             r(Req1,Bytes1,Conn1,Lost1,[Ls|LLs])) :-
+    Req1   is Req0+Req,
+    Bytes1 is Bytes0+Bytes,
+    Conn1  is Conn0+Conn,
+    Lost1  is Lost0+Lost.
+
+percentile([], _, null) :- !.
+percentile(Sorted, P, Value) :-
+    length(Sorted, Len),
+    I is max(0, min(Len-1, ceiling(P*Len)-1)),
+    nth0(I, Sorted, Value).
+
+report(json, Config, Stats) :-
+    append(Config, Stats, Pairs),
+    format('{'),
+    foldl(json_pair, Pairs, "", _),
+    format('}~n').
+report(prolog, Config, Stats) :-
+    format('~q.~n', [bench(Config, Stats)]).
+
+json_pair(Key-Value, Sep, ", ") :-
+    format('~w"~w": ', [Sep, Key]),
+    json_value(Value).
+
+json_value(null) :-
+    !,
+    format(null).
+json_value(Value) :-
+    integer(Value),
+    !,
+    format('~d', [Value]).
+json_value(Value) :-
+    float(Value),
+    !,
+    format('~3f', [Value]).
+json_value(Value) :-
+    format('"~w"', [Value]).
@@ -24,7 +24,10 @@
 #cmakedefine HAVE_MALLINFO2 @HAVE_MALLINFO2@
 #cmakedefine HAVE_MALLOC_H @HAVE_MALLOC_H@
 #cmakedefine HAVE_MALLOC_INFO @HAVE_MALLOC_INFO@
+#cmakedefine HAVE_MEMFD_CREATE @HAVE_MEMFD_CREATE@
 #cmakedefine HAVE_MEMORY_H @HAVE_MEMORY_H@
+#cmakedefine HAVE_MMAP @HAVE_MMAP@
+#cmakedefine HAVE_MREMAP @HAVE_MREMAP@
 #cmakedefine HAVE_NETINET_TCP_H @HAVE_NETINET_TCP_H@
 #cmakedefine HAVE_OPEN_MEMSTREAM @HAVE_OPEN_MEMSTREAM@
 #cmakedefine HAVE_PIPE @HAVE_PIPE@2
@@ -47,17 +50,20 @@
 #cmakedefine HAVE_STRING_H @HAVE_STRING_H@
 #cmakedefine HAVE_SYSCONF @HAVE_SYSCONF@
 #cmakedefine HAVE_SYSLOG_H @HAVE_SYSLOG_H@
+#cmakedefine HAVE_SYS_MMAN_H @HAVE_SYS_MMAN_H@
 #cmakedefine HAVE_SYS_PRCTL_H @HAVE_SYS_PRCTL_H@
 #cmakedefine HAVE_SYS_RESOURCE_H @HAVE_SYS_RESOURCE_H@
 #cmakedefine HAVE_SYS_STAT_H @HAVE_SYS_STAT_H@
 #cmakedefine HAVE_SYS_TIME_H @HAVE_SYS_TIME_H@
 #cmakedefine HAVE_SYS_TYPES_H @HAVE_SYS_TYPES_H@
+#cmakedefine HAVE_SYS_UIO_H @HAVE_SYS_UIO_H@
 #cmakedefine HAVE_SYS_WAIT_H @HAVE_SYS_WAIT_H@
 #cmakedefine HAVE_SYS_UN_H @HAVE_SYS_UN_H@
 #cmakedefine HAVE_UNISTD_H @HAVE_UNISTD_H@
 #cmakedefine HAVE_UTIME @HAVE_UTIME@
 #cmakedefine HAVE_UTIME_H @HAVE_UTIME_H@
 #cmakedefine HAVE_VFORK @HAVE_VFORK@
+#cmakedefine HAVE_WRITEV @HAVE_WRITEV@
 #cmakedefine HAVE__NSGETENVIRON @HAVE__NSGETENVIRON@
 #cmakedefine O_PLMT @O_PLMT@
 #cmakedefine SETPGRP_VOID @SETPGRP_VOID@
@@ -34,18 +34,71 @@
     POSSIBILITY OF SUCH DAMAGE.
 */
 
+#define _GNU_SOURCE			/* get mremap() */
 #include <config.h>
 #include <SWI-Stream.h>
 #include <SWI-Prolog.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef __WINDOWS__
+#include <io.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 #ifdef O_PLMT
 #include <pthread.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 #endif
 #include "error.h"
+#include "memrope.h"
+#include "memutf8.h"
+#include "md5.h"
+#include "sha1/sha1.h"
+#include "sha1/sha2.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define O_MMAP 1
+#endif
+#if !defined(HAVE_SYS_UIO_H)
+#undef HAVE_WRITEV
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifdef _MSC_VER
+#include <windows.h>
+#define ATOMIC_INC(p) InterlockedIncrement((LONG volatile*)(p))
+#define ATOMIC_DEC(p) InterlockedDecrement((LONG volatile*)(p))
+#else
+#define ATOMIC_INC(p) __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_DEC(p) __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+#endif
+
+#if defined(O_MMAP) && defined(HAVE_MREMAP) && defined(MREMAP_MAYMOVE)
+#define O_MREMAP 1
+#endif
+#if defined(O_MREMAP) && defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+#define O_MEMFD 1
+#endif
 
 #ifdef O_PLMT
 #define LOCK(mf)   pthread_mutex_lock(&(mf)->mutex)
@@ -71,32 +124,96 @@ static atom_t ATOM_append;
 static atom_t ATOM_update;
 static atom_t ATOM_insert;
 static atom_t ATOM_free_on_close;
+static atom_t ATOM_infinite;
+static atom_t ATOM_backend;
+static atom_t ATOM_gap;
+static atom_t ATOM_rope;
+static atom_t ATOM_append_only;
+static atom_t ATOM_capacity;
+static atom_t ATOM_memfd;
+static atom_t ATOM_algorithm;
+static atom_t ATOM_offset;
+static atom_t ATOM_length;
+static atom_t ATOM_md5;
+static atom_t ATOM_sha1;
+static atom_t ATOM_sha224;
+static atom_t ATOM_sha256;
+static atom_t ATOM_sha384;
+static atom_t ATOM_sha512;
 
 #define MEMFILE_MAGIC	0x5624a6b3L
 #define MEMFILE_CMAGIC	0x5624a6b7L
 #define NOSIZE ((size_t)-1)
 
-#define	V_CHARCOUNT	0x01
-#define	V_LINENO	0x02
-#define	V_LINEPOS	0x04
-#define V_ALL		0x07
+#define MF_INDEX_BLOCK	16384		/* Bytes per index block */
 
-typedef struct
-{ size_t	byte_count;		/* Byte position in MF */
-  size_t	char_count;		/* Corresponding logical char */
-  size_t	line_no;		/* Line */
-  size_t	line_pos;		/* Line position */
-  unsigned int	valid;			/* Valid mask */
-} pos_cache;
+/* The index divides the buffer, including the gap, into blocks of
+   MF_INDEX_BLOCK bytes.  Two Fenwick trees hold the number of UTF-8
+   characters and newlines in the non-gap bytes of each block.
+*/
+
+typedef struct mf_index
+{ size_t	nblocks;		/* # blocks */
+  size_t       *chars;			/* Fenwick tree of char counts */
+  size_t       *lines;			/* Fenwick tree of newline counts */
+} mf_index;
+
+
+/* Data of a gap buffer shared between a memory file and its snapshots.
+   Shared data is never modified: mf_writable() gives the memory file a
+   private copy before the first modification.
+*/
+
+typedef struct mf_share
+{ unsigned int	refs;			/* Reference count */
+  char	       *data;			/* Shared buffer */
+  size_t	size;			/* Allocated size of data */
+  size_t	map_size;		/* data is mmap()ed */
+} mf_share;
+
+
+/* An append-only memory file has a single writer and any number of
+   readers (mf_tail) that block at the end of the data while the writer
+   is open.  The mutex protects the data against the writer.
+*/
+
+typedef struct mf_log
+{
+#ifdef O_PLMT
+  pthread_mutex_t mutex;		/* Guards data while writing */
+  pthread_cond_t  cond;			/* Signalled on append and close */
+#endif
+  int		readers;		/* # open readers */
+  int		writing;		/* Writer is open */
+} mf_log;
+
+#ifdef O_PLMT
+#define LOG_LOCK(l)	 pthread_mutex_lock(&(l)->mutex)
+#define LOG_UNLOCK(l)	 pthread_mutex_unlock(&(l)->mutex)
+#define LOG_BROADCAST(l) pthread_cond_broadcast(&(l)->cond)
+#else
+#define LOG_LOCK(l)
+#define LOG_UNLOCK(l)
+#define LOG_BROADCAST(l)
+#endif
 
 
+/* A memory file either uses a gap buffer (data, gap_start, gap_size) or
+   a rope (see memrope.c).  Using a rope, data is NULL, gap_size is 0,
+   end is the size and gap_start is the insertion point.
+*/
+
 typedef struct
 { char	       *data;			/* data of the file */
+  rope	       *rope;			/* Rope backend */
   size_t	end;			/* End of buffer */
   size_t	gap_start;		/* Insertion point */
   size_t	gap_size;		/* Insertion hole */
   size_t	char_count;		/* size in characters */
-  pos_cache	pcache;			/* Cached position */
+  size_t	capacity;		/* Minimal buffer size */
+  mf_index     *index;			/* Character and line index */
+  mf_share     *share;			/* data is shared with snapshots */
+  mf_log       *log;			/* Append-only with tailing readers */
   size_t	here;			/* read pointer */
   IOSTREAM     *stream;			/* Stream hanging onto it */
   atom_t	symbol;			/* <memory_file>(%p) */
@@ -107,7 +224,15 @@ typedef struct
 #endif
   int		magic;			/* MEMFILE_MAGIC */
   int		free_on_close;		/* free if it is closed */
+  int		snapshot;		/* Read-only snapshot */
+  int		memfd;			/* Data is a mapping of this memfd */
+  int		sealed;			/* memfd is sealed (read-only) */
   IOENC		encoding;		/* encoding of the data */
+#ifdef O_MMAP
+  size_t	map_size;		/* data is mmap()ed from a file */
+  dev_t		map_dev;		/* device of the mapped file */
+  ino_t		map_ino;		/* inode of the mapped file */
+#endif
 } memfile;
 
 static int	destroy_memory_file(memfile *m);
@@ -206,10 +331,246 @@ release_memfile(memfile *mf)
 }
 
 
+		 /*******************************
+		 *	      BUFFERS		*
+		 *******************************/
+
+/* The allocated size of a gap buffer is m->end.  Buffers that are a
+   power of two between MF_MIN_BUFFER and MF_POOL_MAX bytes are recycled
+   through a process-wide pool, so creating and freeing many small
+   memory files does not call malloc() and free() each time.  Buffers of
+   MF_MAP_MIN bytes or more are anonymous mappings that are grown using
+   mremap(), which moves pages rather than copying the data.  The
+   allocation method follows from the size, so mf_free_buf() and
+   mf_realloc_buf() must be passed the size used to allocate the buffer.
+*/
+
+#define MF_MIN_BUFFER	512
+#define MF_POOL_CLASSES	8			/* 512 ... 64K */
+#define MF_POOL_MAX	(MF_MIN_BUFFER<<(MF_POOL_CLASSES-1))
+#define MF_POOL_DEPTH	16			/* Max free buffers per class */
+#define MF_MAP_MIN	((size_t)1<<20)
+
+#ifdef O_MREMAP
+#define MF_MAPPED(size) ((size) >= MF_MAP_MIN)
+#else
+#define MF_MAPPED(size) FALSE
+#endif
+
+static void *pool_free[MF_POOL_CLASSES];	/* Linked through 1st word */
+static int   pool_count[MF_POOL_CLASSES];
+#ifdef O_PLMT
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define POOL_LOCK()   pthread_mutex_lock(&pool_mutex)
+#define POOL_UNLOCK() pthread_mutex_unlock(&pool_mutex)
+#else
+#define POOL_LOCK()
+#define POOL_UNLOCK()
+#endif
+
+static int
+pool_class(size_t size)
+{ size_t s = MF_MIN_BUFFER;
+  int i;
+
+  for(i=0; i<MF_POOL_CLASSES; i++, s <<= 1)
+  { if ( s == size )
+      return i;
+  }
+
+  return -1;
+}
+
+
+static char *
+mf_alloc_buf(size_t size)
+{ int c;
+
+  if ( (c=pool_class(size)) >= 0 )
+  { void *b;
+
+    POOL_LOCK();
+    if ( (b=pool_free[c]) )
+    { pool_free[c] = *(void**)b;
+      pool_count[c]--;
+    }
+    POOL_UNLOCK();
+    if ( b )
+      return b;
+  }
+#ifdef O_MREMAP
+  if ( MF_MAPPED(size) )
+  { void *b = mmap(NULL, size, PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+    return b == MAP_FAILED ? NULL : b;
+  }
+#endif
+
+  return malloc(size);
+}
+
+
+static void
+mf_free_buf(char *data, size_t size)
+{ int c;
+
+  if ( (c=pool_class(size)) >= 0 )
+  { POOL_LOCK();
+    if ( pool_count[c] < MF_POOL_DEPTH )
+    { *(void**)data = pool_free[c];
+      pool_free[c] = data;
+      pool_count[c]++;
+      data = NULL;
+    }
+    POOL_UNLOCK();
+    if ( !data )
+      return;
+  }
+#ifdef O_MREMAP
+  if ( MF_MAPPED(size) )
+  { munmap(data, size);
+    return;
+  }
+#endif
+
+  free(data);
+}
+
+
+static char *
+mf_realloc_buf(char *data, size_t old, size_t size)
+{ char *new;
+
+#ifdef O_MREMAP
+  if ( MF_MAPPED(old) && MF_MAPPED(size) )
+  { void *b = mremap(data, old, size, MREMAP_MAYMOVE);
+
+    return b == MAP_FAILED ? NULL : b;
+  }
+#endif
+  if ( pool_class(old) < 0 && pool_class(size) < 0 &&
+       !MF_MAPPED(old) && !MF_MAPPED(size) )
+    return realloc(data, size);
+
+  if ( (new = mf_alloc_buf(size)) )
+  { memcpy(new, data, old < size ? old : size);
+    mf_free_buf(data, old);
+  }
+
+  return new;
+}
+
+
+#ifdef O_MEMFD
+/* A memory file created with backend(memfd) keeps its gap buffer in a
+   shared mapping of a memfd_create() file.  The file is at least as
+   large as the buffer, such that the mapping never extends beyond the
+   end of the file.  It is only truncated to the size of the content by
+   memfd_publish().
+*/
+
+static char *
+memfd_resize(memfile *m, size_t size)
+{ void *b;
+
+  if ( size > m->end && ftruncate(m->memfd, size) != 0 )
+    return NULL;
+  if ( m->data )
+    b = mremap(m->data, m->end, size, MREMAP_MAYMOVE);
+  else
+    b = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, m->memfd, 0);
+
+  return b == MAP_FAILED ? NULL : b;
+}
+
+
+/* Create the memfd.  As 0 means "no memfd", we move it if stdin was
+   closed.  The descriptor itself is not inherited; memory_file_open_fd()
+   creates the descriptors for child processes.
+*/
+
+static int
+memfd_open(void)
+{ int fd = memfd_create("swipl-memory-file", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+
+  if ( fd == 0 )
+  { int fd2 = fcntl(fd, F_DUPFD_CLOEXEC, 1);
+
+    close(fd);
+    fd = fd2;
+  }
+
+  return fd;
+}
+#endif
+
+
+/* Resize the gap buffer of m to size bytes */
+
+static char *
+mf_resize_buf(memfile *m, size_t size)
+{
+#ifdef O_MEMFD
+  if ( m->memfd )
+    return memfd_resize(m, size);
+#endif
+  if ( m->data )
+    return mf_realloc_buf(m->data, m->end, size);
+
+  return mf_alloc_buf(size);
+}
+
+
+static void	free_index(memfile *m);
+
+static void
+release_share(mf_share *s)
+{ if ( ATOMIC_DEC(&s->refs) == 0 )
+  {
+#ifdef O_MMAP
+    if ( s->map_size )
+      munmap(s->data, s->map_size);
+    else
+#endif
+      mf_free_buf(s->data, s->size);
+    free(s);
+  }
+}
+
+
+static void
+free_data(memfile *m)
+{ free_index(m);
+  if ( m->share )
+  { release_share(m->share);
+    m->share = NULL;
+#ifdef O_MMAP
+  } else if ( m->map_size )
+  { munmap(m->data, m->map_size);
+#endif
+#ifdef O_MEMFD
+  } else if ( m->memfd )
+  { if ( m->data )
+      munmap(m->data, m->end);
+#endif
+  } else if ( m->data )
+  { mf_free_buf(m->data, m->end);
+  }
+
+#ifdef O_MMAP
+  m->map_size = 0;
+#endif
+  m->data = NULL;
+}
+
+
 static void
 empty_memory_file(memfile *m)
-{ if ( m->data )
-    free(m->data);
+{ if ( m->rope )
+    rope_clear(m->rope);
+  else
+    free_data(m);
 
   m->encoding     = ENC_UTF8;
   m->data         = NULL;
@@ -217,20 +578,65 @@ empty_memory_file(memfile *m)
   m->gap_start    = 0;
   m->gap_size     = 0;
   m->char_count   = NOSIZE;
-  m->pcache.valid = 0;
   m->here         = 0;
 }
 
 
 static foreign_t
-new_memory_file(term_t handle)
-{ memfile *m = calloc(1, sizeof(*m));
+new_memory_file2(term_t handle, term_t options)
+{ memfile *m;
+  int use_rope = FALSE;
+  int use_memfd = FALSE;
+  int append_only = FALSE;
+  size_t capacity = 0;
+
+  if ( options )
+  { term_t tail = PL_copy_term_ref(options);
+    term_t head = PL_new_term_ref();
+    term_t arg  = PL_new_term_ref();
+
+    while(PL_get_list(tail, head, tail))
+    { size_t arity;
+      atom_t name;
+
+      if ( PL_get_name_arity(head, &name, &arity) && arity == 1 )
+      { _PL_get_arg(1, head, arg);
+	if ( name == ATOM_backend )
+	{ atom_t a;
+
+	  if ( !PL_get_atom_ex(arg, &a) )
+	    return FALSE;
+	  use_rope = use_memfd = FALSE;
+	  if ( a == ATOM_rope )
+	    use_rope = TRUE;
+	  else if ( a == ATOM_memfd )
+#ifdef O_MEMFD
+	    use_memfd = TRUE;
+#else
+	    return pl_error(NULL, 0, NULL, ERR_NOTIMPLEMENTED, "backend", arg);
+#endif
+	  else if ( a != ATOM_gap )
+	    return PL_domain_error("memory_file_backend", arg);
+	} else if ( name == ATOM_append_only )
+	{ if ( !PL_get_bool_ex(arg, &append_only) )
+	    return FALSE;
+	} else if ( name == ATOM_capacity )
+	{ if ( !PL_get_size_ex(arg, &capacity) )
+	    return FALSE;
+	}
+      } else
+	return pl_error("new_memory_file", 2, NULL, ERR_TYPE, head, "option");
+    }
+    if ( !PL_get_nil(tail) )
+      return pl_error("new_memory_file", 2, NULL, ERR_TYPE, tail, "list");
+  }
 
-  if ( !m )
+  if ( !(m = calloc(1, sizeof(*m))) )
     return PL_resource_error("memory");
 
   m->magic    = MEMFILE_MAGIC;
   m->encoding = ENC_UTF8;
+  m->capacity = capacity;
   m->data     = NULL;
   m->atom     = 0;
   m->symbol   = 0;
@@ -238,6 +644,30 @@ new_memory_file(term_t handle)
 #ifdef O_PLMT
   pthread_mutex_init(&m->mutex, NULL);
 #endif
+  if ( use_rope && !(m->rope = rope_new()) )
+  { destroy_memory_file(m);
+    return PL_resource_error("memory");
+  }
+#ifdef O_MEMFD
+  if ( use_memfd && (m->memfd = memfd_open()) < 0 )
+  { int e = errno;
+
+    m->memfd = 0;
+    destroy_memory_file(m);
+    return pl_error(NULL, 0, NULL, ERR_ERRNO, e,
+		    "create", "memory_file", handle);
+  }
+#endif
+  if ( append_only )
+  { if ( !(m->log = calloc(1, sizeof(*m->log))) )
+    { destroy_memory_file(m);
+      return PL_resource_error("memory");
+    }
+#ifdef O_PLMT
+    pthread_mutex_init(&m->log->mutex, NULL);
+    pthread_cond_init(&m->log->cond, NULL);
+#endif
+  }
 
   if ( unify_memfile(handle, m) )
     return TRUE;
@@ -247,19 +677,31 @@ new_memory_file(term_t handle)
 }
 
 
+static foreign_t
+new_memory_file(term_t handle)
+{ return new_memory_file2(handle, 0);
+}
+
+
 static void
 clean_memory_file(memfile *m)
 { if ( m->stream )
   { Sclose(m->stream);
     m->stream = NULL;
   }
-  if ( m->atom )
+  if ( m->rope )
+  { rope_free(m->rope);
+    m->rope = NULL;
+  } else if ( m->atom )
   { PL_unregister_atom(m->atom);
     m->atom = 0;
     m->data = NULL;
-  } else if ( m->data )
-  { free(m->data);
-    m->data = NULL;
+  } else
+  { free_data(m);
+  }
+  if ( m->memfd )
+  { close(m->memfd);
+    m->memfd = 0;
   }
 }
 
@@ -267,6 +709,14 @@ clean_memory_file(memfile *m)
 static int
 destroy_memory_file(memfile *m)
 { clean_memory_file(m);
+  if ( m->log )
+  {
+#ifdef O_PLMT
+    pthread_mutex_destroy(&m->log->mutex);
+    pthread_cond_destroy(&m->log->cond);
+#endif
+    free(m->log);
+  }
 #ifdef O_PLMT
   pthread_mutex_destroy(&m->mutex);
 #endif
@@ -282,8 +732,23 @@ free_memory_file(term_t handle)
 { memfile *m;
 
   if ( get_memfile(handle, &m) )
-  { m->symbol = 0;
-    clean_memory_file(m);
+  { int readers = 0;
+
+    if ( m->log )
+    { LOG_LOCK(m->log);
+      readers = m->log->readers;
+      LOG_UNLOCK(m->log);
+    }
+    if ( readers )			/* data is freed with the blob */
+    { if ( m->stream )
+      { Sclose(m->stream);
+	m->stream = NULL;
+      }
+      m->symbol = 0;
+    } else
+    { m->symbol = 0;
+      clean_memory_file(m);
+    }
     release_memfile(m);
     return TRUE;
   }
@@ -325,7 +790,9 @@ check_utf8_seq(char *s, size_t len)
       else if ( IS_UTF8_6BYTE(s) ) skip = 6;
       else assert(0);
     } else
-      skip = 1;
+    { skip = mf_ascii_prefix(s, len);	/* ASCII run */
+      count += skip-1;
+    }
 
     assert(len >= skip);
     len -= skip;
@@ -342,6 +809,14 @@ static void
 check_memfile(memfile *mf)
 { size_t count = 0;
 
+  if ( mf->rope )
+  { assert(mf->gap_size == 0 && mf->end == rope_length(mf->rope));
+    assert(mf->char_count == NOSIZE ||
+	   mf->encoding != ENC_UTF8 ||
+	   mf->char_count == rope_chars(mf->rope));
+    return;
+  }
+
   count += check_utf8_seq(&mf->data[0],                          mf->gap_start);
   count += check_utf8_seq(&mf->data[mf->gap_start+mf->gap_size],
 			  mf->end-(mf->gap_size+mf->gap_start));
@@ -365,125 +840,469 @@ check_memfile(memfile *mf)
 	  return -1; \
 	}
 
+/* Copy at most len bytes from the logical offset at into buf */
+
+static size_t
+mf_read_range(const memfile *m, size_t at, char *buf, size_t len)
+{ size_t size = m->end - m->gap_size;
+  size_t done = 0;
+
+  if ( at >= size )
+    return 0;
+  if ( len > size - at )
+    len = size - at;
+  if ( m->rope )
+    return rope_read(m->rope, at, buf, len);
+
+  if ( at < m->gap_start )
+  { done = m->gap_start - at;
+    if ( done > len )
+      done = len;
+    memcpy(buf, &m->data[at], done);
+  }
+  if ( done < len )
+    memcpy(&buf[done], &m->data[at+done+m->gap_size], len-done);
+
+  return len;
+}
+
+
 static ssize_t
 read_memfile(void *handle, char *buf, size_t size)
 { memfile *m = handle;
-  size_t done = 0;
 
   CHECK_MEMFILE(m);
-  if ( m->here < m->gap_start )
-  { size_t before_gap = m->gap_start - m->here;
-    if ( size <= before_gap )
-    { memcpy(buf, &m->data[m->here], size);
-      m->here += size;
-      return size;
-    } else
-    { memcpy(buf, &m->data[m->here], before_gap);
-      m->here += before_gap;
-      done = before_gap;
+  size = mf_read_range(m, m->here, buf, size);
+  m->here += size;
+
+  return size;
+}
+
+
+		 /*******************************
+		 *	CHAR AND LINE INDEX	*
+		 *******************************/
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+The index allows translating between byte offsets, character offsets and
+line numbers in O(log n).  It is created lazily by mf_get_index() and is
+updated for every change to the buffer.  Moving the gap moves bytes
+between blocks, so we update the index for the moved bytes.  The
+index is discarded if the buffer is reallocated.  Characters are counted
+as UTF-8 lead bytes, which is exact for UTF-8 and single byte encodings.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static size_t
+count_text(const char *s, size_t len, int lines)
+{ return lines ? mf_newlines(s, len) : mf_utf8_chars(s, len);
+}
+
+static size_t
+find_text(const char *s, size_t len, size_t k, int lines)
+{ return lines ? mf_find_newline(s, len, k) : mf_utf8_find_char(s, len, k);
+}
+
+static void
+fw_add(size_t *tree, size_t n, size_t i, size_t delta)
+{ for(i++; i <= n; i += i&(~i+1))
+    tree[i] += delta;
+}
+
+static size_t
+fw_sum(const size_t *tree, size_t i)	/* sum of blocks [0,i) */
+{ size_t sum = 0;
+
+  for(; i > 0; i -= i&(~i+1))
+    sum += tree[i];
+
+  return sum;
+}
+
+/* Find the block holding the k-th (0-based) counted item.  On return
+   *k is the index of the item inside the block.
+*/
+
+static size_t
+fw_find(const size_t *tree, size_t n, size_t *k)
+{ size_t pos = 0;
+  size_t step = 1;
+
+  while( step*2 <= n )
+    step *= 2;
+  for(; step > 0; step /= 2)
+  { if ( pos+step <= n && tree[pos+step] <= *k )
+    { pos += step;
+      *k -= tree[pos];
     }
   }
 
-  /* we are now after the gap */
-  { size_t left = size - done;
-    size_t start = m->here + m->gap_size;
-    size_t avail = m->end - start;
+  return pos;
+}
+
+/* Count items in the physical range [from,to), skipping the gap */
 
-    if ( avail < left )
-    { left = avail;
-      size = done + avail;
-    }
-    m->here += left;
-    memcpy(&buf[done], &m->data[start], left);
-    return size;
+static size_t
+count_phys(const memfile *m, size_t from, size_t to, int lines)
+{ size_t gs = m->gap_start;
+  size_t ge = gs + m->gap_size;
+  size_t count = 0;
+
+  if ( from < gs )
+    count += count_text(&m->data[from], (to < gs ? to : gs) - from, lines);
+  if ( to > ge )
+  { if ( from < ge )
+      from = ge;
+    count += count_text(&m->data[from], to-from, lines);
   }
+
+  return count;
 }
 
+/* Find the physical position of the k-th item in [from,to) */
 
 static size_t
-memfile_nextsize(size_t needed)
-{ size_t size = 512;
+find_phys(const memfile *m, size_t from, size_t to, size_t k, int lines)
+{ size_t gs = m->gap_start;
+  size_t ge = gs + m->gap_size;
+  size_t off;
 
-  while ( size < needed )
-    size *= 2;
+  if ( from < gs )
+  { size_t len = (to < gs ? to : gs) - from;
 
-  return size;
+    if ( (off=find_text(&m->data[from], len, k, lines)) != NOSIZE )
+      return from+off;
+    k -= count_text(&m->data[from], len, lines);
+  }
+  if ( to > ge )
+  { if ( from < ge )
+      from = ge;
+    if ( (off=find_text(&m->data[from], to-from, k, lines)) != NOSIZE )
+      return from+off;
+  }
+
+  return NOSIZE;
 }
 
+static void
+free_index(memfile *m)
+{ mf_index *idx;
+
+  if ( (idx=m->index) )
+  { m->index = NULL;
+    free(idx->chars);
+    free(idx->lines);
+    free(idx);
+  }
+}
 
-static int
-ensure_gap_size(memfile *m, size_t size)
-{ if ( m->gap_size < size )
-  { size_t nextsize = memfile_nextsize(m->end+(size-m->gap_size));
-    void *ptr;
+static mf_index *
+mf_get_index(memfile *m)
+{ mf_index *idx;
+  size_t n, i;
+
+  if ( m->index || m->rope )
+    return m->index;
+
+  n = (m->end + MF_INDEX_BLOCK - 1)/MF_INDEX_BLOCK;
+  if ( !(idx = malloc(sizeof(*idx))) )
+    return NULL;
+  idx->nblocks = n;
+  idx->chars   = calloc(n+1, sizeof(size_t));
+  idx->lines   = calloc(n+1, sizeof(size_t));
+  if ( !idx->chars || !idx->lines )
+  { free(idx->chars);
+    free(idx->lines);
+    free(idx);
+    return NULL;
+  }
 
-    if ( m->data )
-      ptr = realloc(m->data, nextsize);
-    else
-      ptr = malloc(nextsize);
+  for(i=0; i<n; i++)			/* block counts */
+  { size_t from = i*MF_INDEX_BLOCK;
+    size_t to   = from+MF_INDEX_BLOCK;
 
-    if ( ptr != NULL )
-    { size_t after_gap = m->end - (m->gap_start + m->gap_size);
+    if ( to > m->end )
+      to = m->end;
+    idx->chars[i+1] = count_phys(m, from, to, FALSE);
+    idx->lines[i+1] = count_phys(m, from, to, TRUE);
+  }
+  for(i=1; i<=n; i++)			/* turn into Fenwick trees */
+  { size_t j = i + (i&(~i+1));
 
-      m->data = ptr;
-      memmove(&m->data[nextsize-after_gap], &m->data[m->end-after_gap], after_gap);
-      m->gap_size += nextsize - m->end;
-      m->end = nextsize;
-    } else
-    { return -1;
+    if ( j <= n )
+    { idx->chars[j] += idx->chars[i];
+      idx->lines[j] += idx->lines[i];
     }
   }
 
-  return 0;
+  return m->index = idx;
 }
 
+/* Add (sign > 0) or remove the counts for len bytes at physical
+   position phys.
+*/
 
 static void
-move_gap_to(memfile *m, size_t to)
-{ assert(to <= m->end - m->gap_size);
-
-  if ( to != m->gap_start )
-  { if ( to > m->gap_start )		/* move forwards */
-    { memmove(&m->data[m->gap_start],
-	      &m->data[m->gap_start+m->gap_size],
-	      to - m->gap_start);
-      m->gap_start = to;
-    } else				/* move backwards */
-    { memmove(&m->data[to+m->gap_size],
-	      &m->data[to],
-	      m->gap_start - to);
-      m->gap_start = to;
-    }
+update_index(memfile *m, size_t phys, const char *data, size_t len, int sign)
+{ mf_index *idx;
+
+  if ( !(idx=m->index) )
+    return;
+
+  while( len > 0 )
+  { size_t b = phys/MF_INDEX_BLOCK;
+    size_t seg = (b+1)*MF_INDEX_BLOCK - phys;
+    size_t c, l;
+
+    if ( seg > len )
+      seg = len;
+    c = mf_utf8_chars(data, seg);
+    l = mf_newlines(data, seg);
+    if ( c )
+      fw_add(idx->chars, idx->nblocks, b, sign > 0 ? c : ~c+1);
+    if ( l )
+      fw_add(idx->lines, idx->nblocks, b, sign > 0 ? l : ~l+1);
+    phys += seg;
+    data += seg;
+    len  -= seg;
   }
 }
 
+/* Number of characters (lines is FALSE) or newlines before the
+   logical byte offset `at`.
+*/
 
-static ssize_t
-write_memfile(void *handle, char *buf, size_t size)
-{ memfile *m = handle;
-  int rc;
+static size_t
+index_count_before(memfile *m, size_t at, int lines)
+{ mf_index *idx = m->index;
+  size_t *tree = lines ? idx->lines : idx->chars;
+  size_t phys = at < m->gap_start ? at : at + m->gap_size;
+  size_t b;
+
+  if ( phys >= m->end )
+    return fw_sum(tree, idx->nblocks);
+
+  b = phys/MF_INDEX_BLOCK;
+  return fw_sum(tree, b) + count_phys(m, b*MF_INDEX_BLOCK, phys, lines);
+}
+
+/* Logical byte offset of the k-th (0-based) character or newline or
+   NOSIZE if there are not that many.
+*/
+
+static size_t
+index_find(memfile *m, size_t k, int lines)
+{ mf_index *idx = m->index;
+  size_t *tree = lines ? idx->lines : idx->chars;
+  size_t b, from, to, phys;
+
+  if ( k >= fw_sum(tree, idx->nblocks) )
+    return NOSIZE;
+
+  b    = fw_find(tree, idx->nblocks, &k);
+  from = b*MF_INDEX_BLOCK;
+  to   = from+MF_INDEX_BLOCK;
+  if ( to > m->end )
+    to = m->end;
+  phys = find_phys(m, from, to, k, lines);
+  assert(phys != NOSIZE);
+
+  return phys < m->gap_start ? phys : phys - m->gap_size;
+}
+
+
+/* Offset translation for the rope and indexed gap buffer */
+
+static int
+mf_indexed(memfile *m)
+{ return m->rope || mf_get_index(m);
+}
+
+static size_t
+mf_total_chars(memfile *m)
+{ return m->rope ? rope_chars(m->rope)
+		 : fw_sum(m->index->chars, m->index->nblocks);
+}
+
+static size_t
+mf_byte_to_char(memfile *m, size_t byte)
+{ return m->rope ? rope_byte_to_char(m->rope, byte)
+		 : index_count_before(m, byte, FALSE);
+}
+
+static size_t
+mf_char_to_byte(memfile *m, size_t chr)
+{ size_t pos;
+
+  if ( m->rope )
+    return rope_char_to_byte(m->rope, chr);
+  if ( (pos=index_find(m, chr, FALSE)) == NOSIZE )
+    pos = m->end - m->gap_size;
+
+  return pos;
+}
+
+static size_t
+mf_byte_to_line(memfile *m, size_t byte)
+{ return m->rope ? rope_byte_to_line(m->rope, byte)
+		 : index_count_before(m, byte, TRUE);
+}
+
+/* Byte offset after the line-th newline or NOSIZE */
+
+static size_t
+mf_line_to_byte(memfile *m, size_t line)
+{ size_t pos;
+
+  if ( m->rope )
+    return rope_line_to_byte(m->rope, line);
+  if ( line == 0 )
+    return 0;
+  if ( (pos=index_find(m, line-1, TRUE)) == NOSIZE )
+    return NOSIZE;
+
+  return pos+1;
+}
+
+
+static size_t
+memfile_nextsize(const memfile *m, size_t needed)
+{ size_t size = MF_MIN_BUFFER;
+
+  while ( size < needed || size < m->capacity )
+    size *= 2;
+
+  return size;
+}
+
+
+static int
+ensure_gap_size(memfile *m, size_t size)
+{ if ( m->gap_size < size )
+  { size_t nextsize = memfile_nextsize(m, m->end+(size-m->gap_size));
+    void *ptr;
+
+    if ( (ptr = mf_resize_buf(m, nextsize)) != NULL )
+    { size_t after_gap = m->end - (m->gap_start + m->gap_size);
+
+      free_index(m);
+      m->data = ptr;
+      memmove(&m->data[nextsize-after_gap], &m->data[m->end-after_gap], after_gap);
+      m->gap_size += nextsize - m->end;
+      m->end = nextsize;
+    } else
+    { return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+/* A memory file created by file_to_memory_file/3 may be a read-only
+   mapping of the file and the data may be shared with snapshots.  Copy
+   the data into a private gap buffer before the first modification.
+*/
+
+static int
+mf_writable(memfile *m)
+{ int shared = !!m->share;
+
+#ifdef O_MMAP
+  if ( m->map_size )
+    shared = TRUE;
+#endif
+
+  if ( shared )
+  { size_t size = m->end - m->gap_size;
+    size_t after = m->end - (m->gap_start + m->gap_size);
+    size_t nextsize = memfile_nextsize(m, size);
+    size_t gap_start = m->gap_start;
+    char *data;
+
+    if ( !(data = mf_alloc_buf(nextsize)) )
+      return -1;
+    memcpy(data, m->data, gap_start);
+    memcpy(&data[nextsize-after], &m->data[m->end-after], after);
+    free_data(m);
+    m->data      = data;
+    m->gap_start = gap_start;
+    m->gap_size  = nextsize - size;
+    m->end       = nextsize;
+  }
+
+  return 0;
+}
+
+
+static void
+move_gap_to(memfile *m, size_t to)
+{ assert(to <= m->end - m->gap_size);
+
+  if ( m->rope )
+  { m->gap_start = to;
+    return;
+  }
+  if ( to != m->gap_start )
+  { if ( to > m->gap_start )		/* move forwards */
+    { size_t len = to - m->gap_start;
+      size_t src = m->gap_start+m->gap_size;
+
+      update_index(m, src, &m->data[src], len, -1);
+      memmove(&m->data[m->gap_start], &m->data[src], len);
+      update_index(m, m->gap_start, &m->data[m->gap_start], len, 1);
+      m->gap_start = to;
+    } else				/* move backwards */
+    { size_t len = m->gap_start - to;
+
+      update_index(m, to, &m->data[to], len, -1);
+      memmove(&m->data[to+m->gap_size], &m->data[to], len);
+      update_index(m, to+m->gap_size, &m->data[to+m->gap_size], len, 1);
+      m->gap_start = to;
+    }
+  }
+}
+
+
+static ssize_t
+mf_write(memfile *m, char *buf, size_t size)
+{ int rc;
 
-  CHECK_MEMFILE(m);
   if ( size > 0 )
-  { m->char_count = NOSIZE;		/* TBD: Dynamically update? */
-    if ( m->gap_start < m->pcache.byte_count )
-      m->pcache.valid = 0;
+  { m->char_count = NOSIZE;
+
+    if ( m->rope )
+    { if ( m->mode == ATOM_update )
+      { size_t after = m->end - m->gap_start;
 
-    if ( m->mode == ATOM_update )
+	if ( rope_delete(m->rope, m->gap_start,
+			 size < after ? size : after) != 0 )
+	  return -1;
+      }
+      if ( rope_insert(m->rope, m->gap_start, buf, size) != 0 )
+	return -1;
+      m->gap_start += size;
+      m->end = rope_length(m->rope);
+    } else if ( m->mode == ATOM_update )
     { size_t start = m->gap_start + m->gap_size;
       size_t after = m->end - start;
 
       if ( size > after )
       { if ( (rc=ensure_gap_size(m, size-after)) != 0 )
 	  return rc;
+	start = m->gap_start + m->gap_size;
+	update_index(m, start, &m->data[start], after, -1);
 	m->gap_size -= size-after;
+      } else
+      { update_index(m, start, &m->data[start], size, -1);
       }
       memmove(&m->data[m->gap_start], buf, size);
+      update_index(m, m->gap_start, buf, size, 1);
       m->gap_start += size;
     } else
     { if ( (rc=ensure_gap_size(m, size)) != 0 )
 	return rc;
       memcpy(&m->data[m->gap_start], buf, size);
+      update_index(m, m->gap_start, buf, size, 1);
       m->gap_start += size;
       m->gap_size  -= size;
     }
@@ -492,6 +1311,23 @@ write_memfile(void *handle, char *buf, size_t size)
   return size;
 }
 
+static ssize_t
+write_memfile(void *handle, char *buf, size_t size)
+{ memfile *m = handle;
+  ssize_t rc;
+
+  CHECK_MEMFILE(m);
+  if ( !m->log )
+    return mf_write(m, buf, size);
+
+  LOG_LOCK(m->log);			/* wake up tailing readers */
+  rc = mf_write(m, buf, size);
+  LOG_BROADCAST(m->log);
+  LOG_UNLOCK(m->log);
+
+  return rc;
+}
+
 static int64_t
 seek64_memfile(void *handle, int64_t offset, int whence)
 { memfile *m = handle;
@@ -536,6 +1372,12 @@ close_memfile(void *handle)
   CHECK_MEMFILE(m);
   m->stream = NULL;
   m->mode = 0;
+  if ( m->log )
+  { LOG_LOCK(m->log);
+    m->log->writing = FALSE;
+    LOG_BROADCAST(m->log);
+    LOG_UNLOCK(m->log);
+  }
   if ( m->free_on_close )
     clean_memory_file(m);
   PL_unregister_atom(m->symbol);
@@ -561,121 +1403,558 @@ alreadyOpen(term_t handle, const char *op)
 }
 
 
-static struct encname
-{ IOENC  code;
-  atom_t *name;
-} encoding_names[] =
-{ { ENC_UNKNOWN,     &ATOM_unknown },
-  { ENC_OCTET,       &ATOM_octet },
-  { ENC_ASCII,       &ATOM_ascii },
-  { ENC_ISO_LATIN_1, &ATOM_iso_latin_1 },
-  { ENC_ANSI,	     &ATOM_text },
-  { ENC_UTF8,        &ATOM_utf8 },
-  { ENC_UNICODE_BE,  &ATOM_unicode_be },
-  { ENC_UNICODE_LE,  &ATOM_unicode_le },
-  { ENC_WCHAR,	     &ATOM_wchar_t },
-  { ENC_UNKNOWN,     NULL },
-};
+/* memory_file_shrink(+Handle) releases the gap of a gap buffer.  Data
+   we do not own (atoms, file mappings and data shared with snapshots)
+   is left alone.
+*/
 
+static int
+mf_shrink(memfile *m)
+{ size_t size = m->end - m->gap_size;
+  char *data;
+
+  if ( !m->data || !m->gap_size || m->atom || m->share )
+    return 0;
+#ifdef O_MMAP
+  if ( m->map_size )
+    return 0;
+#endif
 
-static IOENC
-atom_to_encoding(atom_t a)
-{ struct encname *en;
+  move_gap_to(m, size);
+  if ( size == 0 )
+  { free_data(m);
+    m->end = m->gap_start = m->gap_size = 0;
+  } else if ( (data = mf_resize_buf(m, size)) )
+  { free_index(m);
+    m->data     = data;
+    m->end      = size;
+    m->gap_size = 0;
+  } else
+    return -1;
 
-  for(en=encoding_names; en->name; en++)
-  { if ( *en->name == a )
-      return en->code;
+  return 0;
+}
+
+
+static foreign_t
+memory_file_shrink(term_t handle)
+{ memfile *m;
+  int rc = TRUE;
+
+  if ( !get_memfile(handle, &m) )
+    return FALSE;
+
+  if ( m->stream )
+  { rc = alreadyOpen(handle, "shrink");
+  } else
+  { if ( m->log )
+      LOG_LOCK(m->log);
+    if ( mf_shrink(m) != 0 )
+      rc = PL_resource_error("memory");
+    if ( m->log )
+      LOG_UNLOCK(m->log);
   }
 
-  return ENC_UNKNOWN;
+  release_memfile(m);
+  return rc;
 }
 
 
-static bool
-get_encoding(term_t t, IOENC *enc)
-{ atom_t en;
+		 /*******************************
+		 *	     SNAPSHOTS		*
+		 *******************************/
 
-  if ( PL_get_atom(t, &en) )
-  { IOENC encoding;
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+memory_file_snapshot(+Handle, -Snapshot)
 
-    if ( (encoding = atom_to_encoding(en)) == ENC_UNKNOWN )
-      return pl_error(NULL, 0, NULL, ERR_DOMAIN, t, "encoding"),false;
+A snapshot is a read-only memory file that shares the data with the
+original.  A rope is shared using rope_snapshot().  A gap buffer is
+shared as a whole using a reference counted mf_share, which causes the
+original to copy the data on its next modification.
 
-    *enc = encoding;
-    return TRUE;
+Opening a snapshot for reading creates another view with its own read
+pointer, so any number of threads can read a snapshot concurrently
+without locking it.  The view is destroyed when the stream is closed.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static int
+close_memfile_view(void *handle)
+{ memfile *m = handle;
+
+  CHECK_MEMFILE(m);
+  m->stream = NULL;
+  destroy_memory_file(m);
+
+  return 0;
+}
+
+
+IOFUNCTIONS memfile_view_functions =
+{ read_memfile,
+  NULL,					/* write */
+  seek_memfile,
+  close_memfile_view,
+  NULL,					/* control */
+  seek64_memfile
+};
+
+
+static memfile *
+mf_view(memfile *m)
+{ memfile *v;
+  mf_share *copy = NULL;
+
+  if ( m->memfd )			/* modified in place: copy */
+  { size_t size = m->end - m->gap_size;
+
+    if ( size > 0 )
+    { if ( !(copy = malloc(sizeof(*copy))) )
+	return NULL;
+      if ( !(copy->data = mf_alloc_buf(size)) )
+      { free(copy);
+	return NULL;
+      }
+      mf_read_range(m, 0, copy->data, size);
+      copy->refs     = 1;
+      copy->size     = size;
+      copy->map_size = 0;
+    }
+  } else if ( m->data && !m->rope && !m->atom && !m->share )
+  { mf_share *sh;
+
+    if ( !(sh = malloc(sizeof(*sh))) )
+      return NULL;
+    sh->refs     = 1;
+    sh->data     = m->data;
+    sh->size     = m->end;
+#ifdef O_MMAP
+    sh->map_size = m->map_size;
+#else
+    sh->map_size = 0;
+#endif
+    m->share = sh;
   }
 
-  return pl_error(NULL, 0, NULL, ERR_TYPE, t, "encoding"),false;
+  if ( !(v = calloc(1, sizeof(*v))) )
+  { if ( copy )
+      release_share(copy);
+    return NULL;
+  }
+  if ( m->rope && !(v->rope = rope_snapshot(m->rope)) )
+  { free(v);
+    return NULL;
+  }
+
+  v->magic      = MEMFILE_MAGIC;
+  v->snapshot   = TRUE;
+  v->encoding   = m->encoding;
+  v->data       = m->data;
+  v->end        = m->end;
+  v->gap_start  = m->gap_start;
+  v->gap_size   = m->gap_size;
+  v->char_count = m->char_count;
+#ifdef O_MMAP
+  v->map_size   = m->map_size;
+  v->map_dev    = m->map_dev;
+  v->map_ino    = m->map_ino;
+#endif
+  if ( m->atom )
+  { v->atom = m->atom;
+    PL_register_atom(v->atom);
+  } else if ( m->memfd )
+  { v->share     = copy;
+    v->data      = copy ? copy->data : NULL;
+    v->end       = copy ? copy->size : 0;
+    v->gap_start = v->end;
+    v->gap_size  = 0;
+  } else if ( m->share )
+  { v->share = m->share;
+    ATOMIC_INC(&v->share->refs);
+  }
+#ifdef O_PLMT
+  pthread_mutex_init(&v->mutex, NULL);
+#endif
+
+  return v;
 }
 
 
 static foreign_t
-open_memory_file4(term_t handle, term_t mode, term_t stream, term_t options)
+memory_file_snapshot(term_t handle, term_t snapshot)
 { memfile *m;
-  foreign_t rc;
+  int rc;
 
   if ( get_memfile(handle, &m) )
-  { int flags = SIO_FBUF|SIO_RECORDPOS|SIO_NOMUTEX;
-    atom_t iom;
-    IOSTREAM *fd;
-    IOENC encoding;
-    int free_on_close = FALSE;
-
-    if ( m->stream )
-    { rc = alreadyOpen(handle, "open");
-      goto out;
-    }
-    if ( !PL_get_atom(mode, &iom) )
-    { rc = pl_error("open_memory_file", 3, NULL, ERR_ARGTYPE, 2,
-		    mode, "io_mode");
-      goto out;
+  { memfile *v;
+
+    if ( m->stream && (m->stream->flags & SIO_OUTPUT) )
+    { rc = alreadyOpen(handle, "snapshot");
+    } else if ( !(v = mf_view(m)) )
+    { rc = PL_resource_error("memory");
+    } else if ( !(rc = unify_memfile(snapshot, v)) )
+    { destroy_memory_file(v);
     }
 
-    encoding = m->encoding;
-
-    if ( options )
-    { term_t tail = PL_copy_term_ref(options);
-      term_t head = PL_new_term_ref();
+    release_memfile(m);
+  } else
+    rc = FALSE;
 
-      while(PL_get_list(tail, head, tail))
-      { size_t arity;
-	atom_t name;
+  return rc;
+}
 
-	if ( PL_get_name_arity(head, &name, &arity) && arity == 1 )
-	{ term_t arg = PL_new_term_ref();
 
-	  _PL_get_arg(1, head, arg);
-	  if ( name == ATOM_encoding )
-	  { if ( !get_encoding(arg, &encoding) )
-	    { rc = FALSE;
-	      goto out;
-	    }
-	  } else if ( name == ATOM_free_on_close )
-	  { if ( !PL_get_bool(arg, &free_on_close) )
-	    { rc = pl_error("open_memory_file", 4, NULL, ERR_TYPE,
-			    arg, "boolean");
-	      goto out;
-	    }
-	  }
-	} else
-	{ rc = pl_error("open_memory_file", 4, NULL, ERR_TYPE, head, "option");
-	  goto out;
-	}
-      }
-      if ( !PL_get_nil(tail) )
-      { rc = pl_error("open_memory_file", 4, NULL, ERR_TYPE, tail, "list");
-	goto out;
-      }
-    }
+static int
+open_snapshot(term_t handle, memfile *m, int flags, IOENC encoding,
+	      term_t stream)
+{ memfile *v;
+  IOSTREAM *fd;
+
+  if ( !(v = mf_view(m)) )
+    return PL_resource_error("memory");
+  if ( !(fd = Snew(v, flags, &memfile_view_functions)) )
+  { destroy_memory_file(v);
+    return pl_error("open_memory_file", 3, NULL, ERR_ERRNO, errno,
+		    "create", "memory_file", handle);
+  }
+  fd->encoding = encoding;
+  fd->newline  = SIO_NL_POSIX;
+  v->stream    = fd;
+  v->mode      = ATOM_read;
+
+  if ( PL_unify_stream(stream, fd) )
+    return TRUE;
+
+  Sclose(fd);				/* destroys v */
+  return FALSE;
+}
+
+
+		 /*******************************
+		 *	  APPEND-ONLY LOGS	*
+		 *******************************/
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+A memory file created with new_memory_file(MF, [append_only(true)]) can
+only be extended by a single stream opened in append mode.  Opening it
+for reading creates an mf_tail reader with its own offset.  At the end of
+the data a reader waits until the writer appends (flushes) more data or
+closes its stream.  If the reader stream has a timeout (see set_stream/2)
+the read raises a timeout error after waiting this long.  If no writer is
+open the reader sees end-of-file.
+
+The readers copy directly from the memory file.  Writing and reading
+are serialized using the mutex of the mf_log.  Readers keep the memory
+file alive by holding a reference to its blob.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+typedef struct mf_tail
+{ memfile      *mf;			/* The log */
+  atom_t	symbol;			/* Its blob */
+  IOSTREAM     *stream;			/* Our stream */
+  size_t	here;			/* Read offset */
+} mf_tail;
+
+#ifdef O_PLMT
+/* Wait for the writer.  Returns -1 with errno set on timeout or if a
+   signal raised an exception.  We wake up every 250ms to handle
+   signals.
+*/
+
+static int
+wait_log(mf_log *log, IOSTREAM *s, const struct timeval *start)
+{ struct timeval now;
+  struct timespec deadline;
+  long ms = 250;
+
+  gettimeofday(&now, NULL);
+  if ( s->timeout >= 0 )
+  { long left = s->timeout - ((now.tv_sec  - start->tv_sec)*1000 +
+			      (now.tv_usec - start->tv_usec)/1000);
+
+    if ( left <= 0 )
+    { Sseterr(s, SIO_TIMEOUT, NULL);
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    if ( left < ms )
+      ms = left;
+  }
+
+  deadline.tv_sec  = now.tv_sec + ms/1000;
+  deadline.tv_nsec = (now.tv_usec + (ms%1000)*1000)*1000;
+  if ( deadline.tv_nsec >= 1000000000 )
+  { deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  if ( pthread_cond_timedwait(&log->cond, &log->mutex, &deadline) == ETIMEDOUT )
+  { int rc;
+
+    LOG_UNLOCK(log);
+    rc = PL_handle_signals();
+    LOG_LOCK(log);
+    if ( rc < 0 )
+    { errno = EPLEXCEPTION;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+#endif /*O_PLMT*/
+
+
+static ssize_t
+read_tail(void *handle, char *buf, size_t size)
+{ mf_tail *t = handle;
+  memfile *m = t->mf;
+  mf_log *log = m->log;
+  ssize_t rc;
+#ifdef O_PLMT
+  struct timeval start;
+
+  if ( t->stream->timeout >= 0 )
+    gettimeofday(&start, NULL);
+#endif
+
+  LOG_LOCK(log);
+  for(;;)
+  { if ( t->here < m->end - m->gap_size || !log->writing )
+    { rc = mf_read_range(m, t->here, buf, size);
+      t->here += rc;
+      break;
+    }
+#ifdef O_PLMT
+    if ( wait_log(log, t->stream, &start) < 0 )
+    { rc = -1;
+      break;
+    }
+#else
+    rc = 0;				/* no thread can append: end of file */
+    break;
+#endif
+  }
+  LOG_UNLOCK(log);
+
+  return rc;
+}
+
+
+static int64_t
+seek64_tail(void *handle, int64_t offset, int whence)
+{ mf_tail *t = handle;
+  memfile *m = t->mf;
+  int64_t size;
+
+  LOG_LOCK(m->log);
+  size = m->end - m->gap_size;
+  LOG_UNLOCK(m->log);
+
+  switch(whence)
+  { case SIO_SEEK_SET:
+      break;
+    case SIO_SEEK_CUR:
+      offset += t->here;
+      break;
+    case SIO_SEEK_END:
+      offset = size - offset;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+  if ( offset < 0 || offset > size )
+  { errno = EINVAL;
+    return -1;
+  }
+  t->here = offset;
+
+  return offset;
+}
+
+
+static long
+seek_tail(void *handle, long offset, int whence)
+{ return (long)seek64_tail(handle, (int64_t)offset, whence);
+}
+
+
+static int
+close_tail(void *handle)
+{ mf_tail *t = handle;
+  mf_log *log = t->mf->log;
+
+  LOG_LOCK(log);
+  log->readers--;
+  LOG_UNLOCK(log);
+  PL_unregister_atom(t->symbol);
+  free(t);
+
+  return 0;
+}
+
+
+IOFUNCTIONS memfile_tail_functions =
+{ read_tail,
+  NULL,					/* write */
+  seek_tail,
+  close_tail,
+  NULL,					/* control */
+  seek64_tail
+};
+
+
+static int
+open_tail(term_t handle, memfile *m, int flags, IOENC encoding,
+	  term_t stream)
+{ mf_tail *t;
+  IOSTREAM *fd;
+
+  if ( !(t = calloc(1, sizeof(*t))) )
+    return PL_resource_error("memory");
+  t->mf     = m;
+  t->symbol = m->symbol;
+  if ( !(fd = Snew(t, flags, &memfile_tail_functions)) )
+  { free(t);
+    return pl_error("open_memory_file", 3, NULL, ERR_ERRNO, errno,
+		    "create", "memory_file", handle);
+  }
+  fd->encoding = encoding;
+  fd->newline  = SIO_NL_POSIX;
+  t->stream    = fd;
+  PL_register_atom(t->symbol);
+  LOG_LOCK(m->log);
+  m->log->readers++;
+  LOG_UNLOCK(m->log);
+
+  if ( PL_unify_stream(stream, fd) )
+    return TRUE;
+
+  Sclose(fd);
+  return FALSE;
+}
+
+
+static struct encname
+{ IOENC  code;
+  atom_t *name;
+} encoding_names[] =
+{ { ENC_UNKNOWN,     &ATOM_unknown },
+  { ENC_OCTET,       &ATOM_octet },
+  { ENC_ASCII,       &ATOM_ascii },
+  { ENC_ISO_LATIN_1, &ATOM_iso_latin_1 },
+  { ENC_ANSI,	     &ATOM_text },
+  { ENC_UTF8,        &ATOM_utf8 },
+  { ENC_UNICODE_BE,  &ATOM_unicode_be },
+  { ENC_UNICODE_LE,  &ATOM_unicode_le },
+  { ENC_WCHAR,	     &ATOM_wchar_t },
+  { ENC_UNKNOWN,     NULL },
+};
+
+
+static IOENC
+atom_to_encoding(atom_t a)
+{ struct encname *en;
+
+  for(en=encoding_names; en->name; en++)
+  { if ( *en->name == a )
+      return en->code;
+  }
+
+  return ENC_UNKNOWN;
+}
+
+
+static bool
+get_encoding(term_t t, IOENC *enc)
+{ atom_t en;
+
+  if ( PL_get_atom(t, &en) )
+  { IOENC encoding;
+
+    if ( (encoding = atom_to_encoding(en)) == ENC_UNKNOWN )
+      return pl_error(NULL, 0, NULL, ERR_DOMAIN, t, "encoding"),false;
+
+    *enc = encoding;
+    return TRUE;
+  }
+
+  return pl_error(NULL, 0, NULL, ERR_TYPE, t, "encoding"),false;
+}
+
+
+static foreign_t
+open_memory_file4(term_t handle, term_t mode, term_t stream, term_t options)
+{ memfile *m;
+  foreign_t rc;
+
+  if ( get_memfile(handle, &m) )
+  { int flags = SIO_FBUF|SIO_RECORDPOS|SIO_NOMUTEX;
+    atom_t iom;
+    IOSTREAM *fd;
+    IOENC encoding;
+    int free_on_close = FALSE;
+
+    if ( !PL_get_atom(mode, &iom) )
+    { rc = pl_error("open_memory_file", 3, NULL, ERR_ARGTYPE, 2,
+		    mode, "io_mode");
+      goto out;
+    }
+    if ( m->stream && !(m->log && iom == ATOM_read) )
+    { rc = alreadyOpen(handle, "open");
+      goto out;
+    }
+
+    encoding = m->encoding;
+
+    if ( options )
+    { term_t tail = PL_copy_term_ref(options);
+      term_t head = PL_new_term_ref();
+
+      while(PL_get_list(tail, head, tail))
+      { size_t arity;
+	atom_t name;
+
+	if ( PL_get_name_arity(head, &name, &arity) && arity == 1 )
+	{ term_t arg = PL_new_term_ref();
+
+	  _PL_get_arg(1, head, arg);
+	  if ( name == ATOM_encoding )
+	  { if ( !get_encoding(arg, &encoding) )
+	    { rc = FALSE;
+	      goto out;
+	    }
+	  } else if ( name == ATOM_free_on_close )
+	  { if ( !PL_get_bool(arg, &free_on_close) )
+	    { rc = pl_error("open_memory_file", 4, NULL, ERR_TYPE,
+			    arg, "boolean");
+	      goto out;
+	    }
+	  }
+	} else
+	{ rc = pl_error("open_memory_file", 4, NULL, ERR_TYPE, head, "option");
+	  goto out;
+	}
+      }
+      if ( !PL_get_nil(tail) )
+      { rc = pl_error("open_memory_file", 4, NULL, ERR_TYPE, tail, "list");
+	goto out;
+      }
+    }
 
     if ( iom == ATOM_write  || iom == ATOM_append ||
 	 iom == ATOM_update || iom == ATOM_insert )
     { flags |= SIO_OUTPUT;
-      if ( m->atom )
+      if ( m->atom || m->snapshot || m->sealed )
       { rc = pl_error("open_memory_file", 3, "read only",
 		      ERR_PERMISSION, handle, "modify", "memory_file");
 	goto out;
       }
+      if ( m->log && iom != ATOM_append )
+      { rc = pl_error("open_memory_file", 3, "append only",
+		      ERR_PERMISSION, handle, PL_atom_chars(iom), "memory_file");
+	goto out;
+      }
 
       if ( iom == ATOM_write )
       { empty_memory_file(m);
@@ -686,6 +1965,16 @@ open_memory_file4(term_t handle, term_t mode, term_t stream, term_t options)
 			ERR_PERMISSION, handle, PL_atom_chars(iom), "memory_file");
 	  goto out;
 	}
+	if ( m->log )
+	{ LOG_LOCK(m->log);
+	  rc = mf_writable(m);
+	  LOG_UNLOCK(m->log);
+	} else
+	  rc = mf_writable(m);
+	if ( rc != 0 )
+	{ rc = PL_resource_error("memory");
+	  goto out;
+	}
 	if ( iom == ATOM_append )
 	{ move_gap_to(m, m->end - m->gap_size);
 	} else
@@ -695,6 +1984,18 @@ open_memory_file4(term_t handle, term_t mode, term_t stream, term_t options)
 
     } else if ( iom == ATOM_read )
     { flags |= SIO_INPUT;
+      if ( m->snapshot )
+      { if ( encoding != ENC_OCTET )
+	  flags |= SIO_TEXT;
+	rc = open_snapshot(handle, m, flags, encoding, stream);
+	goto out;
+      }
+      if ( m->log )
+      { if ( encoding != ENC_OCTET )
+	  flags |= SIO_TEXT;
+	rc = open_tail(handle, m, flags, encoding, stream);
+	goto out;
+      }
       m->free_on_close = free_on_close;
       m->here = 0;
     } else
@@ -718,6 +2019,11 @@ open_memory_file4(term_t handle, term_t mode, term_t stream, term_t options)
       m->stream = fd;
       m->mode = iom;
       PL_register_atom(m->symbol);
+      if ( m->log )
+      { LOG_LOCK(m->log);
+	m->log->writing = TRUE;
+	LOG_UNLOCK(m->log);
+      }
     } else
     { Sclose(fd);
     }
@@ -761,9 +2067,12 @@ get_size_mf(memfile *m, IOENC encoding, size_t *sizep)
       case ENC_UTF8:
       { size_t gap_end = m->gap_start+m->gap_size;
 
-	/* assumes UTF-8 sequences are not broken over the gap */
-	size  = PL_utf8_strlen(m->data, m->gap_start);
-	size +=	PL_utf8_strlen(&m->data[gap_end], m->end-gap_end);
+	if ( mf_indexed(m) )
+	{ size = mf_total_chars(m);
+	  break;
+	}
+	size  = mf_utf8_chars(m->data, m->gap_start);
+	size += mf_utf8_chars(&m->data[gap_end], m->end-gap_end);
 	break;
       }
       default:
@@ -922,51 +2231,594 @@ atom_to_memory_file(term_t atom, term_t handle)
 }
 
 		 /*******************************
-		 *	  DIRECT EXCHANGE	*
+		 *	       MEMFD		*
 		 *******************************/
 
-static foreign_t
-can_modify_memory_file(term_t handle, memfile *mf)
-{ if ( mf->atom )
-    return pl_error(NULL, 0, "read only",
-		    ERR_PERMISSION, handle, "modify", "memory_file");
-  if ( mf->stream )
-    return alreadyOpen(handle, "modify");
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+memory_file_seal(+Handle)
+memory_file_open_fd(+Handle, +Mode, -Stream)
+
+A memory file created with backend(memfd) holds its data in a file
+created by memfd_create().  memory_file_open_fd() opens a new descriptor
+for this file with its own file offset that is inherited by child
+processes.  The stream can be passed to process_create/3 as stream(S)
+or the child can open /dev/fd/N.
+
+Opening for reading first truncates the file to the content, moving the
+gap to the end.  Opening for writing empties the memory file; when the
+stream is closed the memory file maps whatever was written to the file,
+also by child processes.  memory_file_seal() makes the file immutable
+using F_SEAL_WRITE, F_SEAL_SHRINK and F_SEAL_GROW.  Sealing fails while
+there are shared mappings, so we unmap the buffer and replace it by a
+private read-only mapping, which is equivalent for an immutable file.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 
-  return TRUE;
+#ifdef O_MEMFD
+
+static int
+memfd_publish(memfile *m)
+{ if ( mf_shrink(m) != 0 )
+    return -1;
+
+  return ftruncate(m->memfd, m->data ? m->end : 0);
 }
 
 
-/* Get the byte offset for a character
-*/
+static int
+memfd_reopen(memfile *m, int flags)
+{ char path[64];
+  int fd;
 
-static char *
-utf8_skip_char(const char *in, const char *e)
-{ if ( !(in[0]&0x80) )
-  { return (char*)in+1;
-  } else
-  { in++;
-    while ( in < e && ISUTF8_CB(in[0]) )
-      in++;
-    return (char*)in;
-  }
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", m->memfd);
+  if ( (fd=open(path, flags)) < 0 &&	/* no /proc: share the offset */
+       (fd=dup(m->memfd)) >= 0 )
+    lseek(fd, 0, SEEK_SET);
+
+  return fd;
 }
 
 
-/* Skip chars forward from a byte position, returning the new
-   byte position in the memory file or NOSIZE if we would skip
-   outside the limits of the memory file.  Returns:
+static foreign_t
+not_a_memfd(term_t handle, const char *op)
+{ return pl_error(NULL, 0, "not backed by a memfd",
+		  ERR_PERMISSION, handle, op, "memory_file");
+}
 
-     OUTOFRANGE if memfile is too small
-     FALSE      if the encoding is not supported
-     TRUE       if ok
-*/
 
-#define OUTOFRANGE -1
+static foreign_t
+memory_file_seal(term_t handle)
+{ memfile *m;
+  int rc = TRUE;
+
+  if ( !get_memfile(handle, &m) )
+    return FALSE;
+
+  if ( !m->memfd )
+  { rc = not_a_memfd(handle, "seal");
+  } else if ( m->stream )
+  { rc = alreadyOpen(handle, "seal");
+  } else if ( !m->sealed )
+  { if ( memfd_publish(m) != 0 )
+    { rc = pl_error(NULL, 0, NULL, ERR_ERRNO, errno,
+		    "seal", "memory_file", handle);
+      goto out;
+    }
+    if ( m->data )
+    { munmap(m->data, m->end);
+      m->data = NULL;
+    }
+    if ( fcntl(m->memfd, F_ADD_SEALS,
+	       F_SEAL_WRITE|F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) == 0 )
+    { m->sealed = TRUE;
+      if ( m->end )
+	m->data = mmap(NULL, m->end, PROT_READ, MAP_PRIVATE, m->memfd, 0);
+    } else
+    { rc = pl_error(NULL, 0, NULL, ERR_ERRNO, errno,
+		    "seal", "memory_file", handle);
+      if ( m->end )
+	m->data = mmap(NULL, m->end, PROT_READ|PROT_WRITE, MAP_SHARED,
+		       m->memfd, 0);
+    }
+    if ( m->data == MAP_FAILED )	/* cannot happen on a valid memfd */
+    { m->data = NULL;
+      m->end = m->gap_start = m->gap_size = 0;
+      m->char_count = NOSIZE;
+    }
+  }
+
+out:
+  release_memfile(m);
+  return rc;
+}
+
+
+typedef struct
+{ memfile      *mf;			/* Memory file we write */
+  int		fd;			/* Descriptor for the memfd */
+} mf_fd;
+
+static ssize_t
+write_memfile_fd(void *handle, char *buf, size_t size)
+{ mf_fd *h = handle;
+
+  return (*Sfilefunctions.write)((void*)(intptr_t)h->fd, buf, size);
+}
+
+
+static int
+control_memfile_fd(void *handle, int action, void *arg)
+{ mf_fd *h = handle;
+
+  if ( action == SIO_GETFILENO )
+  { *(int*)arg = h->fd;
+    return 0;
+  }
+
+  return -1;
+}
+
+
+static int
+close_memfile_fd(void *handle)
+{ mf_fd *h = handle;
+  memfile *m = h->mf;
+  struct stat st;
+  int rc = close(h->fd);
+
+  m->stream = NULL;
+  m->mode = 0;
+  if ( fstat(m->memfd, &st) != 0 )
+  { rc = -1;
+  } else if ( st.st_size > 0 )
+  { void *data = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		      m->memfd, 0);
+
+    if ( data != MAP_FAILED )
+    { m->data      = data;
+      m->end       = st.st_size;
+      m->gap_start = m->end;
+      m->gap_size  = 0;
+    } else
+      rc = -1;
+  }
+  m->char_count = NOSIZE;
+  PL_unregister_atom(m->symbol);
+  free(h);
+
+  return rc;
+}
+
+
+static IOFUNCTIONS memfile_fd_functions =
+{ NULL,
+  write_memfile_fd,
+  NULL,
+  close_memfile_fd,
+  control_memfile_fd
+};
+
+
+static int
+open_fd_write(term_t handle, memfile *m, term_t stream)
+{ int flags = SIO_OUTPUT|SIO_FBUF|SIO_RECORDPOS;
+  IOENC encoding = m->encoding;
+  IOSTREAM *s;
+  mf_fd *h;
+
+  empty_memory_file(m);
+  m->encoding = encoding;
+  if ( !(h = malloc(sizeof(*h))) )
+    return PL_resource_error("memory");
+  h->mf = m;
+  if ( ftruncate(m->memfd, 0) != 0 ||
+       (h->fd = memfd_reopen(m, O_WRONLY)) < 0 )
+  { free(h);
+    return pl_error(NULL, 0, NULL, ERR_ERRNO, errno,
+		    "open", "memory_file", handle);
+  }
+  if ( encoding != ENC_OCTET )
+    flags |= SIO_TEXT;
+  if ( !(s = Snew(h, flags, &memfile_fd_functions)) )
+  { close(h->fd);
+    free(h);
+    return PL_resource_error("memory");
+  }
+  s->encoding = encoding;
+  s->newline  = SIO_NL_POSIX;
+  m->stream   = s;
+  m->mode     = ATOM_write;
+  PL_register_atom(m->symbol);
+  if ( PL_unify_stream(stream, s) )
+    return TRUE;
+  Sclose(s);
+  return FALSE;
+}
+
+
+static int
+open_fd_read(term_t handle, memfile *m, term_t stream)
+{ IOSTREAM *s;
+  int fd;
+
+  if ( (!m->sealed && memfd_publish(m) != 0) ||
+       (fd = memfd_reopen(m, O_RDONLY)) < 0 )
+    return pl_error(NULL, 0, NULL, ERR_ERRNO, errno,
+		    "open", "memory_file", handle);
+  if ( !(s = Sfdopen(fd, m->encoding == ENC_OCTET ? "rb" : "r")) )
+  { close(fd);
+    return PL_resource_error("memory");
+  }
+  s->encoding = m->encoding;
+  if ( PL_unify_stream(stream, s) )
+    return TRUE;
+  Sclose(s);
+  return FALSE;
+}
+
+
+static foreign_t
+memory_file_open_fd(term_t handle, term_t mode, term_t stream)
+{ memfile *m;
+  atom_t iom;
+  int rc;
+
+  if ( !PL_get_atom_ex(mode, &iom) || !get_memfile(handle, &m) )
+    return FALSE;
+
+  if ( !m->memfd )
+    rc = not_a_memfd(handle, "open");
+  else if ( m->stream )
+    rc = alreadyOpen(handle, "open");
+  else if ( iom == ATOM_read )
+    rc = open_fd_read(handle, m, stream);
+  else if ( iom == ATOM_write )
+    rc = ( m->sealed || m->log
+		? pl_error(NULL, 0, m->sealed ? "sealed" : "append only",
+			   ERR_PERMISSION, handle, "modify", "memory_file")
+		: open_fd_write(handle, m, stream) );
+  else
+    rc = PL_domain_error("io_mode", mode);
+
+  release_memfile(m);
+  return rc;
+}
+
+#endif /*O_MEMFD*/
+
+
+		 /*******************************
+		 *	     FILE I/O		*
+		 *******************************/
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+file_to_memory_file(+File, -Handle, +Options)
+
+Create a memory file from a file.  If possible, the file is mapped
+read-only, such that loading costs no more than the page faults for the
+data we actually access.  The data is copied into a normal gap buffer
+if the memory file is modified (see mf_writable()).
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static int
+read_file_data(int fd, memfile *m, size_t size)
+{ char *data;
+  size_t done = 0;
+
+  if ( !(data = mf_alloc_buf(size)) )
+  { errno = ENOMEM;
+    return -1;
+  }
+  while( done < size )
+  { ssize_t n = read(fd, data+done, size-done);
+
+    if ( n < 0 )
+    { if ( errno == EINTR )
+	continue;
+      mf_free_buf(data, size);
+      return -1;
+    }
+    if ( n == 0 )
+      break;				/* file shrunk */
+    done += n;
+  }
+  if ( done < size )
+  { char *d;
+
+    if ( done == 0 )
+    { mf_free_buf(data, size);
+      data = NULL;
+    } else if ( (d = mf_realloc_buf(data, size, done)) )
+    { data = d;
+    } else
+    { mf_free_buf(data, size);
+      errno = ENOMEM;
+      return -1;
+    }
+  }
+
+  m->data      = data;
+  m->end       = done;
+  m->gap_start = done;
+
+  return 0;
+}
+
+
+static foreign_t
+file_to_memory_file(term_t file, term_t handle, term_t options)
+{ char *name;
+  IOENC encoding = ENC_UTF8;
+  term_t tail = PL_copy_term_ref(options);
+  term_t head = PL_new_term_ref();
+  term_t arg  = PL_new_term_ref();
+  struct stat st;
+  memfile *m;
+  int fd;
+
+  while(PL_get_list(tail, head, tail))
+  { size_t arity;
+    atom_t name;
+
+    if ( PL_get_name_arity(head, &name, &arity) && arity == 1 )
+    { _PL_get_arg(1, head, arg);
+      if ( name == ATOM_encoding )
+      { if ( !get_encoding(arg, &encoding) )
+	  return FALSE;
+      }
+    } else
+      return pl_error("file_to_memory_file", 3, NULL, ERR_TYPE,
+		      head, "option");
+  }
+  if ( !PL_get_nil(tail) )
+    return pl_error("file_to_memory_file", 3, NULL, ERR_TYPE, tail, "list");
+
+  if ( !PL_get_file_name(file, &name, PL_FILE_OSPATH|PL_FILE_READ) )
+    return FALSE;
+  if ( (fd=open(name, O_RDONLY|O_BINARY)) < 0 )
+    return pl_error(NULL, 0, NULL, ERR_ERRNO, errno, "open", "source_sink", file);
+  if ( fstat(fd, &st) != 0 )
+  { int e = errno;
+
+    close(fd);
+    return pl_error(NULL, 0, NULL, ERR_ERRNO, e, "stat", "file", file);
+  }
+
+  if ( !(m = calloc(1, sizeof(*m))) )
+  { close(fd);
+    return PL_resource_error("memory");
+  }
+  m->magic      = MEMFILE_MAGIC;
+  m->encoding   = encoding;
+  m->char_count = NOSIZE;
+#ifdef O_PLMT
+  pthread_mutex_init(&m->mutex, NULL);
+#endif
+
+  if ( st.st_size > 0 )
+  { size_t size = (size_t)st.st_size;
+#ifdef O_MMAP
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if ( data != MAP_FAILED )
+    { m->data      = data;
+      m->map_size  = size;
+      m->map_dev   = st.st_dev;
+      m->map_ino   = st.st_ino;
+      m->end       = size;
+      m->gap_start = size;
+    } else
+#endif
+    if ( read_file_data(fd, m, size) != 0 )
+    { int e = errno;
+
+      close(fd);
+      destroy_memory_file(m);
+      return pl_error(NULL, 0, NULL, ERR_ERRNO, e, "read", "file", file);
+    }
+  }
+  close(fd);
+
+  if ( unify_memfile(handle, m) )
+    return TRUE;
+
+  destroy_memory_file(m);
+  return FALSE;
+}
 
-static int
-mf_skip(memfile *mf, IOENC encoding, size_t from, size_t chars, size_t *end)
-{ size_t to;
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+memory_file_save(+Handle, +File)
+
+Write the content to File.  The data before and after the gap is written
+using a single writev() call.  For a rope we pass the chunks, at most
+MF_MAX_SEGMENTS per call.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#define MF_MAX_SEGMENTS 64
+
+typedef struct
+{ int		fd;			/* File we write to */
+  int		count;			/* # segments */
+  const char   *base[MF_MAX_SEGMENTS];	/* Segment start */
+  size_t	len[MF_MAX_SEGMENTS];	/* Segment length */
+} mf_segments;
+
+
+static int
+flush_segments(mf_segments *segs)
+{ int count = segs->count;
+  int i = 0;
+
+  segs->count = 0;
+#ifdef HAVE_WRITEV
+  { struct iovec iov[MF_MAX_SEGMENTS];
+    struct iovec *v = iov;
+
+    for(i=0; i<count; i++)
+    { iov[i].iov_base = (void*)segs->base[i];
+      iov[i].iov_len  = segs->len[i];
+    }
+    while( count > 0 )
+    { ssize_t n = writev(segs->fd, v, count);
+
+      if ( n < 0 )
+      { if ( errno == EINTR )
+	  continue;
+	return -1;
+      }
+      while( count > 0 && (size_t)n >= v->iov_len )
+      { n -= v->iov_len;
+	v++;
+	count--;
+      }
+      if ( count > 0 )
+      { v->iov_base = (char*)v->iov_base + n;
+	v->iov_len -= n;
+      }
+    }
+  }
+#else
+  for(i=0; i<count; i++)
+  { const char *s = segs->base[i];
+    size_t left = segs->len[i];
+
+    while( left > 0 )
+    { ssize_t n = write(segs->fd, s, left);
+
+      if ( n < 0 )
+      { if ( errno == EINTR )
+	  continue;
+	return -1;
+      }
+      s += n;
+      left -= n;
+    }
+  }
+#endif
+
+  return 0;
+}
+
+
+static int
+add_segment(const char *data, size_t len, void *closure)
+{ mf_segments *segs = closure;
+
+  if ( len == 0 )
+    return 0;
+  if ( segs->count == MF_MAX_SEGMENTS && flush_segments(segs) != 0 )
+    return -1;
+  segs->base[segs->count] = data;
+  segs->len[segs->count]  = len;
+  segs->count++;
+
+  return 0;
+}
+
+
+static foreign_t
+memory_file_save(term_t handle, term_t file)
+{ memfile *m;
+  int rc;
+
+  if ( get_memfile(handle, &m) )
+  { char *name;
+    mf_segments segs;
+
+    if ( m->stream && (m->stream->flags & SIO_OUTPUT) )
+    { rc = alreadyOpen(handle, "save");
+      goto out;
+    }
+    if ( !PL_get_file_name(file, &name, PL_FILE_OSPATH|PL_FILE_WRITE) )
+    { rc = FALSE;
+      goto out;
+    }
+
+#ifdef O_MMAP
+    if ( m->map_size )			/* unmodified mapping of this file */
+    { struct stat st;
+
+      if ( stat(name, &st) == 0 &&
+	   st.st_dev == m->map_dev && st.st_ino == m->map_ino )
+      { rc = TRUE;
+	goto out;
+      }
+    }
+#endif
+
+    if ( (segs.fd=open(name, O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0666)) < 0 )
+    { rc = pl_error(NULL, 0, NULL, ERR_ERRNO, errno,
+		    "open", "source_sink", file);
+      goto out;
+    }
+    segs.count = 0;
+
+    if ( m->rope )
+    { rc = rope_foreach(m->rope, add_segment, &segs);
+    } else
+    { size_t gap_end = m->gap_start + m->gap_size;
+
+      add_segment(m->data, m->gap_start, &segs);
+      add_segment(m->data+gap_end, m->end-gap_end, &segs);
+      rc = 0;
+    }
+    if ( rc == 0 )
+      rc = flush_segments(&segs);
+    if ( rc != 0 )
+    { int e = errno;
+
+      close(segs.fd);
+      rc = pl_error(NULL, 0, NULL, ERR_ERRNO, e, "write", "file", file);
+    } else if ( close(segs.fd) != 0 )
+    { rc = pl_error(NULL, 0, NULL, ERR_ERRNO, errno, "write", "file", file);
+    } else
+    { rc = TRUE;
+    }
+
+  out:
+    release_memfile(m);
+  } else
+    rc = FALSE;
+
+  return rc;
+}
+
+
+		 /*******************************
+		 *	  DIRECT EXCHANGE	*
+		 *******************************/
+
+static foreign_t
+can_modify_memory_file(term_t handle, memfile *mf)
+{ if ( mf->atom || mf->snapshot || mf->sealed )
+    return pl_error(NULL, 0, "read only",
+		    ERR_PERMISSION, handle, "modify", "memory_file");
+  if ( mf->log )
+    return pl_error(NULL, 0, "append only",
+		    ERR_PERMISSION, handle, "modify", "memory_file");
+  if ( mf->stream )
+    return alreadyOpen(handle, "modify");
+  if ( mf_writable(mf) != 0 )
+    return PL_resource_error("memory");
+
+  return TRUE;
+}
+
+
+/* Skip chars forward from a byte position, returning the new
+   byte position in the memory file or NOSIZE if we would skip
+   outside the limits of the memory file.  Returns:
+
+     OUTOFRANGE if memfile is too small
+     FALSE      if the encoding is not supported
+     TRUE       if ok
+*/
+
+#define OUTOFRANGE -1
+
+static int
+mf_skip(memfile *mf, IOENC encoding, size_t from, size_t chars, size_t *end)
+{ size_t to;
 
   switch(encoding)
   { case ENC_OCTET:
@@ -975,47 +2827,37 @@ mf_skip(memfile *mf, IOENC encoding, size_t from, size_t chars, size_t *end)
       to = from+chars;
       break;
     case ENC_UTF8:
-    { const char *start, *s, *e;
-      const size_t chars0 = (from == 0 ? chars : NOSIZE);
-
-      if ( from == 0 &&
-	   (mf->pcache.valid & V_CHARCOUNT) &&
-	   chars >= mf->pcache.char_count )
-      { from   = mf->pcache.byte_count;
-	chars -= mf->pcache.char_count;
+    { size_t len, off;
+
+      if ( mf_indexed(mf) )
+      { size_t c = mf_byte_to_char(mf, from) + chars;
+
+	if ( c > mf_total_chars(mf) )
+	  goto outofrange;
+	*end = mf_char_to_byte(mf, c);
+	return TRUE;
       }
 
       if ( from < mf->gap_start )
-      { start = s = &mf->data[from];
-	e = &mf->data[mf->gap_start];
-
-	while(chars>0 && s<e)
-	{ chars--;
-	  s = utf8_skip_char(s, e);
-	}
-	from += s - start;
-	if ( chars == 0 )
-	{ utf8_out:
-	  if ( chars0 != NOSIZE )
-	  { mf->pcache.char_count = chars0;
-	    mf->pcache.byte_count = from;
-	    mf->pcache.valid |= V_CHARCOUNT;
-	  }
-	  *end = from;
+      { len = mf->gap_start - from;
+	if ( (off=mf_utf8_find_char(&mf->data[from], len, chars)) != NOSIZE )
+	{ *end = from+off;
 	  return TRUE;
 	}
-	assert(s == e);
+	chars -= mf_utf8_chars(&mf->data[from], len);
+	from = mf->gap_start;
       }
 
-      start = s = &mf->data[mf->gap_size+from];
-      e = &mf->data[mf->end];
-      while(chars>0 && s<e)
-      { chars--;
-	s = utf8_skip_char(s, e);
+      len = mf->end - (mf->gap_size+from);
+      if ( (off=mf_utf8_find_char(&mf->data[mf->gap_size+from],
+				  len, chars)) != NOSIZE )
+      { *end = from+off;
+	return TRUE;
+      }
+      if ( mf_utf8_chars(&mf->data[mf->gap_size+from], len) == chars )
+      { *end = from+len;
+	return TRUE;
       }
-      from += s - start;
-      if ( chars == 0 )
-	goto utf8_out;
       goto outofrange;
     }
     case ENC_UNICODE_BE:
@@ -1050,61 +2892,835 @@ get_offset(term_t where, memfile *mf, IOENC encoding, size_t *pos)
     if ( rc != OUTOFRANGE )
       return rc;
 
-    return PL_domain_error("offset", where);
+    return PL_domain_error("offset", where);
+  }
+
+  return FALSE;
+}
+
+
+static foreign_t
+insert_memory_file(term_t handle, term_t where, term_t data)
+{ memfile *m;
+  int rc;
+
+  if ( get_memfile(handle, &m) )
+  { size_t pos;
+    int flags = CVT_ALL|CVT_WRITEQ|CVT_EXCEPTION;
+
+    if ( can_modify_memory_file(handle, m) &&
+	 get_offset(where, m, m->encoding, &pos) )
+    { move_gap_to(m, pos);
+      switch(m->encoding)
+      { case ENC_OCTET:
+	case ENC_ASCII:
+	case ENC_ISO_LATIN_1:
+	case ENC_ANSI:
+	case ENC_UTF8:
+	{ size_t len;
+	  char *buf;
+	  int rep = ( m->encoding == ENC_UTF8 ? REP_UTF8 :
+		      m->encoding == ENC_ANSI ? REP_MB :
+						REP_ISO_LATIN_1
+		    );
+
+	  if ( (rc=PL_get_nchars(data, &len, &buf, flags|rep)) )
+	  { if ( write_memfile(m, buf, len) < 0 )
+	      rc = PL_resource_error("memory");
+	    check_memfile(m);
+	  }
+	  break;
+	}
+	case ENC_WCHAR:
+	{ size_t len;
+	  wchar_t *buf;
+
+	  if ( (rc=PL_get_wchars(data, &len, &buf, flags)) )
+	  { if ( write_memfile(m, (void*)buf, len*sizeof(wchar_t)) < 0 )
+	      rc = PL_resource_error("memory");
+	  }
+	  break;
+	}
+	default:
+	  rc = PL_representation_error("encoding");
+      }
+    } else
+      rc = FALSE;
+
+    release_memfile(m);
+  } else
+    rc = FALSE;
+
+  return rc;
+}
+
+
+static foreign_t
+delete_memory_file(term_t handle, term_t where, term_t len)
+{ memfile *m;
+  int rc;
+
+  if ( get_memfile(handle, &m) )
+  { size_t pos, end;
+    size_t l;
+
+    if ( can_modify_memory_file(handle, m) &&
+	 get_offset(where, m, m->encoding, &pos) &&
+	 PL_get_size_ex(len, &l) &&
+	 mf_skip(m, m->encoding, pos, l, &end) != FALSE )
+    { if ( end > pos )
+      { if ( m->rope )
+	{ if ( rope_delete(m->rope, pos, end-pos) != 0 )
+	  { rc = PL_resource_error("memory");
+	    goto out;
+	  }
+	  m->end = rope_length(m->rope);
+	  m->gap_start = pos;
+	} else
+	{ size_t gap_end;
+
+	  move_gap_to(m, pos);
+	  gap_end = m->gap_start + m->gap_size;
+	  update_index(m, gap_end, &m->data[gap_end], end-pos, -1);
+	  m->gap_size += end-pos;
+	}
+	m->char_count = NOSIZE;
+      }
+      rc = TRUE;
+    } else
+      rc = FALSE;
+
+  out:
+    release_memfile(m);
+  } else
+    rc = FALSE;
+
+  return rc;
+}
+
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+memory_file_read_stream(+MF, +Stream, +Length, -Count)
+
+Append at most Length bytes from Stream to MF.  We first empty the input
+buffer of Stream and then call the read function of the stream directly
+with the gap of the memory file as buffer.  For a socket this implies we
+recv() straight into the memory file rather than copying the data twice
+through the stream buffer and the stream we write the memory file with.
+If Stream has a timeout we use Sfread() such that the timeout is
+honoured.  The rope backend has no gap, so here we read into a temporary
+buffer and insert that.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#define MF_READ_CHUNK (64*1024)
+
+static void copy_update_position(IOSTREAM *s, const char *data, size_t len);
+
+static ssize_t
+mf_read_stream(IOSTREAM *s, char *buf, size_t size)
+{ ssize_t n;
+
+  if ( s->bufp < s->limitp )
+  { n = s->limitp - s->bufp;
+    if ( (size_t)n > size )
+      n = size;
+    memcpy(buf, s->bufp, n);
+    s->bufp += n;
+  } else if ( s->timeout >= 0 || !s->functions->read )
+  { n = Sfread(buf, 1, size, s);
+    if ( Sferror(s) )
+      return -1;
+    return n;				/* Sfread() updated the position */
+  } else
+  { if ( (n = (*s->functions->read)(s->handle, buf, size)) < 0 )
+    { Sseterr(s, SIO_FERR, NULL);
+      return -1;
+    }
+    if ( n == 0 )
+      s->flags |= SIO_FEOF;
+  }
+
+  if ( s->position && n > 0 )
+  { copy_update_position(s, buf, n);
+    s->position->byteno += n;
+  }
+
+  return n;
+}
+
+
+static foreign_t
+memory_file_read_stream(term_t handle, term_t stream, term_t length,
+			term_t count)
+{ memfile *m;
+  int rc;
+
+  if ( get_memfile(handle, &m) )
+  { size_t len;
+    IOSTREAM *s;
+
+    if ( PL_is_atom(length) )
+    { atom_t a;
+
+      if ( !PL_get_atom(length, &a) || a != ATOM_infinite )
+      { rc = PL_domain_error("length", length);
+	goto out;
+      }
+      len = NOSIZE;
+    } else if ( !PL_get_size_ex(length, &len) )
+    { rc = FALSE;
+      goto out;
+    }
+
+    if ( !can_modify_memory_file(handle, m) ||
+	 !PL_get_stream(stream, &s, SIO_INPUT) )
+    { rc = FALSE;
+      goto out;
+    }
+
+    { size_t done = 0;
+      char *tmp = NULL;
+
+      rc = TRUE;
+      move_gap_to(m, m->end - m->gap_size);
+      m->char_count = NOSIZE;
+      while( done < len )
+      { size_t chunk = len - done;
+	ssize_t n;
+
+	char *buf;
+
+	if ( chunk > MF_READ_CHUNK )
+	  chunk = MF_READ_CHUNK;
+	if ( m->rope )
+	{ if ( !tmp && !(tmp = malloc(MF_READ_CHUNK)) )
+	  { rc = PL_resource_error("memory");
+	    break;
+	  }
+	  buf = tmp;
+	} else
+	{ if ( ensure_gap_size(m, chunk) != 0 )
+	  { rc = PL_resource_error("memory");
+	    break;
+	  }
+	  buf = &m->data[m->gap_start];
+	}
+	if ( (n=mf_read_stream(s, buf, chunk)) < 0 )
+	{ rc = FALSE;
+	  break;
+	}
+	if ( n == 0 )
+	  break;
+	if ( m->rope )
+	{ if ( rope_insert(m->rope, m->end, buf, n) != 0 )
+	  { rc = PL_resource_error("memory");
+	    break;
+	  }
+	  m->end = m->gap_start = rope_length(m->rope);
+	} else
+	{ update_index(m, m->gap_start, buf, n, 1);
+	  m->gap_start += n;
+	  m->gap_size  -= n;
+	}
+	done += n;
+      }
+      if ( tmp )
+	free(tmp);
+      check_memfile(m);
+
+      if ( !PL_release_stream(s) )
+	rc = FALSE;
+      if ( rc )
+	rc = PL_unify_int64(count, done);
+    }
+
+  out:
+    release_memfile(m);
+  } else
+    rc = FALSE;
+
+  return rc;
+}
+
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+memory_file_copy_to_stream(+MF, +Stream)
+memory_file_copy_to_stream(+MF, +Stream, +Offset, +Length)
+
+Write (a range of) the content of MF to Stream.  If Stream uses the same
+encoding as MF or is binary, the data is written as bytes from the gap
+buffer or the chunks of the rope.  Segments that do not fit in the
+stream buffer are written by flushing Stream and calling its write
+function directly, so a large memory file is sent to a socket without
+copying it through the stream buffers.  As we bypass the stream layer we
+update the position of Stream ourselves.  If the encodings differ we
+read the data through a temporary input stream and copy the characters.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static int
+raw_copy_encoding(IOENC from, IOENC to)
+{ if ( to == ENC_OCTET )
+    return TRUE;
+  if ( from != to )
+    return FALSE;
+
+  switch(to)
+  { case ENC_ASCII:
+    case ENC_ISO_LATIN_1:
+    case ENC_UTF8:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+
+static void
+copy_update_position(IOSTREAM *s, const char *data, size_t len)
+{ IOPOS *p = s->position;
+  const char *e = data+len;
+  const char *t = data;
+  size_t lines = mf_newlines(data, len);
+
+  p->charno += ( s->encoding == ENC_UTF8 ? mf_utf8_lead_bytes(data, len)
+					 : len );
+  if ( lines )
+  { p->lineno += (int)lines;
+    p->linepos = 0;
+    t += mf_find_newline(data, len, lines-1) + 1;
+  }
+  for(; t < e; t++)
+  { switch(*t)
+    { case '\t':
+	p->linepos |= 7;
+	p->linepos++;
+	break;
+      case '\r':
+	p->linepos = 0;
+	break;
+      case '\b':
+	if ( p->linepos > 0 )
+	  p->linepos--;
+	break;
+      default:
+	if ( s->encoding != ENC_UTF8 || !ISUTF8_CB(*t) )
+	  p->linepos++;
+    }
+  }
+}
+
+
+static int
+copy_segment(const char *data, size_t len, void *closure)
+{ IOSTREAM *s = closure;
+
+  if ( len < (size_t)s->bufsize && !(s->flags & SIO_NBUF) )
+    return Sfwrite(data, 1, len, s) == len ? 0 : -1;	/* updates position */
+
+  if ( Sflush(s) < 0 )
+    return -1;
+  if ( s->position )
+  { copy_update_position(s, data, len);
+    s->position->byteno += len;
+  }
+  while( len > 0 )
+  { ssize_t n = (*s->functions->write)(s->handle, (char*)data, len);
+
+    if ( n <= 0 )
+    { Sseterr(s, SIO_FERR, NULL);
+      return -1;
+    }
+    data += n;
+    len  -= n;
+  }
+
+  return 0;
+}
+
+
+typedef struct
+{ memfile      *mf;			/* Memory file we read */
+  size_t	here;			/* Current byte position */
+  size_t	end;			/* End of the range */
+} mf_range;
+
+static ssize_t
+read_memfile_range(void *handle, char *buf, size_t size)
+{ mf_range *r = handle;
+
+  if ( size > r->end - r->here )
+    size = r->end - r->here;
+  mf_read_range(r->mf, r->here, buf, size);
+  r->here += size;
+
+  return size;
+}
+
+
+static int
+close_memfile_range(void *handle)
+{ return 0;
+}
+
+
+static IOFUNCTIONS memfile_range_functions =
+{ read_memfile_range,
+  NULL,
+  NULL,
+  close_memfile_range
+};
+
+
+static int
+copy_text(memfile *m, size_t from, size_t to, IOSTREAM *out)
+{ mf_range r = { m, from, to };
+  IOSTREAM *in;
+  int c;
+
+  if ( !(in = Snew(&r, SIO_INPUT|SIO_FBUF|SIO_NOMUTEX,
+		   &memfile_range_functions)) )
+    return -1;
+  in->encoding = m->encoding;
+  while( (c=Sgetcode(in)) != -1 )
+  { if ( Sputcode(c, out) < 0 )
+      break;
+  }
+  Sclose(in);
+
+  return Sferror(out) ? -1 : 0;
+}
+
+
+static int
+copy_to_stream(memfile *m, size_t from, size_t to, IOSTREAM *s)
+{ if ( !raw_copy_encoding(m->encoding, s->encoding) )
+    return copy_text(m, from, to, s);
+
+  if ( m->rope )
+    return rope_foreach_range(m->rope, from, to-from, copy_segment, s);
+
+  if ( from < m->gap_start )
+  { size_t e = to < m->gap_start ? to : m->gap_start;
+
+    if ( copy_segment(m->data+from, e-from, s) != 0 )
+      return -1;
+    from = e;
+  }
+  if ( from < to )
+    return copy_segment(m->data+m->gap_size+from, to-from, s);
+
+  return 0;
+}
+
+
+static foreign_t
+memory_file_copy_to_stream4(term_t handle, term_t stream,
+			    term_t offset, term_t length)
+{ memfile *m;
+  int rc;
+
+  if ( get_memfile(handle, &m) )
+  { IOSTREAM *s;
+    size_t from, to;
+
+    if ( m->stream && (m->stream->flags & SIO_OUTPUT) )
+    { rc = alreadyOpen(handle, "copy");
+      goto out;
+    }
+    if ( offset )
+    { size_t l;
+
+      if ( !get_offset(offset, m, m->encoding, &from) ||
+	   !PL_get_size_ex(length, &l) ||
+	   mf_skip(m, m->encoding, from, l, &to) == FALSE )
+      { rc = FALSE;
+	goto out;
+      }
+    } else
+    { from = 0;
+      to = m->end - m->gap_size;
+    }
+
+    if ( !PL_get_stream(stream, &s, SIO_OUTPUT) )
+    { rc = FALSE;
+      goto out;
+    }
+    if ( m->log )
+      LOG_LOCK(m->log);
+    rc = from < to ? copy_to_stream(m, from, to, s) : 0;
+    if ( m->log )
+      LOG_UNLOCK(m->log);
+    if ( rc != 0 && !Sferror(s) )
+    { PL_release_stream(s);
+      rc = PL_resource_error("memory");
+    } else
+      rc = PL_release_stream(s);
+
+  out:
+    release_memfile(m);
+  } else
+    rc = FALSE;
+
+  return rc;
+}
+
+
+static foreign_t
+memory_file_copy_to_stream2(term_t handle, term_t stream)
+{ return memory_file_copy_to_stream4(handle, stream, 0, 0);
+}
+
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+'$memory_file_search'(+MF, +Pattern, +FromByte, +BaseByte, +BaseChar,
+		      -Byte, -Char)
+
+Find the first occurrence of Pattern at or after FromByte without
+converting the memory file to text.  BaseByte <= FromByte is a known
+character boundary at character offset BaseChar, typically the previous
+match.  Char is computed by counting from there, so enumerating all
+matches is linear in the size of the file rather than quadratic.  The pattern is encoded in the
+encoding of the memory file and searched for using the Two-Way algorithm
+of Crochemore and Perrin, which is linear in the size of the data and
+needs no tables.  While the algorithm would shift by one, we use
+memchr() to find the next candidate, which lets the vectorized memchr()
+of the C library skip most of the data.  The segments (the two parts of
+the gap buffer or the chunks of a rope) are searched in turn.  Matches
+that span two segments are found by searching the last plen-1 bytes of
+the previous segment(s) together with the start of the next.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+typedef struct
+{ const unsigned char *pat;		/* The pattern */
+  size_t	len;			/* Its length */
+  size_t	suffix;			/* Critical factorization */
+  size_t	period;			/* Period of the pattern */
+  int		periodic;		/* Pattern is periodic */
+} mf_pattern;
+
+static size_t
+critical_factorization(const unsigned char *x, size_t n, size_t *period)
+{ size_t max_suffix, max_suffix_rev, j, k, p;
+  unsigned char a, b;
+
+  max_suffix = (size_t)-1;		/* maximal suffix for < */
+  j = 0; k = p = 1;
+  while( j+k < n )
+  { a = x[j+k];
+    b = x[max_suffix+k];
+    if ( a < b )
+    { j += k;
+      k = 1;
+      p = j - max_suffix;
+    } else if ( a == b )
+    { if ( k != p )
+      { k++;
+      } else
+      { j += p;
+	k = 1;
+      }
+    } else
+    { max_suffix = j++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+
+  max_suffix_rev = (size_t)-1;		/* maximal suffix for > */
+  j = 0; k = p = 1;
+  while( j+k < n )
+  { a = x[j+k];
+    b = x[max_suffix_rev+k];
+    if ( b < a )
+    { j += k;
+      k = 1;
+      p = j - max_suffix_rev;
+    } else if ( a == b )
+    { if ( k != p )
+      { k++;
+      } else
+      { j += p;
+	k = 1;
+      }
+    } else
+    { max_suffix_rev = j++;
+      k = p = 1;
+    }
+  }
+
+  if ( max_suffix_rev+1 < max_suffix+1 )
+    return max_suffix+1;
+  *period = p;
+  return max_suffix_rev+1;
+}
+
+
+static void
+init_pattern(mf_pattern *p, const char *pat, size_t len)
+{ p->pat = (const unsigned char *)pat;
+  p->len = len;
+  if ( len > 1 )
+  { p->suffix = critical_factorization(p->pat, len, &p->period);
+    p->periodic = ( p->suffix + p->period <= len &&
+		    memcmp(p->pat, p->pat+p->period, p->suffix) == 0 );
+    if ( !p->periodic )
+      p->period = (p->suffix > len-p->suffix ? p->suffix
+					       : len-p->suffix) + 1;
+  }
+}
+
+
+/* Offset of the first match of p in h, or NOSIZE */
+
+static size_t
+find_pattern(const mf_pattern *p, const char *hs, size_t hn)
+{ const unsigned char *h = (const unsigned char *)hs;
+  const unsigned char *x = p->pat;
+  size_t n = p->len;
+  size_t suffix = p->suffix;
+  size_t memory = 0;
+  size_t i, j = 0;
+
+  if ( n > hn )
+    return NOSIZE;
+  if ( n == 1 )
+  { const char *m = memchr(hs, x[0], hn);
+
+    return m ? (size_t)(m-hs) : NOSIZE;
+  }
+
+  while( j <= hn-n )
+  { if ( memory == 0 && h[j+suffix] != x[suffix] )
+    { const unsigned char *c = memchr(h+j+suffix, x[suffix], hn-n-j+1);
+
+      if ( !c )
+	return NOSIZE;
+      j = c - (h+suffix);
+    }
+
+    i = suffix > memory ? suffix : memory;
+    while( i < n && x[i] == h[i+j] )
+      i++;
+    if ( i < n )
+    { j += i - suffix + 1;
+      memory = 0;
+      continue;
+    }
+
+    i = suffix;				/* match the left part backwards */
+    while( i > memory && x[i-1] == h[i-1+j] )
+      i--;
+    if ( i <= memory )
+      return j;
+    j += p->period;
+    if ( p->periodic )
+      memory = n - p->period;
+  }
+
+  return NOSIZE;
+}
+
+
+typedef struct
+{ mf_pattern	pattern;		/* What we search for */
+  size_t	pos;			/* Offset of the next segment */
+  char	       *carry;			/* Tail of the previous segments */
+  size_t	ncarry;			/* # bytes in carry (< pattern.len) */
+  size_t	found;			/* Offset of the match */
+} mf_search;
+
+static int
+search_segment(const char *data, size_t len, void *closure)
+{ mf_search *st = closure;
+  size_t keep = st->pattern.len-1;
+  size_t off;
+
+  if ( st->ncarry > 0 )			/* matches spanning segments */
+  { size_t take = len < keep ? len : keep;
+
+    memcpy(st->carry+st->ncarry, data, take);
+    if ( (off=find_pattern(&st->pattern, st->carry, st->ncarry+take))
+	 != NOSIZE && off < st->ncarry )
+    { st->found = st->pos - st->ncarry + off;
+      return 1;
+    }
+  }
+  if ( (off=find_pattern(&st->pattern, data, len)) != NOSIZE )
+  { st->found = st->pos + off;
+    return 1;
+  }
+
+  if ( keep > 0 )
+  { if ( len >= keep )
+    { memcpy(st->carry, data+len-keep, keep);
+      st->ncarry = keep;
+    } else
+    { size_t old = st->ncarry+len > keep ? keep-len : st->ncarry;
+
+      memmove(st->carry, st->carry+st->ncarry-old, old);
+      memcpy(st->carry+old, data, len);
+      st->ncarry = old+len;
+    }
+  }
+  st->pos += len;
+
+  return 0;
+}
+
+
+/* Logical offset of the first match at or after from, NOSIZE if there
+   is none or MF_NOMEM if we cannot allocate the carry buffer.
+*/
+
+#define MF_NOMEM ((size_t)-2)
+
+static size_t
+mf_search_from(memfile *m, const mf_pattern *pat, size_t from)
+{ size_t size = m->end - m->gap_size;
+  char buf[256];
+  mf_search st;
+
+  st.pattern = *pat;
+  st.pos     = from;
+  st.ncarry  = 0;
+  st.found   = NOSIZE;
+  if ( pat->len*2 <= sizeof(buf) )
+    st.carry = buf;
+  else if ( !(st.carry = malloc(pat->len*2)) )
+    return MF_NOMEM;
+
+  if ( m->rope )
+  { rope_foreach_range(m->rope, from, size-from, search_segment, &st);
+  } else
+  { int done = FALSE;
+
+    if ( from < m->gap_start )
+      done = search_segment(m->data+from, m->gap_start-from, &st);
+    if ( !done )
+    { size_t at = from > m->gap_start ? from : m->gap_start;
+
+      search_segment(m->data+m->gap_size+at, size-at, &st);
+    }
+  }
+
+  if ( st.carry != buf )
+    free(st.carry);
+
+  return st.found;
+}
+
+
+/* Character offset of byte.  base_byte <= byte is a character boundary
+   at character offset base_char, so we only need to count from there.
+*/
+
+static int
+mf_char_offset(memfile *m, size_t byte, size_t base_byte, size_t base_char,
+	       size_t *chr)
+{ switch(m->encoding)
+  { case ENC_OCTET:
+    case ENC_ASCII:
+    case ENC_ISO_LATIN_1:
+      *chr = byte;
+      return TRUE;
+    case ENC_WCHAR:
+      *chr = byte/sizeof(wchar_t);
+      return TRUE;
+    case ENC_UTF8:
+      if ( mf_indexed(m) )
+      { *chr = mf_byte_to_char(m, byte);
+      } else
+      { size_t from = ( base_byte <= m->gap_start ? base_byte
+						  : base_byte+m->gap_size );
+	size_t to   = byte <= m->gap_start ? byte : byte+m->gap_size;
+
+	*chr = base_char + count_phys(m, from, to, FALSE);
+      }
+      return TRUE;
+    default:
+      return PL_representation_error("encoding");
   }
-
-  return FALSE;
 }
 
 
 static foreign_t
-insert_memory_file(term_t handle, term_t where, term_t data)
+memory_file_search(term_t handle, term_t pattern, term_t from,
+		   term_t base_byte, term_t base_char,
+		   term_t byte, term_t chr)
 { memfile *m;
   int rc;
 
   if ( get_memfile(handle, &m) )
-  { size_t pos;
-    int flags = CVT_ALL|CVT_WRITEQ|CVT_EXCEPTION;
-
-    if ( can_modify_memory_file(handle, m) &&
-	 get_offset(where, m, m->encoding, &pos) )
-    { move_gap_to(m, pos);
-      switch(m->encoding)
-      { case ENC_OCTET:
-	case ENC_ASCII:
-	case ENC_ISO_LATIN_1:
-	case ENC_ANSI:
-	case ENC_UTF8:
-	{ size_t len;
-	  char *buf;
-	  int rep = ( m->encoding == ENC_UTF8 ? REP_UTF8 :
-		      m->encoding == ENC_ANSI ? REP_MB :
-						REP_ISO_LATIN_1
-		    );
+  { size_t start, bbyte, bchar, at, c;
+    size_t unit = 1;
+    int flags = CVT_ATOM|CVT_STRING|CVT_LIST|CVT_EXCEPTION;
+    mf_pattern pat;
+    size_t len;
+    char *s;
+    pl_wchar_t *ws;
+
+    if ( m->stream && (m->stream->flags & SIO_OUTPUT) && !m->log )
+    { rc = alreadyOpen(handle, "search");
+      goto out;
+    }
+    if ( !PL_get_size_ex(from, &start) ||
+	 !PL_get_size_ex(base_byte, &bbyte) ||
+	 !PL_get_size_ex(base_char, &bchar) )
+    { rc = FALSE;
+      goto out;
+    }
+    if ( bbyte > start )
+    { rc = PL_domain_error("search_base", base_byte);
+      goto out;
+    }
 
-	  if ( (rc=PL_get_nchars(data, &len, &buf, flags|rep)) )
-	  { if ( write_memfile(m, buf, len) < 0 )
-	      rc = PL_resource_error("memory");
-	    check_memfile(m);
-	  }
-	  break;
+    switch(m->encoding)
+    { case ENC_OCTET:
+      case ENC_ASCII:
+      case ENC_ISO_LATIN_1:
+	rc = PL_get_nchars(pattern, &len, &s, flags|REP_ISO_LATIN_1);
+	break;
+      case ENC_UTF8:
+	rc = PL_get_nchars(pattern, &len, &s, flags|REP_UTF8);
+	break;
+      case ENC_WCHAR:
+	if ( (rc = PL_get_wchars(pattern, &len, &ws, flags)) )
+	{ s = (char *)ws;
+	  unit = sizeof(wchar_t);
+	  len *= unit;
 	}
-	case ENC_WCHAR:
-	{ size_t len;
-	  wchar_t *buf;
+	break;
+      default:
+	rc = PL_representation_error("encoding");
+    }
+    if ( !rc )
+      goto out;
+    if ( len == 0 )
+    { rc = PL_domain_error("non_empty_text", pattern);
+      goto out;
+    }
 
-	  if ( (rc=PL_get_wchars(data, &len, &buf, flags)) )
-	  { if ( write_memfile(m, (void*)buf, len*sizeof(wchar_t)) < 0 )
-	      rc = PL_resource_error("memory");
-	  }
-	  break;
-	}
-	default:
-	  rc = PL_representation_error("encoding");
-      }
-    } else
-      rc = FALSE;
+    init_pattern(&pat, s, len);
+    if ( m->log )
+      LOG_LOCK(m->log);
+    if ( start > m->end - m->gap_size )
+      at = NOSIZE;
+    else
+    { at = start;
+      while( (at=mf_search_from(m, &pat, at)) < MF_NOMEM && at%unit != 0 )
+	at++;
+    }
+    if ( at == MF_NOMEM )
+      rc = PL_resource_error("memory");
+    else
+      rc = ( at != NOSIZE &&
+	     mf_char_offset(m, at, bbyte, bchar, &c) &&
+	     PL_unify_int64(byte, at) &&
+	     PL_unify_int64(chr, c) );
+    if ( m->log )
+      LOG_UNLOCK(m->log);
 
+  out:
     release_memfile(m);
   } else
     rc = FALSE;
@@ -1113,36 +3729,54 @@ insert_memory_file(term_t handle, term_t where, term_t data)
 }
 
 
-static foreign_t
-delete_memory_file(term_t handle, term_t where, term_t len)
-{ memfile *m;
-  int rc;
+/* Unify UTF-8 text.  Pure ASCII is passed as ISO Latin 1 and other
+   valid UTF-8 is decoded by the vectorized decoder.  Invalid UTF-8 is
+   left to Prolog's own conversion.
+*/
 
-  if ( get_memfile(handle, &m) )
-  { size_t pos, end;
-    size_t l;
+static int
+unify_utf8_text(term_t t, int flags, size_t len, const char *data)
+{ size_t ascii = mf_ascii_prefix(data, len);
 
-    if ( can_modify_memory_file(handle, m) &&
-	 get_offset(where, m, m->encoding, &pos) &&
-	 PL_get_size_ex(len, &l) &&
-	 mf_skip(m, m->encoding, pos, l, &end) != FALSE )
-    { if ( end > pos )
-      { if ( pos < m->pcache.byte_count )
-	  m->pcache.valid = 0;
+  if ( ascii == len )
+    return PL_unify_chars(t, flags, len, data);
+#ifdef MF_UTF8_DECODE
+  if ( mf_utf8_valid(data+ascii, len-ascii) == len-ascii )
+  { size_t chars = ascii + mf_utf8_chars(data+ascii, len-ascii);
+    pl_wchar_t *buf;
 
-	move_gap_to(m, pos);
-	m->gap_size += end-pos;
-	m->char_count = NOSIZE;
-      }
-      rc = TRUE;
-    } else
-      rc = FALSE;
+    if ( (buf = malloc(chars*sizeof(*buf))) )
+    { int rc;
 
-    release_memfile(m);
-  } else
-    rc = FALSE;
+      mf_utf8_decode(data, len, buf);
+      rc = PL_unify_wchars(t, flags, chars, buf);
+      free(buf);
 
-  return rc;
+      return rc;
+    }
+  }
+#endif
+
+  return PL_unify_chars(t, flags|REP_UTF8, len, data);
+}
+
+
+static int
+unify_mf_text(term_t atom, IOENC enc, term_t encoding, int flags,
+	      size_t len, const char *data)
+{ switch(enc)
+  { case ENC_ISO_LATIN_1:
+    case ENC_OCTET:
+      return PL_unify_chars(atom, flags, len, data);
+    case ENC_WCHAR:
+      return PL_unify_wchars(atom, flags,
+			     len/sizeof(wchar_t),
+			     (pl_wchar_t*)data);
+    case ENC_UTF8:
+      return unify_utf8_text(atom, flags, len, data);
+    default:
+      return PL_domain_error("encoding", encoding);
+  }
 }
 
 
@@ -1175,36 +3809,35 @@ mf_to_text(term_t handle, memfile *m, size_t from, size_t len,
       return FALSE;
   }
 
-  if ( m->data )
+  if ( m->rope ||			/* cannot move a shared gap */
+       (m->share && start < m->gap_start && end > m->gap_start) )
+  { size_t len = end-start;
+    char *data;
+    int rc;
+
+    if ( !(data = malloc(len+1)) )
+      return PL_resource_error("memory");
+    mf_read_range(m, start, data, len);
+    rc = unify_mf_text(atom, enc, encoding, flags, len, data);
+    free(data);
+
+    return rc;
+  } else if ( m->data )
   { size_t len = end-start;
     const char *data;
 
-    if ( start <= m->gap_start && end <= m->gap_start )
+    if ( end <= m->gap_start )
     { data = &m->data[start];
-    } else if ( start >= m->gap_start+m->gap_size )
-    { data = &m->data[m->gap_size + (start-m->gap_start)];
+    } else if ( start >= m->gap_start )
+    { data = &m->data[start + m->gap_size];
     } else
     { move_gap_to(m, end);
       data = &m->data[start];
     }
 
-    switch(enc)
-    { case ENC_ISO_LATIN_1:
-      case ENC_OCTET:
-	return PL_unify_chars(atom, flags, len, data);
-      case ENC_WCHAR:
-	return PL_unify_wchars(atom, flags,
-			       len/sizeof(wchar_t),
-			       (pl_wchar_t*)data);
-      case ENC_UTF8:
-	return PL_unify_chars(atom, flags|REP_UTF8, len, data);
-      default:
-	return PL_domain_error("encoding", encoding);
-    }
+    return unify_mf_text(atom, enc, encoding, flags, len, data);
   } else
     return PL_unify_chars(atom, flags, 0, "");
-
-  return FALSE;
 }
 
 
@@ -1310,6 +3943,43 @@ memory_file_substring(term_t handle,
    count that belongs to that.
 */
 
+/* The rope and the index maintain newline and character counts, so we
+   can skip lines in O(log n).  The counts are exact for single byte
+   encodings and UTF-8.
+*/
+
+static int
+indexed_skip_lines(memfile *mf, size_t from, size_t lines,
+		   size_t *startp, size_t *chcountp)
+{ size_t line, c0, pos;
+
+  switch(mf->encoding)
+  { case ENC_OCTET:
+    case ENC_ASCII:
+    case ENC_ISO_LATIN_1:
+    case ENC_UTF8:
+      break;
+    default:
+      return PL_representation_error("encoding");
+  }
+
+  line = mf_byte_to_line(mf, from) + lines;
+  c0   = ( mf->encoding == ENC_UTF8 ? mf_byte_to_char(mf, from) : from );
+  if ( (pos=mf_line_to_byte(mf, line)) == NOSIZE )
+  { size_t size = mf->end - mf->gap_size;
+
+    *startp   = size;
+    *chcountp = ( mf->encoding == ENC_UTF8 ? mf_total_chars(mf) : size ) - c0;
+    return OUTOFRANGE;
+  }
+
+  *startp   = pos;
+  *chcountp = ( mf->encoding == ENC_UTF8 ? mf_byte_to_char(mf, pos)
+					 : pos ) - c0;
+  return TRUE;
+}
+
+
 static int
 skip_lines(memfile *mf, size_t from, size_t lines,
 	   size_t *startp, size_t *chcountp)
@@ -1322,6 +3992,19 @@ skip_lines(memfile *mf, size_t from, size_t lines,
     return TRUE;
   }
 
+  switch(mf->encoding)
+  { case ENC_OCTET:
+    case ENC_ASCII:
+    case ENC_ISO_LATIN_1:
+    case ENC_UTF8:
+      if ( mf_indexed(mf) )
+	return indexed_skip_lines(mf, from, lines, startp, chcountp);
+      break;
+    default:
+      if ( mf->rope )
+	return PL_representation_error("encoding");
+  }
+
   if ( from < mf->gap_start )
   { start = s = mf->data+from;
     e = &mf->data[mf->gap_start];
@@ -1348,15 +4031,19 @@ skip_lines(memfile *mf, size_t from, size_t lines,
       break;
     case ENC_UTF8:
       while( s < e )
-      { chcount++;
-	if ( *s == '\n' )
-	{ if ( --lines == 0 )
-	  { *startp   = from + (s-start) + 1;
-	    *chcountp = chcount;
-	    return TRUE;
-	  }
+      { const char *nl = memchr(s, '\n', e-s);
+
+	if ( !nl )
+	{ chcount += mf_utf8_chars(s, e-s);
+	  break;
+	}
+	chcount += mf_utf8_chars(s, nl+1-s);
+	s = nl+1;
+	if ( --lines == 0 )
+	{ *startp   = from + (s-start);
+	  *chcountp = chcount;
+	  return TRUE;
 	}
-	s = utf8_skip_char(s, e);
       }
       break;
     case ENC_WCHAR:
@@ -1407,6 +4094,10 @@ memory_file_line_position(term_t handle,
   if ( get_memfile(handle, &mf) )
   { size_t l, lp, o;
 
+    if ( mf->stream && (mf->stream->flags & SIO_OUTPUT) )
+    { rc = alreadyOpen(handle, "line_position");
+      goto out;
+    }
     if ( get_size_or_var(line, &l) &&
 	 get_size_or_var(linepos, &lp) &&
 	 get_size_or_var(offset, &o) )
@@ -1464,11 +4155,243 @@ memory_file_line_position(term_t handle,
 }
 
 
+		 /*******************************
+		 *		HASH		*
+		 *******************************/
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+memory_file_hash(+Handle, -Hash, +Options)
+
+Compute a secure hash over the bytes of the memory file.  The segments
+before and after the gap (or the chunks of a rope) are fed directly into
+the hash function, so no copy of the data is made.  The hash is returned
+as a hexadecimal atom, compatible with stream_hash/2 from
+library(hash_stream).
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+typedef enum hash_algorithm
+{ ALGORITHM_MD5,
+  ALGORITHM_SHA1,
+  ALGORITHM_SHA224,
+  ALGORITHM_SHA256,
+  ALGORITHM_SHA384,
+  ALGORITHM_SHA512
+} hash_algorithm;
+
+typedef struct hash_context
+{ hash_algorithm    algorithm;
+  unsigned long	    digest_size;
+  union
+  { md5_state_t md5;
+    sha1_ctx	sha1;
+    sha2_ctx    sha2;
+  } state;
+} hash_context;
+
+#define HASH_CHUNK ((size_t)1<<30)	/* sha*_hash() takes unsigned long */
+
+static int
+hash_segment(const char *data, size_t len, void *closure)
+{ hash_context *ctx = closure;
+
+  while ( len > 0 )
+  { size_t chunk = len < HASH_CHUNK ? len : HASH_CHUNK;
+    const unsigned char *d = (const unsigned char *)data;
+
+    switch ( ctx->algorithm )
+    { case ALGORITHM_MD5:
+	md5_append(&ctx->state.md5, d, chunk);
+	break;
+      case ALGORITHM_SHA1:
+	sha1_hash(d, (unsigned long)chunk, &ctx->state.sha1);
+	break;
+      default:
+	sha2_hash(d, (unsigned long)chunk, &ctx->state.sha2);
+	break;
+    }
+    data += chunk;
+    len  -= chunk;
+  }
+
+  return 0;
+}
+
+
+static int
+get_hash_algorithm(term_t t, hash_algorithm *ap)
+{ atom_t a;
+
+  if ( PL_get_atom_ex(t, &a) )
+  { if ( a == ATOM_md5 )
+      *ap = ALGORITHM_MD5;
+    else if ( a == ATOM_sha1 )
+      *ap = ALGORITHM_SHA1;
+    else if ( a == ATOM_sha224 )
+      *ap = ALGORITHM_SHA224;
+    else if ( a == ATOM_sha256 )
+      *ap = ALGORITHM_SHA256;
+    else if ( a == ATOM_sha384 )
+      *ap = ALGORITHM_SHA384;
+    else if ( a == ATOM_sha512 )
+      *ap = ALGORITHM_SHA512;
+    else
+      return PL_domain_error("algorithm", t);
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+
+static void
+hash_begin(hash_context *ctx, hash_algorithm algorithm)
+{ ctx->algorithm = algorithm;
+
+  switch(algorithm)
+  { case ALGORITHM_MD5:
+      ctx->digest_size = 16;
+      md5_init(&ctx->state.md5);
+      break;
+    case ALGORITHM_SHA1:
+      ctx->digest_size = SHA1_DIGEST_SIZE;
+      sha1_begin(&ctx->state.sha1);
+      break;
+    default:
+      switch(algorithm)
+      { case ALGORITHM_SHA224: ctx->digest_size = SHA224_DIGEST_SIZE; break;
+	case ALGORITHM_SHA256: ctx->digest_size = SHA256_DIGEST_SIZE; break;
+	case ALGORITHM_SHA384: ctx->digest_size = SHA384_DIGEST_SIZE; break;
+	default:	       ctx->digest_size = SHA512_DIGEST_SIZE; break;
+      }
+      sha2_begin(ctx->digest_size, &ctx->state.sha2);
+      break;
+  }
+}
+
+
+static int
+unify_hash(term_t t, hash_context *ctx)
+{ unsigned char digest[SHA2_MAX_DIGEST_SIZE];
+  char hex[SHA2_MAX_DIGEST_SIZE*2];
+  static const char hexd[] = "0123456789abcdef";
+  unsigned long i;
+
+  switch(ctx->algorithm)
+  { case ALGORITHM_MD5:
+      md5_finish(&ctx->state.md5, (md5_byte_t*)digest);
+      break;
+    case ALGORITHM_SHA1:
+      sha1_end(digest, &ctx->state.sha1);
+      break;
+    default:
+      sha2_end(digest, &ctx->state.sha2);
+      break;
+  }
+
+  for(i=0; i<ctx->digest_size; i++)
+  { hex[i*2]   = hexd[(digest[i] >> 4) & 0x0f];
+    hex[i*2+1] = hexd[digest[i] & 0x0f];
+  }
+
+  return PL_unify_atom_nchars(t, ctx->digest_size*2, hex);
+}
+
+
+static void
+hash_range(memfile *m, size_t from, size_t to, hash_context *ctx)
+{ if ( m->rope )
+  { rope_foreach_range(m->rope, from, to-from, hash_segment, ctx);
+    return;
+  }
+
+  if ( from < m->gap_start )
+  { size_t e = to < m->gap_start ? to : m->gap_start;
+
+    hash_segment(m->data+from, e-from, ctx);
+    from = e;
+  }
+  if ( from < to )
+    hash_segment(m->data+m->gap_size+from, to-from, ctx);
+}
+
+
+static foreign_t
+memory_file_hash(term_t handle, term_t hash, term_t options)
+{ hash_algorithm algorithm = ALGORITHM_SHA1;
+  size_t offset = 0, length = NOSIZE;
+  term_t offset_term = 0;
+  term_t tail = PL_copy_term_ref(options);
+  term_t head = PL_new_term_ref();
+  term_t arg  = PL_new_term_ref();
+  memfile *m;
+  int rc;
+
+  while(PL_get_list_ex(tail, head, tail))
+  { atom_t name;
+    size_t arity;
+
+    if ( !PL_get_name_arity(head, &name, &arity) || arity != 1 )
+      return PL_type_error("option", head);
+    _PL_get_arg(1, head, arg);
+
+    if ( name == ATOM_algorithm )
+    { if ( !get_hash_algorithm(arg, &algorithm) )
+	return FALSE;
+    } else if ( name == ATOM_offset )
+    { if ( !PL_get_size_ex(arg, &offset) )
+	return FALSE;
+      offset_term = PL_copy_term_ref(arg);
+    } else if ( name == ATOM_length )
+    { if ( !PL_get_size_ex(arg, &length) )
+	return FALSE;
+    }
+  }
+  if ( !PL_get_nil_ex(tail) )
+    return FALSE;
+
+  if ( get_memfile(handle, &m) )
+  { hash_context ctx;
+    size_t size;
+
+    if ( m->stream && (m->stream->flags & SIO_OUTPUT) && !m->log )
+    { rc = alreadyOpen(handle, "hash");
+      goto out;
+    }
+
+    if ( m->log )
+      LOG_LOCK(m->log);
+    size = m->end - m->gap_size;
+    if ( offset > size )
+    { rc = PL_domain_error("offset", offset_term);
+    } else
+    { size_t to = (length > size-offset ? size : offset+length);
+
+      hash_begin(&ctx, algorithm);
+      hash_range(m, offset, to, &ctx);
+      rc = TRUE;
+    }
+    if ( m->log )
+      LOG_UNLOCK(m->log);
+    if ( rc )
+      rc = unify_hash(hash, &ctx);
+
+  out:
+    release_memfile(m);
+  } else
+    rc = FALSE;
+
+  return rc;
+}
+
+
 #define MKATOM(n) ATOM_ ## n = PL_new_atom(#n);
 
 install_t
 install_memfile()
-{ MKATOM(encoding);
+{ mf_utf8_init();
+
+  MKATOM(encoding);
   MKATOM(unknown);
   MKATOM(octet);
   MKATOM(ascii);
@@ -1484,8 +4407,25 @@ install_memfile()
   MKATOM(update);
   MKATOM(insert);
   MKATOM(free_on_close);
+  MKATOM(infinite);
+  MKATOM(backend);
+  MKATOM(gap);
+  MKATOM(rope);
+  MKATOM(append_only);
+  MKATOM(capacity);
+  MKATOM(memfd);
+  MKATOM(algorithm);
+  MKATOM(offset);
+  MKATOM(length);
+  MKATOM(md5);
+  MKATOM(sha1);
+  MKATOM(sha224);
+  MKATOM(sha256);
+  MKATOM(sha384);
+  MKATOM(sha512);
 
   PL_register_foreign("new_memory_file",	   1, new_memory_file,	      0);
+  PL_register_foreign("new_memory_file",	   2, new_memory_file2,	      0);
   PL_register_foreign("free_memory_file",	   1, free_memory_file,	      0);
   PL_register_foreign("size_memory_file",	   2, size_memory_file2,      0);
   PL_register_foreign("size_memory_file",	   3, size_memory_file3,      0);
@@ -1503,4 +4443,19 @@ install_memfile()
   PL_register_foreign("delete_memory_file",	   3, delete_memory_file,     0);
   PL_register_foreign("memory_file_substring",     5, memory_file_substring,  0);
   PL_register_foreign("memory_file_line_position", 4, memory_file_line_position, 0);
+  PL_register_foreign("memory_file_read_stream",   4, memory_file_read_stream, 0);
+  PL_register_foreign("file_to_memory_file",	   3, file_to_memory_file,    0);
+  PL_register_foreign("memory_file_save",	   2, memory_file_save,	      0);
+  PL_register_foreign("memory_file_snapshot",	   2, memory_file_snapshot,   0);
+  PL_register_foreign("memory_file_shrink",	   1, memory_file_shrink,     0);
+  PL_register_foreign("memory_file_copy_to_stream", 2,
+		      memory_file_copy_to_stream2, 0);
+  PL_register_foreign("memory_file_copy_to_stream", 4,
+		      memory_file_copy_to_stream4, 0);
+  PL_register_foreign("$memory_file_search",	   7, memory_file_search,     0);
+  PL_register_foreign("memory_file_hash",	   3, memory_file_hash,	      0);
+#ifdef O_MEMFD
+  PL_register_foreign("memory_file_seal",	   1, memory_file_seal,	      0);
+  PL_register_foreign("memory_file_open_fd",	   3, memory_file_open_fd,    0);
+#endif
 }
@@ -35,6 +35,7 @@
 
 :- module(memory_file,
           [ new_memory_file/1,          % -Handle
+            new_memory_file/2,          % -Handle, +Options
             free_memory_file/1,         % +Handle
             size_memory_file/2,         % +Handle, -Size
             size_memory_file/3,         % +Handle, -Size, +Encoding
@@ -51,11 +52,55 @@
             memory_file_to_string/3,    % +Handle, -String, +Encoding
             memory_file_substring/5,    % +Handle, +Before, +Length, +After, -String
             memory_file_line_position/4,% +Handle, ?Line, ?ListPos, ?Offset
+            memory_file_read_stream/4,  % +Handle, +Stream, +Length, -Count
+            file_to_memory_file/3,      % +File, -Handle, +Options
+            memory_file_save/2,         % +Handle, +File
+            memory_file_snapshot/2,     % +Handle, -Snapshot
+            memory_file_shrink/1,       % +Handle
+            memory_file_copy_to_stream/2, % +Handle, +Stream
+            memory_file_copy_to_stream/4, % +Handle, +Stream, +Offset, +Length
+            memory_file_search/4,       % +Handle, +Pattern, -Offset, -ByteOffset
+            memory_file_hash/3,         % +Handle, -Hash, +Options
+            memory_file_seal/1,         % +Handle
+            memory_file_open_fd/3,      % +Handle, +Mode, -Stream
             utf8_position_memory_file/3 % +Handle, -Here, -Size
           ]).
 :- use_foreign_library(foreign(memfile)).
 
+:- predicate_options(new_memory_file/2, 2,
+                     [ backend(oneof([gap,rope,memfd])),
+                       append_only(boolean),
+                       capacity(nonneg)
+                     ]).
+:- predicate_options(file_to_memory_file/3, 3,
+                     [ encoding(encoding)
+                     ]).
 :- predicate_options(open_memory_file/4, 4,
                      [ encoding(encoding),
                        free_on_close(boolean)
                      ]).
+:- predicate_options(memory_file_hash/3, 3,
+                     [ algorithm(oneof([md5,sha1,sha224,sha256,sha384,sha512])),
+                       offset(nonneg),
+                       length(nonneg)
+                     ]).
+
+%!  memory_file_search(+Handle, +Pattern, -Offset, -ByteOffset) is nondet.
+%
+%   True when Pattern appears in Handle at character Offset, which is
+%   at ByteOffset in the data. Enumerates all, possibly overlapping,
+%   matches on backtracking.
+
+memory_file_search(MF, Pattern, Offset, ByteOffset) :-
+    search_from(MF, Pattern, 0, 0-0, Offset, ByteOffset).
+
+%   Base is the Byte-Char pair of the previous match, from which the
+%   character offset of the next match is counted.
+
+search_from(MF, Pattern, From, BaseB-BaseC, Offset, ByteOffset) :-
+    '$memory_file_search'(MF, Pattern, From, BaseB, BaseC, B, C),
+    (   Offset = C,
+        ByteOffset = B
+    ;   Next is B+1,
+        search_from(MF, Pattern, Next, B-C, Offset, ByteOffset)
+    ).
@@ -0,0 +1,801 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "memrope.h"
+#include "memutf8.h"
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Rope backend for memory files.
+
+The text is stored as a sequence of chunks of at most ROPE_CHUNK bytes.
+The chunks are the nodes of a treap ordered by position, where each node
+maintains the byte, character and newline count of its subtree.  Small
+edits are done in place in the chunk that holds the position, so typing
+text at a cursor only moves the bytes of a single chunk.  Larger edits
+split the tree at the edit position and merge the parts.  Nothing ever
+copies the whole text.
+
+Characters are counted as UTF-8 lead bytes and lines as newline bytes.
+These counts are exact for UTF-8 and single byte encodings.
+
+Nodes are reference counted such that rope_snapshot() can share the
+tree.  A node that is shared is never modified: own() replaces it by a
+private copy on the path to the modification (path copying).  Only
+the thread that owns the rope modifies it, but snapshots may be released
+by any thread, so the reference counts are updated atomically.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#define ROPE_CHUNK 4096			/* Max bytes in a chunk */
+#define NOSIZE ((size_t)-1)
+
+#ifdef _MSC_VER
+#include <windows.h>
+#define ATOMIC_INC(p) InterlockedIncrement((LONG volatile*)(p))
+#define ATOMIC_DEC(p) InterlockedDecrement((LONG volatile*)(p))
+#define ATOMIC_GET(p) InterlockedCompareExchange((LONG volatile*)(p), 0, 0)
+#else
+#define ATOMIC_INC(p) __atomic_add_fetch(p, 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_DEC(p) __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL)
+#define ATOMIC_GET(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#endif
+
+typedef struct rope_node
+{ struct rope_node *left;		/* Text before me */
+  struct rope_node *right;		/* Text after me */
+  char	       *data;			/* My chunk */
+  unsigned int	len;			/* Bytes in data */
+  unsigned int	size;			/* Allocated size of data */
+  unsigned int	prio;			/* Treap priority */
+  unsigned int	nchars;			/* Characters in data */
+  unsigned int	nlines;			/* Newlines in data */
+  unsigned int	refs;			/* Reference count */
+  size_t	t_bytes;		/* Bytes in subtree */
+  size_t	t_chars;		/* Characters in subtree */
+  size_t	t_lines;		/* Newlines in subtree */
+} rope_node;
+
+struct rope
+{ rope_node    *root;			/* Root of the treap */
+  unsigned int	seed;			/* Random state for priorities */
+};
+
+#define BYTES(n) ((n) ? (n)->t_bytes : 0)
+#define CHARS(n) ((n) ? (n)->t_chars : 0)
+#define LINES(n) ((n) ? (n)->t_lines : 0)
+
+
+static unsigned int
+rope_random(rope *r)
+{ unsigned int x = r->seed;		/* xorshift32 */
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return r->seed = x;
+}
+
+
+static void
+count_text(const char *s, size_t len, unsigned int *chars, unsigned int *lines)
+{ *chars = (unsigned int)mf_utf8_chars(s, len);
+  *lines = (unsigned int)mf_newlines(s, len);
+}
+
+
+static void
+update(rope_node *n)
+{ n->t_bytes = n->len    + BYTES(n->left) + BYTES(n->right);
+  n->t_chars = n->nchars + CHARS(n->left) + CHARS(n->right);
+  n->t_lines = n->nlines + LINES(n->left) + LINES(n->right);
+}
+
+
+static rope_node *
+new_node(rope *r, const char *data, size_t len)
+{ rope_node *n;
+
+  if ( !(n = calloc(1, sizeof(*n))) )
+    return NULL;
+  if ( len > 0 )
+  { if ( !(n->data = malloc(len)) )
+    { free(n);
+      return NULL;
+    }
+    memcpy(n->data, data, len);
+  }
+  n->len  = (unsigned int)len;
+  n->size = (unsigned int)len;
+  n->prio = rope_random(r);
+  n->refs = 1;
+  count_text(data, len, &n->nchars, &n->nlines);
+  update(n);
+
+  return n;
+}
+
+
+static void
+free_node(rope_node *n)
+{ if ( n->data )
+    free(n->data);
+  free(n);
+}
+
+
+/* Drop a reference to n, freeing the subtree if this was the last */
+
+static void
+free_tree(rope_node *n)
+{ if ( n && ATOMIC_DEC(&n->refs) == 0 )
+  { free_tree(n->left);
+    free_tree(n->right);
+    free_node(n);
+  }
+}
+
+
+/* Make sure *np is not shared, such that we may modify it.  The copy
+   shares the children.  Returns -1 on allocation failure.
+*/
+
+static int
+own(rope_node **np)
+{ rope_node *n = *np;
+  rope_node *c;
+
+  if ( !n || ATOMIC_GET(&n->refs) == 1 )
+    return 0;
+
+  if ( !(c = calloc(1, sizeof(*c))) )
+    return -1;
+  if ( n->size > 0 )
+  { if ( !(c->data = malloc(n->size)) )
+    { free(c);
+      return -1;
+    }
+    memcpy(c->data, n->data, n->len);
+  }
+  c->left    = n->left;			/* n->refs may change concurrently */
+  c->right   = n->right;
+  c->len     = n->len;
+  c->size    = n->size;
+  c->prio    = n->prio;
+  c->nchars  = n->nchars;
+  c->nlines  = n->nlines;
+  c->refs    = 1;
+  c->t_bytes = n->t_bytes;
+  c->t_chars = n->t_chars;
+  c->t_lines = n->t_lines;
+  if ( c->left )
+    ATOMIC_INC(&c->left->refs);
+  if ( c->right )
+    ATOMIC_INC(&c->right->refs);
+
+  free_tree(n);
+  *np = c;
+
+  return 0;
+}
+
+
+/* Own all nodes on the path split() follows to pos.  These are the
+   only nodes modified by split() and, as the spines of the resulting
+   trees, by merge().
+*/
+
+static int
+own_path(rope_node **np, size_t pos)
+{ while( *np )
+  { rope_node *n;
+    size_t lb;
+
+    if ( own(np) < 0 )
+      return -1;
+    n  = *np;
+    lb = BYTES(n->left);
+    if ( pos <= lb )
+    { np = &n->left;
+    } else if ( pos >= lb + n->len )
+    { pos -= lb + n->len;
+      np = &n->right;
+    } else
+      break;
+  }
+
+  return 0;
+}
+
+
+static rope_node *
+merge(rope_node *a, rope_node *b)
+{ if ( !a )
+    return b;
+  if ( !b )
+    return a;
+
+  if ( a->prio > b->prio )
+  { a->right = merge(a->right, b);
+    update(a);
+    return a;
+  } else
+  { b->left = merge(a, b->left);
+    update(b);
+    return b;
+  }
+}
+
+
+/* Split the tree at byte offset pos.  If pos is inside a chunk, the
+   chunk is split using *spare, which the caller allocated such that
+   split() itself cannot fail.
+*/
+
+static void
+split(rope_node *n, size_t pos, rope_node **lp, rope_node **rp,
+      rope_node **spare)
+{ size_t lb;
+
+  if ( !n )
+  { *lp = *rp = NULL;
+    return;
+  }
+
+  lb = BYTES(n->left);
+  if ( pos <= lb )
+  { split(n->left, pos, lp, &n->left, spare);
+    update(n);
+    *rp = n;
+  } else if ( pos >= lb + n->len )
+  { split(n->right, pos-lb-n->len, &n->right, rp, spare);
+    update(n);
+    *lp = n;
+  } else
+  { size_t off = pos - lb;
+    rope_node *m = *spare;
+
+    *spare = NULL;
+    memcpy(m->data, n->data+off, n->len-off);
+    m->len  = n->len - (unsigned int)off;
+    m->prio = n->prio;			/* keeps n->right a valid child */
+    count_text(m->data, m->len, &m->nchars, &m->nlines);
+    m->right = n->right;
+    update(m);
+
+    n->len    = (unsigned int)off;
+    n->nchars -= m->nchars;
+    n->nlines -= m->nlines;
+    n->right  = NULL;
+    update(n);
+
+    *lp = n;
+    *rp = m;
+  }
+}
+
+
+static rope_node *
+new_spare(void)
+{ rope_node *n;
+
+  if ( !(n = calloc(1, sizeof(*n))) )
+    return NULL;
+  if ( !(n->data = malloc(ROPE_CHUNK)) )
+  { free(n);
+    return NULL;
+  }
+  n->size = ROPE_CHUNK;
+  n->refs = 1;
+
+  return n;
+}
+
+
+/* Try to insert in place in the chunk that holds at.  Returns 1 if
+   done, 0 if the chunk has no room and -1 on allocation failure.
+*/
+
+static int
+insert_in_place(rope_node **np, size_t at, const char *data, size_t len)
+{ rope_node *n;
+  size_t lb;
+  int rc;
+
+  if ( !*np )
+    return 0;
+  if ( own(np) < 0 )
+    return -1;
+
+  n  = *np;
+  lb = BYTES(n->left);
+  if ( at < lb )
+  { rc = insert_in_place(&n->left, at, data, len);
+  } else if ( at <= lb + n->len )
+  { size_t off = at - lb;
+    unsigned int chars, lines;
+
+    if ( n->len + len > ROPE_CHUNK )
+      return 0;
+    if ( n->len + len > n->size )
+    { size_t size = n->size ? n->size : 64;
+      char *p;
+
+      while( size < n->len + len )
+	size *= 2;
+      if ( size > ROPE_CHUNK )
+	size = ROPE_CHUNK;
+      if ( !(p = realloc(n->data, size)) )
+	return -1;
+      n->data = p;
+      n->size = (unsigned int)size;
+    }
+    memmove(n->data+off+len, n->data+off, n->len-off);
+    memcpy(n->data+off, data, len);
+    n->len += (unsigned int)len;
+    count_text(data, len, &chars, &lines);
+    n->nchars += chars;
+    n->nlines += lines;
+    rc = 1;
+  } else
+  { rc = insert_in_place(&n->right, at-lb-n->len, data, len);
+  }
+
+  if ( rc == 1 )
+    update(n);
+
+  return rc;
+}
+
+
+/* Try to delete in place if the range is inside a single chunk.
+   Returns 1 if done, 0 otherwise and -1 on allocation failure.
+*/
+
+static int
+delete_in_place(rope_node **np, size_t at, size_t len)
+{ rope_node *n;
+  size_t lb;
+  int rc;
+
+  if ( !*np )
+    return 0;
+  if ( own(np) < 0 )
+    return -1;
+
+  n  = *np;
+  lb = BYTES(n->left);
+  if ( at + len <= lb )
+  { rc = delete_in_place(&n->left, at, len);
+  } else if ( at >= lb + n->len )
+  { rc = delete_in_place(&n->right, at-lb-n->len, len);
+  } else if ( at >= lb && at + len <= lb + n->len &&
+	      len < n->len )
+  { size_t off = at - lb;
+    unsigned int chars, lines;
+
+    count_text(n->data+off, len, &chars, &lines);
+    memmove(n->data+off, n->data+off+len, n->len-(off+len));
+    n->len    -= (unsigned int)len;
+    n->nchars -= chars;
+    n->nlines -= lines;
+    rc = 1;
+  } else
+  { return 0;
+  }
+
+  if ( rc == 1 )
+    update(n);
+
+  return rc;
+}
+
+
+		 /*******************************
+		 *	       API		*
+		 *******************************/
+
+rope *
+rope_new(void)
+{ rope *r = calloc(1, sizeof(*r));
+
+  if ( r )
+    r->seed = 0x9e3779b9;
+
+  return r;
+}
+
+
+/* Create an immutable copy of r that shares all nodes with r */
+
+rope *
+rope_snapshot(const rope *r)
+{ rope *c = malloc(sizeof(*c));
+
+  if ( c )
+  { *c = *r;
+    if ( c->root )
+      ATOMIC_INC(&c->root->refs);
+  }
+
+  return c;
+}
+
+
+void
+rope_clear(rope *r)
+{ free_tree(r->root);
+  r->root = NULL;
+}
+
+
+void
+rope_free(rope *r)
+{ rope_clear(r);
+  free(r);
+}
+
+
+size_t
+rope_length(const rope *r)
+{ return BYTES(r->root);
+}
+
+
+size_t
+rope_chars(const rope *r)
+{ return CHARS(r->root);
+}
+
+
+size_t
+rope_lines(const rope *r)
+{ return LINES(r->root);
+}
+
+
+int
+rope_insert(rope *r, size_t at, const char *data, size_t len)
+{ rope_node *mid = NULL, *spare = NULL, *left, *right;
+  int rc;
+
+  if ( len == 0 )
+    return 0;
+  if ( len <= ROPE_CHUNK &&
+       (rc=insert_in_place(&r->root, at, data, len)) != 0 )
+    return rc < 0 ? -1 : 0;
+
+  while(len > 0)			/* build the new text */
+  { size_t chunk = len > ROPE_CHUNK ? ROPE_CHUNK : len;
+    rope_node *n;
+
+    if ( !(n = new_node(r, data, chunk)) )
+    { free_tree(mid);
+      return -1;
+    }
+    mid = merge(mid, n);
+    data += chunk;
+    len  -= chunk;
+  }
+  if ( !(spare = new_spare()) )
+  { free_tree(mid);
+    return -1;
+  }
+  if ( own_path(&r->root, at) < 0 )
+  { free_tree(mid);
+    free_node(spare);
+    return -1;
+  }
+
+  split(r->root, at, &left, &right, &spare);
+  r->root = merge(merge(left, mid), right);
+  if ( spare )
+    free_node(spare);
+
+  return 0;
+}
+
+
+int
+rope_delete(rope *r, size_t at, size_t len)
+{ rope_node *spare1, *spare2, *left, *mid, *right;
+  int rc;
+
+  if ( len == 0 )
+    return 0;
+  if ( (rc=delete_in_place(&r->root, at, len)) != 0 )
+    return rc < 0 ? -1 : 0;
+
+  if ( !(spare1 = new_spare()) )
+    return -1;
+  if ( !(spare2 = new_spare()) )
+  { free_node(spare1);
+    return -1;
+  }
+  if ( own_path(&r->root, at) < 0 )
+  { rc = -1;
+    goto out;
+  }
+
+  split(r->root, at, &left, &mid, &spare1);
+  if ( own_path(&mid, len) < 0 )
+  { r->root = merge(left, mid);
+    rc = -1;
+    goto out;
+  }
+  split(mid, len, &mid, &right, &spare2);
+  free_tree(mid);
+  r->root = merge(left, right);
+  rc = 0;
+
+out:
+  if ( spare1 )
+    free_node(spare1);
+  if ( spare2 )
+    free_node(spare2);
+
+  return rc;
+}
+
+
+static size_t
+read_range(const rope_node *n, size_t at, char *buf, size_t len)
+{ size_t done = 0;
+  size_t lb;
+
+  if ( !n || len == 0 )
+    return 0;
+
+  lb = BYTES(n->left);
+  if ( at < lb )
+  { done = read_range(n->left, at, buf, len);
+    at = lb;
+  }
+  if ( done < len && at < lb + n->len )
+  { size_t off = at - lb;
+    size_t c = n->len - off;
+
+    if ( c > len - done )
+      c = len - done;
+    memcpy(buf+done, n->data+off, c);
+    done += c;
+    at = lb + n->len;
+  }
+  if ( done < len )
+    done += read_range(n->right, at-lb-n->len, buf+done, len-done);
+
+  return done;
+}
+
+
+size_t
+rope_read(const rope *r, size_t at, char *buf, size_t len)
+{ return read_range(r->root, at, buf, len);
+}
+
+
+size_t
+rope_byte_to_char(const rope *r, size_t byte)
+{ const rope_node *n = r->root;
+  size_t chars = 0;
+
+  while( n )
+  { size_t lb = BYTES(n->left);
+
+    if ( byte < lb )
+    { n = n->left;
+    } else
+    { chars += CHARS(n->left);
+      byte  -= lb;
+      if ( byte < n->len )
+      { unsigned int c, l;
+
+	count_text(n->data, byte, &c, &l);
+	return chars + c;
+      }
+      chars += n->nchars;
+      byte  -= n->len;
+      n = n->right;
+    }
+  }
+
+  return chars;
+}
+
+
+/* Byte offset of the start of character chr or the length of the
+   rope if chr is the number of characters.
+*/
+
+size_t
+rope_char_to_byte(const rope *r, size_t chr)
+{ const rope_node *n = r->root;
+  size_t bytes = 0;
+
+  while( n )
+  { size_t lc = CHARS(n->left);
+
+    if ( chr < lc )
+    { n = n->left;
+    } else
+    { bytes += BYTES(n->left);
+      chr   -= lc;
+      if ( chr < n->nchars )
+	return bytes + mf_utf8_find_char(n->data, n->len, chr);
+      bytes += n->len;
+      chr   -= n->nchars;
+      n = n->right;
+    }
+  }
+
+  return bytes;
+}
+
+
+size_t
+rope_byte_to_line(const rope *r, size_t byte)
+{ const rope_node *n = r->root;
+  size_t lines = 0;
+
+  while( n )
+  { size_t lb = BYTES(n->left);
+
+    if ( byte < lb )
+    { n = n->left;
+    } else
+    { lines += LINES(n->left);
+      byte  -= lb;
+      if ( byte < n->len )
+      { unsigned int c, l;
+
+	count_text(n->data, byte, &c, &l);
+	return lines + l;
+      }
+      lines += n->nlines;
+      byte  -= n->len;
+      n = n->right;
+    }
+  }
+
+  return lines;
+}
+
+
+/* Byte offset just after the line-th newline (counting from 1).  Line
+   0 is the start of the text.  Returns NOSIZE if there are not that
+   many newlines.
+*/
+
+size_t
+rope_line_to_byte(const rope *r, size_t line)
+{ const rope_node *n = r->root;
+  size_t bytes = 0;
+
+  if ( line == 0 )
+    return 0;
+  if ( line > LINES(n) )
+    return NOSIZE;
+
+  line--;				/* 0-based index of the newline */
+  while( n )
+  { size_t ll = LINES(n->left);
+
+    if ( line < ll )
+    { n = n->left;
+    } else
+    { bytes += BYTES(n->left);
+      line  -= ll;
+      if ( line < n->nlines )
+	return bytes + mf_find_newline(n->data, n->len, line) + 1;
+      bytes += n->len;
+      line  -= n->nlines;
+      n = n->right;
+    }
+  }
+
+  return NOSIZE;
+}
+
+
+/* Call f on all chunks in order.  Stops if f returns non-zero and
+   returns this value.
+*/
+
+static int
+foreach_node(const rope_node *n, rope_chunk_func f, void *closure)
+{ int rc;
+
+  if ( !n )
+    return 0;
+  if ( (rc=foreach_node(n->left, f, closure)) ||
+       (rc=(*f)(n->data, n->len, closure)) )
+    return rc;
+
+  return foreach_node(n->right, f, closure);
+}
+
+
+int
+rope_foreach(const rope *r, rope_chunk_func f, void *closure)
+{ return foreach_node(r->root, f, closure);
+}
+
+
+/* As rope_foreach(), but only for the bytes [at,at+len).  Chunks are
+   clipped to the range.
+*/
+
+static int
+foreach_range(const rope_node *n, size_t at, size_t len,
+	      rope_chunk_func f, void *closure)
+{ int rc;
+
+  while( n && len > 0 )
+  { size_t lb = n->left ? n->left->t_bytes : 0;
+
+    if ( at < lb )
+    { size_t l = lb-at < len ? lb-at : len;
+
+      if ( (rc=foreach_range(n->left, at, l, f, closure)) )
+	return rc;
+      at = lb;
+      len -= l;
+      if ( len == 0 )
+	break;
+    }
+    at -= lb;
+    if ( at < n->len )
+    { size_t l = n->len-at < len ? n->len-at : len;
+
+      if ( (rc=(*f)(n->data+at, l, closure)) )
+	return rc;
+      at = n->len;
+      len -= l;
+    }
+    at -= n->len;
+    n = n->right;
+  }
+
+  return 0;
+}
+
+
+int
+rope_foreach_range(const rope *r, size_t at, size_t len,
+		   rope_chunk_func f, void *closure)
+{ return foreach_range(r->root, at, len, f, closure);
+}
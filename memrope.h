@@ -0,0 +1,69 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef H_MEMROPE_INCLUDED
+#define H_MEMROPE_INCLUDED
+
+#include <stddef.h>
+
+/* A rope is a balanced tree (treap) of byte chunks.  Each node keeps
+   the number of bytes, UTF-8 characters and newlines in its subtree,
+   such that conversion between byte, character and line offsets as
+   well as insert and delete are O(log n).  Snapshots share the tree
+   with the original and cost O(1).
+*/
+
+typedef struct rope rope;
+typedef int (*rope_chunk_func)(const char *data, size_t len, void *closure);
+
+/* memrope.c */
+rope *		rope_new(void);
+rope *		rope_snapshot(const rope *r);
+void		rope_free(rope *r);
+void		rope_clear(rope *r);
+size_t		rope_length(const rope *r);
+size_t		rope_chars(const rope *r);
+size_t		rope_lines(const rope *r);
+int		rope_insert(rope *r, size_t at, const char *data, size_t len);
+int		rope_delete(rope *r, size_t at, size_t len);
+size_t		rope_read(const rope *r, size_t at, char *buf, size_t len);
+size_t		rope_byte_to_char(const rope *r, size_t byte);
+size_t		rope_char_to_byte(const rope *r, size_t chr);
+size_t		rope_byte_to_line(const rope *r, size_t byte);
+size_t		rope_line_to_byte(const rope *r, size_t line);
+int		rope_foreach(const rope *r, rope_chunk_func f, void *closure);
+int		rope_foreach_range(const rope *r, size_t at, size_t len,
+				   rope_chunk_func f, void *closure);
+
+#endif /*H_MEMROPE_INCLUDED*/
@@ -0,0 +1,622 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#include <config.h>
+#include <string.h>
+#include <stdint.h>
+#include "memutf8.h"
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Vectorized UTF-8 scanning.
+
+Counting characters is counting the bytes that are not a continuation
+byte (0x80..0xbf).  As signed bytes these are exactly the bytes that are
+larger than -65, so a compare and a subtract count 16 or 32 bytes at a
+time.  The byte counters are flushed to 64-bit sums using psadbw before
+they can overflow.  Validation and decoding skip ASCII runs using the
+sign bits and handle the (rare) multibyte sequences in plain C.
+
+The SSE2 kernels are part of the x86-64 baseline.  The AVX2 kernels are
+compiled using a target attribute and selected by mf_utf8_init() if the
+CPU supports them.  Other platforms use the portable C kernels.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#define NOSIZE ((size_t)-1)
+#define FIND_STEP 256			/* Bytes counted per step by find */
+
+#define ISUTF8_CB(c)  (((c)&0xc0) == 0x80) /* Is continuation byte */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define O_SSE2 1
+#include <emmintrin.h>
+#if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define O_AVX2 1
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef struct kernels
+{ size_t (*count_lead)(const char *s, size_t len);
+  size_t (*count_byte)(const char *s, size_t len, int c);
+  size_t (*ascii_prefix)(const char *s, size_t len);
+#ifdef MF_UTF8_DECODE
+  void	 (*widen)(const char *s, size_t len, wchar_t *out);
+#endif
+} kernels;
+
+
+		 /*******************************
+		 *	     PORTABLE C		*
+		 *******************************/
+
+static size_t
+count_lead_c(const char *s, size_t len)
+{ const char *e = s+len;
+  size_t count = 0;
+
+  for(; s<e; s++)
+  { if ( !ISUTF8_CB(*s) )
+      count++;
+  }
+
+  return count;
+}
+
+static size_t
+count_byte_c(const char *s, size_t len, int c)
+{ const char *e = s+len;
+  size_t count = 0;
+
+  while( s<e && (s=memchr(s, c, e-s)) )
+  { count++;
+    s++;
+  }
+
+  return count;
+}
+
+static size_t
+ascii_prefix_c(const char *s, size_t len)
+{ size_t i;
+
+  for(i=0; i<len && !(s[i]&0x80); i++)
+    ;
+
+  return i;
+}
+
+#ifdef MF_UTF8_DECODE
+static void
+widen_c(const char *s, size_t len, wchar_t *out)
+{ const unsigned char *p = (const unsigned char *)s;
+  size_t i;
+
+  for(i=0; i<len; i++)
+    out[i] = p[i];
+}
+#endif
+
+
+		 /*******************************
+		 *	       SSE2		*
+		 *******************************/
+
+#ifdef O_SSE2
+
+static size_t
+sum_sse2(__m128i acc)
+{ acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+
+  return (size_t)_mm_cvtsi128_si32(acc) + (size_t)_mm_extract_epi16(acc, 4);
+}
+
+static size_t
+count_lead_sse2(const char *s, size_t len)
+{ const __m128i limit = _mm_set1_epi8(-65);
+  size_t count = 0;
+
+  while( len >= 16 )
+  { size_t n = len/16;
+    __m128i acc = _mm_setzero_si128();
+
+    if ( n > 255 )
+      n = 255;
+    len -= n*16;
+    for(; n > 0; n--, s += 16)
+    { __m128i v = _mm_loadu_si128((const __m128i*)s);
+
+      acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, limit));
+    }
+    count += sum_sse2(acc);
+  }
+
+  return count + count_lead_c(s, len);
+}
+
+static size_t
+count_byte_sse2(const char *s, size_t len, int c)
+{ const __m128i cv = _mm_set1_epi8((char)c);
+  size_t count = 0;
+
+  while( len >= 16 )
+  { size_t n = len/16;
+    __m128i acc = _mm_setzero_si128();
+
+    if ( n > 255 )
+      n = 255;
+    len -= n*16;
+    for(; n > 0; n--, s += 16)
+    { __m128i v = _mm_loadu_si128((const __m128i*)s);
+
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, cv));
+    }
+    count += sum_sse2(acc);
+  }
+
+  return count + count_byte_c(s, len, c);
+}
+
+static size_t
+ascii_prefix_sse2(const char *s, size_t len)
+{ size_t i;
+
+  for(i=0; i+16 <= len; i += 16)
+  { int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s+i)));
+
+    if ( mask )
+      return i + __builtin_ctz(mask);
+  }
+
+  return i + ascii_prefix_c(s+i, len-i);
+}
+
+#ifdef MF_UTF8_DECODE
+static void
+widen_sse2(const char *s, size_t len, wchar_t *out)
+{ const __m128i zero = _mm_setzero_si128();
+  size_t i;
+
+  for(i=0; i+16 <= len; i += 16)
+  { __m128i v  = _mm_loadu_si128((const __m128i*)(s+i));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128i *o = (__m128i*)(out+i);
+
+    _mm_storeu_si128(o+0, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128(o+1, _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128(o+2, _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128(o+3, _mm_unpackhi_epi16(hi, zero));
+  }
+
+  widen_c(s+i, len-i, out+i);
+}
+#endif
+
+#endif /*O_SSE2*/
+
+
+		 /*******************************
+		 *	       AVX2		*
+		 *******************************/
+
+#ifdef O_AVX2
+
+static AVX2 size_t
+sum_avx2(__m256i acc)
+{ __m128i sum;
+
+  acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+  sum = _mm_add_epi64(_mm256_castsi256_si128(acc),
+		      _mm256_extracti128_si256(acc, 1));
+
+  return (size_t)_mm_cvtsi128_si32(sum) + (size_t)_mm_extract_epi16(sum, 4);
+}
+
+static AVX2 size_t
+count_lead_avx2(const char *s, size_t len)
+{ const __m256i limit = _mm256_set1_epi8(-65);
+  size_t count = 0;
+
+  while( len >= 32 )
+  { size_t n = len/32;
+    __m256i acc = _mm256_setzero_si256();
+
+    if ( n > 255 )
+      n = 255;
+    len -= n*32;
+    for(; n > 0; n--, s += 32)
+    { __m256i v = _mm256_loadu_si256((const __m256i*)s);
+
+      acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, limit));
+    }
+    count += sum_avx2(acc);
+  }
+
+  return count + count_lead_sse2(s, len);
+}
+
+static AVX2 size_t
+count_byte_avx2(const char *s, size_t len, int c)
+{ const __m256i cv = _mm256_set1_epi8((char)c);
+  size_t count = 0;
+
+  while( len >= 32 )
+  { size_t n = len/32;
+    __m256i acc = _mm256_setzero_si256();
+
+    if ( n > 255 )
+      n = 255;
+    len -= n*32;
+    for(; n > 0; n--, s += 32)
+    { __m256i v = _mm256_loadu_si256((const __m256i*)s);
+
+      acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, cv));
+    }
+    count += sum_avx2(acc);
+  }
+
+  return count + count_byte_sse2(s, len, c);
+}
+
+static AVX2 size_t
+ascii_prefix_avx2(const char *s, size_t len)
+{ size_t i;
+
+  for(i=0; i+32 <= len; i += 32)
+  { unsigned int mask =
+      (unsigned int)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(s+i)));
+
+    if ( mask )
+      return i + __builtin_ctz(mask);
+  }
+
+  return i + ascii_prefix_sse2(s+i, len-i);
+}
+
+#ifdef MF_UTF8_DECODE
+static AVX2 void
+widen_avx2(const char *s, size_t len, wchar_t *out)
+{ size_t i;
+
+  for(i=0; i+32 <= len; i += 32)
+  { __m256i *o = (__m256i*)(out+i);
+    int j;
+
+    for(j=0; j<4; j++)
+    { __m128i v = _mm_loadl_epi64((const __m128i*)(s+i+j*8));
+
+      _mm256_storeu_si256(o+j, _mm256_cvtepu8_epi32(v));
+    }
+  }
+
+  widen_sse2(s+i, len-i, out+i);
+}
+#endif
+
+#endif /*O_AVX2*/
+
+
+		 /*******************************
+		 *	      DISPATCH		*
+		 *******************************/
+
+#ifdef O_SSE2
+#ifdef MF_UTF8_DECODE
+#define WIDEN_SSE2 , widen_sse2
+#define WIDEN_AVX2 , widen_avx2
+#else
+#define WIDEN_SSE2
+#define WIDEN_AVX2
+#endif
+static kernels kern = { count_lead_sse2, count_byte_sse2, ascii_prefix_sse2
+			WIDEN_SSE2 };
+#else
+#ifdef MF_UTF8_DECODE
+static kernels kern = { count_lead_c, count_byte_c, ascii_prefix_c, widen_c };
+#else
+static kernels kern = { count_lead_c, count_byte_c, ascii_prefix_c };
+#endif
+#endif
+
+/* Select the best kernels for the running CPU.  Must be called before
+   any other thread uses the functions below.
+*/
+
+void
+mf_utf8_init(void)
+{
+#ifdef O_AVX2
+  static const kernels avx2 = { count_lead_avx2, count_byte_avx2,
+				ascii_prefix_avx2 WIDEN_AVX2 };
+
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports("avx2") )
+    kern = avx2;
+#endif
+}
+
+
+		 /*******************************
+		 *	    COUNT AND FIND	*
+		 *******************************/
+
+/* Invalid UTF-8 is read by the stream layer one byte per character
+   for each byte that does not start a complete sequence.  Counting lead
+   bytes is only correct for valid UTF-8, so we validate first and count
+   the remainder using the same rules as the stream decoder.
+*/
+
+static size_t utf8_valid_until(const char *s, size_t len, size_t min);
+
+static size_t
+utf8_skip_char(const unsigned char *s, size_t len)
+{ unsigned int c = s[0];
+  size_t n, i;
+
+  if ( (c&0xe0) == 0xc0 )
+    n = 2;
+  else if ( (c&0xf0) == 0xe0 )
+    n = 3;
+  else if ( (c&0xf8) == 0xf0 )
+    n = 4;
+  else if ( (c&0xfc) == 0xf8 )
+    n = 5;
+  else if ( (c&0xfe) == 0xfc )
+    n = 6;
+  else
+    return 1;
+
+  if ( len < n )
+    return 1;
+  for(i=1; i<n; i++)
+  { if ( !ISUTF8_CB(s[i]) )
+      return 1;
+  }
+
+  return n;
+}
+
+static size_t
+utf8_chars_lenient(const char *s, size_t len)
+{ const unsigned char *p = (const unsigned char *)s;
+  const unsigned char *e = p+len;
+  size_t count = 0;
+
+  for(; p < e; count++)
+    p += utf8_skip_char(p, e-p);
+
+  return count;
+}
+
+size_t
+mf_utf8_chars(const char *s, size_t len)
+{ size_t valid = mf_utf8_valid(s, len);
+  size_t count = (*kern.count_lead)(s, valid);
+
+  if ( valid < len )
+    count += utf8_chars_lenient(s+valid, len-valid);
+
+  return count;
+}
+
+/* Number of bytes in s that are not a continuation byte.  This equals
+   mf_utf8_chars() for valid UTF-8 and, unlike mf_utf8_chars(), does not
+   depend on where a buffer splits a sequence.  Used to update stream
+   positions block by block.
+*/
+
+size_t
+mf_utf8_lead_bytes(const char *s, size_t len)
+{ return (*kern.count_lead)(s, len);
+}
+
+size_t
+mf_newlines(const char *s, size_t len)
+{ return (*kern.count_byte)(s, len, '\n');
+}
+
+size_t
+mf_ascii_prefix(const char *s, size_t len)
+{ return (*kern.ascii_prefix)(s, len);
+}
+
+/* Offset of the k-th (0-based) UTF-8 character in s.  Valid steps
+   are counted by the kernel, after which we scan character by character.
+*/
+
+size_t
+mf_utf8_find_char(const char *s, size_t len, size_t k)
+{ const unsigned char *p = (const unsigned char *)s;
+  size_t off = 0;
+
+  while( len-off >= FIND_STEP )
+  { size_t step = utf8_valid_until(s+off, len-off, FIND_STEP);
+    size_t c;
+
+    if ( step < FIND_STEP )
+      break;
+    if ( (c = (*kern.count_lead)(s+off, step)) > k )
+      break;
+    k   -= c;
+    off += step;
+  }
+  while( off < len )
+  { if ( k-- == 0 )
+      return off;
+    off += utf8_skip_char(p+off, len-off);
+  }
+
+  return NOSIZE;
+}
+
+/* Offset of the k-th (0-based) newline in s */
+
+size_t
+mf_find_newline(const char *s, size_t len, size_t k)
+{ const char *e = s+len;
+  const char *p = s;
+
+  while( e-p >= FIND_STEP )
+  { size_t c = (*kern.count_byte)(p, FIND_STEP, '\n');
+
+    if ( c > k )
+      break;
+    k -= c;
+    p += FIND_STEP;
+  }
+  while( p<e && (p=memchr(p, '\n', e-p)) )
+  { if ( k-- == 0 )
+      return p-s;
+    p++;
+  }
+
+  return NOSIZE;
+}
+
+
+		 /*******************************
+		 *     VALIDATE AND DECODE	*
+		 *******************************/
+
+/* Length of the well-formed multibyte sequence at s or 0.  This is
+   strict: overlong forms, surrogates and code points above 0x10ffff
+   are rejected.
+*/
+
+static size_t
+utf8_seq_len(const unsigned char *s, size_t len)
+{ unsigned int c = s[0];
+  unsigned int lo = 0x80, hi = 0xbf;
+  size_t n, i;
+
+  if ( c >= 0xc2 && c <= 0xdf )
+  { n = 2;
+  } else if ( c >= 0xe0 && c <= 0xef )
+  { n = 3;
+    if ( c == 0xe0 )
+      lo = 0xa0;
+    else if ( c == 0xed )
+      hi = 0x9f;
+  } else if ( c >= 0xf0 && c <= 0xf4 )
+  { n = 4;
+    if ( c == 0xf0 )
+      lo = 0x90;
+    else if ( c == 0xf4 )
+      hi = 0x8f;
+  } else
+    return 0;
+
+  if ( len < n || s[1] < lo || s[1] > hi )
+    return 0;
+  for(i=2; i<n; i++)
+  { if ( !ISUTF8_CB(s[i]) )
+      return 0;
+  }
+
+  return n;
+}
+
+/* Length of the longest valid UTF-8 prefix of s, stopping at the first
+   character boundary at or after min.
+*/
+
+static size_t
+utf8_valid_until(const char *s, size_t len, size_t min)
+{ const unsigned char *p = (const unsigned char *)s;
+  const unsigned char *e = p+len;
+  const unsigned char *m = p+min;
+
+  while( p < m )
+  { if ( *p < 0x80 )
+    { p += (*kern.ascii_prefix)((const char*)p, m-p);
+    } else
+    { size_t n = utf8_seq_len(p, e-p);
+
+      if ( !n )
+	break;
+      p += n;
+    }
+  }
+
+  return p - (const unsigned char *)s;
+}
+
+/* Length of the longest valid UTF-8 prefix of s.  Returns len if the
+   entire string is valid.  Partial sequences at the end are invalid.
+*/
+
+size_t
+mf_utf8_valid(const char *s, size_t len)
+{ return utf8_valid_until(s, len, len);
+}
+
+#ifdef MF_UTF8_DECODE
+/* Decode valid UTF-8 (see mf_utf8_valid()).  out must have room for
+   mf_utf8_chars(s,len) characters.  Returns the number of characters.
+*/
+
+size_t
+mf_utf8_decode(const char *s, size_t len, wchar_t *out)
+{ const unsigned char *p = (const unsigned char *)s;
+  const unsigned char *e = p+len;
+  wchar_t *o = out;
+
+  while( p < e )
+  { unsigned int c = *p;
+
+    if ( c < 0x80 )
+    { size_t n = (*kern.ascii_prefix)((const char*)p, e-p);
+
+      (*kern.widen)((const char*)p, n, o);
+      p += n;
+      o += n;
+    } else if ( c < 0xe0 )
+    { *o++ = ((c&0x1f)<<6) | (p[1]&0x3f);
+      p += 2;
+    } else if ( c < 0xf0 )
+    { *o++ = ((c&0x0f)<<12) | ((p[1]&0x3f)<<6) | (p[2]&0x3f);
+      p += 3;
+    } else
+    { *o++ = ((c&0x07)<<18) | ((p[1]&0x3f)<<12) |
+	     ((p[2]&0x3f)<<6) | (p[3]&0x3f);
+      p += 4;
+    }
+  }
+
+  return o-out;
+}
+#endif /*MF_UTF8_DECODE*/
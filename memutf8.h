@@ -0,0 +1,62 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+
+#ifndef H_MEMUTF8_INCLUDED
+#define H_MEMUTF8_INCLUDED
+
+#include <stddef.h>
+#include <wchar.h>
+
+/* Bulk UTF-8 scanning for memory files.  The kernels use SSE2 or AVX2
+   if available on the running CPU and portable C otherwise.  The
+   find functions return (size_t)-1 if there are not enough items.
+*/
+
+#if WCHAR_MAX > 0xffff
+#define MF_UTF8_DECODE 1		/* mf_utf8_decode() yields UCS-4 */
+#endif
+
+/* memutf8.c */
+void		mf_utf8_init(void);
+size_t		mf_utf8_chars(const char *s, size_t len);
+size_t		mf_utf8_lead_bytes(const char *s, size_t len);
+size_t		mf_newlines(const char *s, size_t len);
+size_t		mf_utf8_find_char(const char *s, size_t len, size_t k);
+size_t		mf_find_newline(const char *s, size_t len, size_t k);
+size_t		mf_ascii_prefix(const char *s, size_t len);
+size_t		mf_utf8_valid(const char *s, size_t len);
+size_t		mf_utf8_decode(const char *s, size_t len, wchar_t *out);
+
+#endif /*H_MEMUTF8_INCLUDED*/
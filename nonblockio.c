@@ -143,6 +143,11 @@ leave the details to this function.
 #if defined(HAVE_POLL_H)
 #include <poll.h>
 #endif
+#include <pthread.h>
+#ifndef __WINDOWS__
+#include <time.h>
+#define O_IDLE_REAPER 1
+#endif
 
 #ifdef __WINDOWS__
 #define GET_ERRNO WSAGetLastError()
@@ -190,25 +195,33 @@ typedef size_t os_bufsize_t;
 #define ison(s, f)  ((s)->flags & (f))
 #define isoff(s, f) (!ison(s, f))
 
-#define PLSOCK_MAGIC  0x38da3f2c
-#define PLSOCK_CMAGIC 0x38da3f2d
-
 typedef struct _plsocket
-{ int		    magic;		/* PLSOCK_MAGIC */
+{ int		    in_use;		/* Slot holds an open socket */
+  unsigned int	    generation;		/* Incremented on each allocation */
+  struct _plsocket *next_free;		/* Free list of the socket table */
   SOCKET	    socket;		/* The OS socket */
   int		    flags;		/* Misc flags */
   int		    domain;		/* AF_* */
+  int		    backlog;		/* Backlog passed to nbio_listen() */
   atom_t	    symbol;		/* <socket>(%p) */
   IOSTREAM *	    input;		/* input stream */
   IOSTREAM *	    output;		/* output stream */
 #ifdef __WINDOWS__
   WSAEVENT          event;		/* Winsock event */
 #endif
+#ifdef O_IDLE_REAPER
+  unsigned int	    idle_timeout;	/* Max idle time in seconds (0: none) */
+  volatile unsigned int idle_active;	/* Reaper tick of last I/O */
+  int		    idle_slot;		/* Timer wheel slot (-1: none) */
+  volatile int	    idle_expired;	/* Shut down by the reaper */
+  struct _plsocket *idle_next;		/* Next in timer wheel slot */
+  struct _plsocket *idle_prev;		/* Previous in timer wheel slot */
+#endif
 } plsocket;
 
 #define VALID_SOCKET_RET(s, r) \
 	do						\
-	{ if ( !(s && (s)->magic == PLSOCK_MAGIC) )	\
+	{ if ( !(s && (s)->in_use) )			\
 	  { errno = EINVAL;				\
 	    return (r);					\
 	  }						\
@@ -534,9 +547,19 @@ nbio_set_symbol(nbio_sock_t socket, atom_t symbol)
 { socket->symbol = symbol;
 }
 
+unsigned int
+nbio_generation(nbio_sock_t socket)
+{ return socket->generation;
+}
+
+/* is_nbio_socket() is safe to call on stale handles because the memory
+   of the socket table is never released.  The generation detects that
+   the slot has been recycled for a new socket.
+*/
+
 int
-is_nbio_socket(nbio_sock_t socket)
-{ return socket && socket->magic == PLSOCK_MAGIC;
+is_nbio_socket(nbio_sock_t socket, unsigned int generation)
+{ return socket && socket->in_use && socket->generation == generation;
 }
 
 int
@@ -544,26 +567,304 @@ nbio_domain(nbio_sock_t socket)
 { return socket->domain;
 }
 
+
+		 /*******************************
+		 *	  IDLE TIMEOUT		*
+		 *******************************/
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Sockets with an idle timeout  are  kept   in  a  hashed timer wheel that
+is  maintained  by  a  single  thread.  The  thread  advances  the  tick
+counter  idle_tick  every  second   and    visits   the   slot  for  the
+current tick.  I/O on the socket merely  records the tick in idle_active
+(see  idle_touch()),  so  there  is  no  per-read  cost  for  timers.  A
+socket whose deadline has not passed   is  moved to the slot of its new
+deadline.  Expired sockets are shut down  using shutdown(), which wakes
+up a thread blocked on them, and  marked   as  expired such that
+nbio_read() and nbio_write()  report  ETIMEDOUT.   The  socket  is only
+closed and freed by its owner. The  expired   mark  is  a separate field
+rather than a flag because the owner updates s->flags without locking.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#ifdef O_IDLE_REAPER
+
+#define IDLE_WHEEL_SIZE 256		/* slots in the timer wheel */
+
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  idle_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_t       idle_thread;
+static int	       idle_running = FALSE;
+static int	       idle_stop = FALSE;
+static size_t	       idle_count = 0;	/* # sockets in the wheel */
+static volatile unsigned int idle_tick = 0;
+static plsocket	      *idle_wheel[IDLE_WHEEL_SIZE];
+
+#define idle_touch(s) \
+	do { if ( (s)->idle_timeout ) (s)->idle_active = idle_tick; } while(0)
+#define idle_expired(s) ((s)->idle_expired)
+
+static void
+idle_link(plsocket *s, unsigned int deadline)
+{ int slot = deadline % IDLE_WHEEL_SIZE;
+
+  s->idle_slot = slot;
+  s->idle_prev = NULL;
+  s->idle_next = idle_wheel[slot];
+  if ( s->idle_next )
+    s->idle_next->idle_prev = s;
+  idle_wheel[slot] = s;
+}
+
+static void
+idle_unlink(plsocket *s)
+{ if ( s->idle_prev )
+    s->idle_prev->idle_next = s->idle_next;
+  else
+    idle_wheel[s->idle_slot] = s->idle_next;
+  if ( s->idle_next )
+    s->idle_next->idle_prev = s->idle_prev;
+  s->idle_slot = -1;
+  s->idle_next = s->idle_prev = NULL;
+}
+
+/* idle_reap_slot() must be called with idle_mutex locked.  New entries
+   are added to the head of the slot, so rescheduling a socket into the
+   current slot does not revisit it.
+*/
+
+static void
+idle_reap_slot(unsigned int tick)
+{ plsocket *s, *next;
+
+  for(s = idle_wheel[tick % IDLE_WHEEL_SIZE]; s; s = next)
+  { unsigned int deadline = s->idle_active + s->idle_timeout;
+
+    next = s->idle_next;
+    if ( (int)(deadline - tick) <= 0 )
+    { DEBUG(1, Sdprintf("Idle timeout on %p (%d)\n", s, (int)s->socket));
+      idle_unlink(s);
+      idle_count--;
+      s->idle_expired = TRUE;
+      shutdown(s->socket, SHUT_RDWR);
+    } else if ( deadline % IDLE_WHEEL_SIZE != tick % IDLE_WHEEL_SIZE )
+    { idle_unlink(s);
+      idle_link(s, deadline);
+    }
+  }
+}
+
+static void *
+idle_reaper(void *closure)
+{ (void)closure;
+
+  pthread_mutex_lock(&idle_mutex);
+  while( !idle_stop )
+  { struct timespec deadline;
+    int rc;
+
+    if ( idle_count == 0 )
+    { pthread_cond_wait(&idle_cond, &idle_mutex);
+      continue;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec++;
+    do
+    { rc = pthread_cond_timedwait(&idle_cond, &idle_mutex, &deadline);
+    } while ( rc == 0 && !idle_stop );	/* spurious or registration */
+
+    if ( rc == ETIMEDOUT && !idle_stop )
+    { idle_tick++;
+      idle_reap_slot(idle_tick);
+    }
+  }
+  pthread_mutex_unlock(&idle_mutex);
+
+  return NULL;
+}
+
+/* A listening socket is never linked into the wheel: it sees no I/O
+   and only passes its timeout on to the sockets accepted from it.
+*/
+
+static int
+idle_register(plsocket *s, unsigned int timeout)
+{ int rc = 0;
+
+  pthread_mutex_lock(&idle_mutex);
+  if ( s->idle_slot >= 0 )
+  { idle_unlink(s);
+    idle_count--;
+  }
+  s->idle_timeout = timeout;
+  if ( timeout > 0 && isoff(s, PLSOCK_LISTEN) )
+  { if ( !idle_running )
+    { pthread_attr_t attr;
+
+      idle_stop = FALSE;
+      pthread_attr_init(&attr);
+      pthread_attr_setstacksize(&attr, 64*1024);
+      if ( (rc=pthread_create(&idle_thread, &attr, idle_reaper, NULL)) == 0 )
+	idle_running = TRUE;
+      pthread_attr_destroy(&attr);
+    }
+    if ( rc == 0 )
+    { s->idle_active = idle_tick;
+      idle_link(s, s->idle_active + timeout);
+      if ( idle_count++ == 0 )
+	pthread_cond_signal(&idle_cond);
+    } else
+    { s->idle_timeout = 0;
+    }
+  }
+  pthread_mutex_unlock(&idle_mutex);
+
+  if ( rc != 0 )
+  { nbio_error(rc, TCP_ERRNO);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+idle_unregister(plsocket *s)
+{ if ( s->idle_timeout )
+  { pthread_mutex_lock(&idle_mutex);
+    if ( s->idle_slot >= 0 )
+    { idle_unlink(s);
+      idle_count--;
+    }
+    s->idle_timeout = 0;
+    pthread_mutex_unlock(&idle_mutex);
+  }
+}
+
+static void
+idle_cleanup(void)
+{ if ( idle_running )
+  { pthread_mutex_lock(&idle_mutex);
+    idle_stop = TRUE;
+    pthread_cond_signal(&idle_cond);
+    pthread_mutex_unlock(&idle_mutex);
+    pthread_join(idle_thread, NULL);
+    idle_running = FALSE;
+  }
+}
+
+#else /*O_IDLE_REAPER*/
+
+#define idle_touch(s) (void)0
+#define idle_expired(s) FALSE
+#define idle_unregister(s) (void)0
+#define idle_cleanup() (void)0
+
+#endif /*O_IDLE_REAPER*/
+
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-Allocate a wrapper for an OS  socket.   The  wrapper  is allocated in an
-array of pointers, to keep small  integer   identifiers  we can use with
-FD_SET, etc. for implementing a compatible nbio_select().
+Socket table. Wrappers for OS sockets are  allocated from slabs of
+PLSOCK_SLAB_SIZE structures that are never released.  Closed wrappers
+are recycled through a free list, so accepting a connection does not
+call malloc(). Because the memory remains valid, a stale nbio_sock_t
+can be validated safely using is_nbio_socket() and the generation that
+was current when the handle was created.   On Unix, fd_table maps file
+descriptors to their wrapper for O(1) lookup by nbio_fd_socket().
 - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 
+#define PLSOCK_SLAB_SIZE 256
+
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static plsocket	     **slabs;		/* Allocated slabs */
+static size_t	       slab_count;	/* # used entries in slabs */
+static size_t	       slab_size;	/* # allocated entries in slabs */
+static plsocket	      *free_sockets;	/* Free list */
+#ifndef __WINDOWS__
+static plsocket	     **fd_table;	/* fd --> wrapper */
+static size_t	       fd_table_size;
+#endif
+
+#define TABLE_LOCK()   pthread_mutex_lock(&table_mutex)
+#define TABLE_UNLOCK() pthread_mutex_unlock(&table_mutex)
+
+static int
+add_slab(void)
+{ plsocket *slab;
+  int i;
+
+  if ( slab_count == slab_size )
+  { size_t newsize = slab_size ? slab_size*2 : 16;
+    plsocket **new;
+
+    if ( !(new = realloc(slabs, newsize*sizeof(*slabs))) )
+      return FALSE;
+    slabs = new;
+    slab_size = newsize;
+  }
+
+  if ( !(slab = calloc(PLSOCK_SLAB_SIZE, sizeof(*slab))) )
+    return FALSE;
+  for(i=PLSOCK_SLAB_SIZE-1; i>=0; i--)
+  { slab[i].next_free = free_sockets;
+    free_sockets = &slab[i];
+  }
+  slabs[slab_count++] = slab;
+
+  return TRUE;
+}
+
+#ifndef __WINDOWS__
+static int
+set_fd_socket(SOCKET fd, plsocket *s)
+{ if ( fd < 0 )
+    return TRUE;
+
+  if ( (size_t)fd >= fd_table_size )
+  { size_t newsize = fd_table_size ? fd_table_size : 1024;
+    plsocket **new;
+
+    while ( newsize <= (size_t)fd )
+      newsize *= 2;
+    if ( !(new = realloc(fd_table, newsize*sizeof(*fd_table))) )
+      return FALSE;
+    memset(new+fd_table_size, 0, (newsize-fd_table_size)*sizeof(*fd_table));
+    fd_table = new;
+    fd_table_size = newsize;
+  }
+  fd_table[fd] = s;
+
+  return TRUE;
+}
+#endif
+
 static plsocket *
 allocSocket(SOCKET socket)
 { plsocket *p;
+  unsigned int generation;
 
-  if ( !(p = malloc(sizeof(*p))) )
-  { PL_resource_error("memory");
+  TABLE_LOCK();
+  if ( (!free_sockets && !add_slab())
+#ifndef __WINDOWS__
+       || !set_fd_socket(socket, free_sockets)
+#endif
+     )
+  { TABLE_UNLOCK();
+    PL_resource_error("memory");
     return NULL;
   }
+  p = free_sockets;
+  free_sockets = p->next_free;
+  generation = p->generation+1;
 
   memset(p, 0, sizeof(*p));
+  p->generation = generation;
   p->socket = socket;
   p->flags  = PLSOCK_DISPATCH|PLSOCK_VIRGIN;	/* by default, dispatch */
-  p->magic  = PLSOCK_MAGIC;
   p->input = p->output = (IOSTREAM*)NULL;
+#ifdef O_IDLE_REAPER
+  p->idle_slot = -1;
+#endif
+  p->in_use = TRUE;
+  TABLE_UNLOCK();
 
 #ifdef __WINDOWS__
   { WSAEVENT event = WSACreateEvent();
@@ -580,32 +881,132 @@ allocSocket(SOCKET socket)
 }
 
 
+/* releaseSocket() is called after the OS socket is closed.  If a Prolog
+   blob still refers to the wrapper, a thread may be using it through a
+   plain plsocket* (e.g., blocked in nbio_accept()), so we cannot recycle
+   the slot yet.  This is left to nbio_release_symbol(), which is called
+   when the blob is garbage collected.
+*/
+
+static void
+releaseSocket(plsocket *s)
+{ TABLE_LOCK();
+#ifndef __WINDOWS__
+  if ( s->socket >= 0 && (size_t)s->socket < fd_table_size &&
+       fd_table[s->socket] == s )
+    fd_table[s->socket] = NULL;
+#endif
+  s->in_use = FALSE;
+  s->socket = INVALID_SOCKET;
+  if ( !s->symbol )
+  { s->next_free = free_sockets;
+    free_sockets = s;
+  }
+  TABLE_UNLOCK();
+}
+
+
+/* nbio_release_symbol() is called if the blob that refers to socket is
+   released.  If the socket is still open it is closed.  Otherwise it was
+   closed while the blob was alive and we can now recycle the slot.
+*/
+
 void
-freeSocket(nbio_sock_t s)
-{ if ( s )
-  { if ( s->magic == PLSOCK_CMAGIC )
-      free(s);
-    else
-      s->symbol = 0;
+nbio_release_symbol(nbio_sock_t socket, unsigned int generation)
+{ TABLE_LOCK();
+  if ( socket->generation != generation || !socket->symbol )
+  { TABLE_UNLOCK();
+    return;
+  }
+  socket->symbol = 0;
+  if ( socket->in_use )
+  { TABLE_UNLOCK();
+    nbio_closesocket(socket);
+  } else
+  { socket->next_free = free_sockets;
+    free_sockets = socket;
+    TABLE_UNLOCK();
   }
 }
 
 
+nbio_sock_t
+nbio_fd_socket(SOCKET fd)
+{ plsocket *s = NULL;
+
+  TABLE_LOCK();
+#ifndef __WINDOWS__
+  if ( fd >= 0 && (size_t)fd < fd_table_size )
+    s = fd_table[fd];
+#else
+  { size_t i;
+
+    for(i=0; i<slab_count && !s; i++)
+    { plsocket *p = slabs[i];
+      int j;
+
+      for(j=0; j<PLSOCK_SLAB_SIZE; j++, p++)
+      { if ( p->in_use && p->socket == fd )
+	{ s = p;
+	  break;
+	}
+      }
+    }
+  }
+#endif
+  TABLE_UNLOCK();
+
+  return s;
+}
+
+
+void
+nbio_statistics(nbio_stats *stats)
+{ size_t i;
+
+  memset(stats, 0, sizeof(*stats));
+  TABLE_LOCK();
+  stats->allocated = slab_count*PLSOCK_SLAB_SIZE;
+  for(i=0; i<slab_count; i++)
+  { plsocket *p = slabs[i];
+    int j;
+
+    for(j=0; j<PLSOCK_SLAB_SIZE; j++, p++)
+    { if ( p->in_use )
+      { stats->open++;
+	if ( ison(p, PLSOCK_LISTEN) )
+	  stats->listening++;
+	else if ( ison(p, PLSOCK_ACCEPT) )
+	  stats->accepted++;
+	else if ( ison(p, PLSOCK_CONNECT) )
+	  stats->connected++;
+	if ( ison(p, PLSOCK_INSTREAM|PLSOCK_OUTSTREAM) )
+	  stats->streams++;
+#ifdef O_IDLE_REAPER
+	if ( p->idle_timeout )
+	  stats->idle_timeout++;
+#endif
+      }
+    }
+  }
+  TABLE_UNLOCK();
+}
+
+
 static int
 closeSocket(plsocket *s)
 { int rval;
   SOCKET sock;
 
-  DEBUG(2, Sdprintf("Closing %p (%zd)\n", s, (size_t)s->socket));
-  if ( !s || s->magic != PLSOCK_MAGIC )
-  { DEBUG(1, Sdprintf("OOPS: closeSocket(%p) s->magic = %d\n",
-		      s, s ? s->magic : 0));
+  if ( !s || !s->in_use )
+  { DEBUG(1, Sdprintf("OOPS: closeSocket(%p): not in use\n", s));
     errno = EINVAL;
     return -1;
   }
+  DEBUG(2, Sdprintf("Closing %p (%zd)\n", s, (size_t)s->socket));
 
+  idle_unregister(s);
   sock = s->socket;
-  s->magic = PLSOCK_CMAGIC;
 
 #ifdef __WINDOWS__
   if ( s->event )
@@ -626,8 +1027,7 @@ closeSocket(plsocket *s)
     rval = 0;				/* already closed.  Use s->error? */
   }
 
-  if ( !s->symbol )
-    free(s);
+  releaseSocket(s);
 
   return rval;
 }
@@ -853,7 +1253,7 @@ nbio_init(const char *module)
 int
 nbio_cleanup(void)
 { if ( initialised )
-  {
+  { idle_cleanup();
 #ifdef __WINDOWS__
     WSACleanup();
 #endif
@@ -903,6 +1303,47 @@ nbio_socket(int domain, int type, int protocol)
 }
 
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+nbio_adopt_socket() wraps a socket that was  created outside Prolog, for
+example a listening socket passed by a  supervisor using the systemd
+LISTEN_FDS protocol. The domain is  taken   from  the  bound address. If
+the socket is listening it is marked as such, so tcp_accept/3 can be
+used immediately.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+nbio_sock_t
+nbio_adopt_socket(SOCKET sock)
+{ struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  plsocket *s;
+
+  assert(initialised);
+
+  if ( getsockname(sock, (struct sockaddr*)&addr, &len) != 0 )
+  { nbio_error(GET_ERRNO, TCP_ERRNO);
+    return NULL;
+  }
+  if ( !(s=allocSocket(sock)) )
+    return NULL;
+  s->domain = addr.ss_family;
+
+#ifdef SO_ACCEPTCONN
+  { int listening = 0;
+    socklen_t llen = sizeof(listening);
+
+    if ( getsockopt(sock, SOL_SOCKET, SO_ACCEPTCONN,
+		    (char*)&listening, &llen) == 0 && listening )
+      set(s, PLSOCK_BIND|PLSOCK_LISTEN);
+  }
+#endif
+#if !defined(__WINDOWS__) && defined(FD_CLOEXEC)
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+#endif
+
+  return s;
+}
+
+
 int
 nbio_closesocket(nbio_sock_t socket)
 { int rc = 0;
@@ -1066,6 +1507,68 @@ nbio_setopt(nbio_sock_t socket, nbio_option opt, ...)
 
       break;
     }
+    case TCP_FAST_OPEN:		/* listener: length of the TFO queue */
+    { int val = va_arg(args, int);
+
+#ifdef TCP_FASTOPEN
+      if ( setsockopt(socket->socket, IPPROTO_TCP, TCP_FASTOPEN,
+		      (const char *)&val, sizeof(val)) == -1 )
+      { nbio_error(GET_ERRNO, TCP_ERRNO);
+	rc = -1;
+      } else
+      { rc = 0;
+      }
+#else
+      (void)val;
+      rc = -2;
+#endif
+      break;
+    }
+    case TCP_FAST_OPEN_CONNECT:	/* client: send data in the SYN */
+    { int val = va_arg(args, int);
+
+#ifdef TCP_FASTOPEN_CONNECT
+      if ( setsockopt(socket->socket, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+		      (const char *)&val, sizeof(val)) == -1 )
+      { nbio_error(GET_ERRNO, TCP_ERRNO);
+	rc = -1;
+      } else
+      { rc = 0;
+      }
+#else
+      (void)val;
+      rc = -2;
+#endif
+      break;
+    }
+    case TCP_ACCEPT_DEFER:	/* wake accept() only if data arrived */
+    { int val = va_arg(args, int);
+
+#ifdef TCP_DEFER_ACCEPT
+      if ( setsockopt(socket->socket, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+		      (const char *)&val, sizeof(val)) == -1 )
+      { nbio_error(GET_ERRNO, TCP_ERRNO);
+	rc = -1;
+      } else
+      { rc = 0;
+      }
+#else
+      (void)val;
+      rc = -2;
+#endif
+      break;
+    }
+    case TCP_IDLE_TIMEOUT:	/* shut down after val seconds without I/O */
+    { int val = va_arg(args, int);
+
+#ifdef O_IDLE_REAPER
+      rc = idle_register(socket, val);
+#else
+      (void)val;
+      rc = -2;
+#endif
+      break;
+    }
     default:
       rc = -1;
       assert(0);
@@ -1389,12 +1892,35 @@ nbio_connect(nbio_sock_t socket,
 }
 
 
+/* accept_ready() waits at most 250ms for a connection.  Closing the
+   listener does not wake up a thread blocked in accept() and we cannot
+   use shutdown() as this also affects duplicates of the socket, such as
+   the copy held by a supervisor that passed us the listener.  Instead,
+   nbio_accept() re-validates the listener after each timeout.
+*/
+
+#if !defined(__WINDOWS__) && defined(HAVE_POLL)
+static int
+accept_ready(plsocket *s)
+{ struct pollfd fds[1];
+
+  fds[0].fd = s->socket;
+  fds[0].events = POLLIN;
+
+  return poll(fds, 1, 250) != 0;	/* ready or error: call accept() */
+}
+#else
+#define accept_ready(s) TRUE
+#endif
+
 nbio_sock_t
 nbio_accept(nbio_sock_t master, struct sockaddr *addr, socklen_t *addrlen)
 { SOCKET slave;
   plsocket *s;
+  unsigned int generation;
 
   VALID_SOCKET_RET(master, NULL);
+  generation = master->generation;
 
   for(;;)
   {
@@ -1405,6 +1931,16 @@ nbio_accept(nbio_sock_t master, struct sockaddr *addr, socklen_t *addrlen)
 
     if ( PL_handle_signals() < 0 )
       return NULL;
+    if ( !is_nbio_socket(master, generation) ) /* closed while waiting */
+    { nbio_error(EBADF, TCP_ERRNO);
+      return NULL;
+    }
+    if ( !accept_ready(master) )
+      continue;
+    if ( !is_nbio_socket(master, generation) )
+    { nbio_error(EBADF, TCP_ERRNO);
+      return NULL;
+    }
     DEBUG(3, Sdprintf("[%d] calling accept(%d)\n",
 		      PL_thread_self(), master->socket));
     slave = accept(master->socket, addr, addrlen);
@@ -1433,6 +1969,10 @@ nbio_accept(nbio_sock_t master, struct sockaddr *addr, socklen_t *addrlen)
   if ( ison(s, PLSOCK_NONBLOCK) )
     nbio_setopt(s, TCP_NONBLOCK);
 #endif
+#ifdef O_IDLE_REAPER
+  if ( master->idle_timeout )		/* inherit from the listener */
+    idle_register(s, master->idle_timeout);
+#endif
 
   return s;
 }
@@ -1448,11 +1988,94 @@ nbio_listen(nbio_sock_t socket, int backlog)
   }
 
   set(socket, PLSOCK_LISTEN);
+  socket->backlog = backlog;
+#ifdef O_IDLE_REAPER
+  if ( socket->idle_timeout )		/* set before listen: leave the wheel */
+    idle_register(socket, socket->idle_timeout);
+#endif
 
   return 0;
 }
 
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Listen queue introspection.  On Linux,  TCP_INFO  on a listening socket
+reports the current length  of  the   accept  queue  in tcpi_unacked and
+its   effective   maximum   (backlog   clamped   by   somaxconn)    in
+tcpi_sacked. Elsewhere these are  -1.  Queue  overflows are not counted
+per socket, so nbio_listen_overflows() reports the system-wide counters
+from /proc/net/netstat.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+int
+nbio_get_listen_info(nbio_sock_t socket, nbio_listen_info *info)
+{ VALID_SOCKET(socket);
+
+  if ( isoff(socket, PLSOCK_LISTEN) )
+  { errno = EINVAL;
+    return -1;
+  }
+
+  info->backlog   = socket->backlog;
+  info->max_queue = -1;
+  info->queued    = -1;
+
+#if defined(TCP_INFO) && defined(__linux__)
+  { struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+
+    if ( getsockopt(socket->socket, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0 )
+    { info->queued    = ti.tcpi_unacked;
+      info->max_queue = ti.tcpi_sacked;
+    }
+  }
+#endif
+
+  return 0;
+}
+
+
+int
+nbio_listen_overflows(int64_t *overflows, int64_t *drops)
+{
+#ifdef __linux__
+  FILE *fd;
+  char names[4096], values[4096];
+  int rc = -2;
+
+  if ( !(fd = fopen("/proc/net/netstat", "r")) )
+    return -2;
+
+  while ( fgets(names, sizeof(names), fd) &&
+	  fgets(values, sizeof(values), fd) )
+  { if ( strncmp(names, "TcpExt:", 7) == 0 )
+    { char *ns, *vs, *n, *v;
+
+      *overflows = *drops = 0;
+      for(n = strtok_r(names, " \n", &ns), v = strtok_r(values, " \n", &vs);
+	  n && v;
+	  n = strtok_r(NULL, " \n", &ns), v = strtok_r(NULL, " \n", &vs))
+      { if ( strcmp(n, "ListenOverflows") == 0 )
+	  *overflows = strtoll(v, NULL, 10);
+	else if ( strcmp(n, "ListenDrops") == 0 )
+	  *drops = strtoll(v, NULL, 10);
+      }
+      rc = 0;
+      break;
+    }
+  }
+  fclose(fd);
+
+  return rc;
+#else
+  (void)overflows;
+  (void)drops;
+
+  return -2;
+#endif
+}
+
+
 		 /*******************************
 		 *	  IO-STREAM STUFF	*
 		 *******************************/
@@ -1493,6 +2116,13 @@ nbio_read(nbio_sock_t socket, char *buf, size_t bufSize)
     break;
   }
 
+  if ( n > 0 )
+  { idle_touch(socket);
+  } else if ( n == 0 && idle_expired(socket) )
+  { nbio_error(ETIMEDOUT, TCP_ERRNO);
+    return -1;
+  }
+
   return n;
 }
 
@@ -1520,7 +2150,8 @@ nbio_write(nbio_sock_t socket, char *buf, size_t bufSize)
 #endif
 	continue;
       }
-      nbio_error(GET_ERRNO, TCP_ERRNO);
+      nbio_error(idle_expired(socket) ? ETIMEDOUT : GET_ERRNO,
+		 TCP_ERRNO);
       return -1;
     }
     if ( n < len )
@@ -1534,6 +2165,8 @@ nbio_write(nbio_sock_t socket, char *buf, size_t bufSize)
     str += n;
   }
 
+  idle_touch(socket);
+
   return bufSize;
 }
 
@@ -1571,14 +2204,16 @@ nbio_close_input(nbio_sock_t socket)
   DEBUG(2, Sdprintf("[%d]: nbio_close_input(%p, flags=0x%x)\n",
 		    PL_thread_self(), socket, socket->flags));
   if ( ison(socket, PLSOCK_INSTREAM) )
-  { clear(socket, PLSOCK_INSTREAM);
+  { atom_t symbol = socket->symbol;	/* closeSocket() recycles socket */
+
+    clear(socket, PLSOCK_INSTREAM);
 
     socket->input = NULL;
     if ( isoff(socket, (PLSOCK_INSTREAM|PLSOCK_OUTSTREAM)) )
       rc = closeSocket(socket);
 
-    if ( socket->symbol )
-      PL_unregister_atom(socket->symbol);
+    if ( symbol )
+      PL_unregister_atom(symbol);
   }
 
   return rc;
@@ -1603,7 +2238,9 @@ nbio_close_output(nbio_sock_t socket)
 		    PL_thread_self(), socket, socket->flags));
 
   if ( ison(socket, PLSOCK_OUTSTREAM) )
-  { clear(socket, PLSOCK_OUTSTREAM);
+  { atom_t symbol = socket->symbol;	/* closeSocket() recycles socket */
+
+    clear(socket, PLSOCK_OUTSTREAM);
 
     if ( socket->socket != INVALID_SOCKET )
     { /* if ( (rc = shutdown(socket->socket, SHUT_WR)) )
@@ -1615,8 +2252,8 @@ nbio_close_output(nbio_sock_t socket)
     if ( isoff(socket, (PLSOCK_INSTREAM|PLSOCK_OUTSTREAM)) )
       rc = (rc + closeSocket(socket)) ? -1 : 0;
 
-    if ( socket->symbol )
-      PL_unregister_atom(socket->symbol);
+    if ( symbol )
+      PL_unregister_atom(symbol);
   }
 
   return rc;
@@ -1665,7 +2302,134 @@ nbio_recvfrom(nbio_sock_t socket, void *buf, size_t bufSize, int flags,
     break;
   }
 
+  idle_touch(socket);
+  return n;
+}
+
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+nbio_recvfrom_stamp() is nbio_recvfrom(), but also returns the time the
+kernel  received  the  datagram  in  *stamp   (seconds  since  the  Unix
+epoch). Kernel timestamps are  enabled   on  the  first call using
+SO_TIMESTAMPNS (Linux) or SO_TIMESTAMP and are   passed  as  ancillary
+data to recvmsg().  If the  system  provides   no  timestamp,  *stamp is
+the time recvmsg() returned.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#if !defined(__WINDOWS__) && (defined(SO_TIMESTAMPNS) || defined(SO_TIMESTAMP))
+#define O_RECV_TIMESTAMP 1
+#endif
+
+static double
+time_now(void)
+{ struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+}
+
+ssize_t
+nbio_recvfrom_stamp(nbio_sock_t socket, void *buf, size_t bufSize, int flags,
+		    struct sockaddr *from, socklen_t *fromlen, double *stamp)
+{
+#ifdef O_RECV_TIMESTAMP
+  ssize_t n;
+  struct msghdr msg;
+  struct iovec iov;
+  union
+  { struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct timespec))];
+  } control;
+  struct cmsghdr *cmsg;
+
+  VALID_SOCKET(socket);
+
+  if ( isoff(socket, PLSOCK_TIMESTAMP) )
+  { int on = 1;
+
+#ifdef SO_TIMESTAMPNS
+    if ( setsockopt(socket->socket, SOL_SOCKET, SO_TIMESTAMPNS,
+		    &on, sizeof(on)) == -1 )
+#else
+    if ( setsockopt(socket->socket, SOL_SOCKET, SO_TIMESTAMP,
+		    &on, sizeof(on)) == -1 )
+#endif
+    { nbio_error(GET_ERRNO, TCP_ERRNO);
+      return -1;
+    }
+    set(socket, PLSOCK_TIMESTAMP);
+  }
+
+  for(;;)
+  { if ( (flags & MSG_DONTWAIT) == 0 && !wait_socket(socket) )
+      return -1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base       = buf;
+    iov.iov_len        = bufSize;
+    msg.msg_name       = from;
+    msg.msg_namelen    = *fromlen;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    n = recvmsg(socket->socket, &msg, flags);
+
+    if ( n == -1 )
+    { if ( need_retry(GET_ERRNO) )
+      { if ( PL_handle_signals() < 0 )
+        { errno = EPLEXCEPTION;
+          return -1;
+        }
+        if((flags & MSG_DONTWAIT) != 0)
+          return -1;
+        continue;
+      }
+      nbio_error(GET_ERRNO, TCP_ERRNO);
+      return -1;
+    }
+
+    break;
+  }
+
+  idle_touch(socket);
+  *fromlen = msg.msg_namelen;
+  *stamp = 0.0;
+  for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  { if ( cmsg->cmsg_level != SOL_SOCKET )
+      continue;
+#ifdef SCM_TIMESTAMPNS
+    if ( cmsg->cmsg_type == SCM_TIMESTAMPNS )
+    { struct timespec ts;
+
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      *stamp = (double)ts.tv_sec + (double)ts.tv_nsec/1000000000.0;
+      break;
+    }
+#endif
+#ifdef SCM_TIMESTAMP
+    if ( cmsg->cmsg_type == SCM_TIMESTAMP )
+    { struct timeval tv;
+
+      memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+      *stamp = (double)tv.tv_sec + (double)tv.tv_usec/1000000.0;
+      break;
+    }
+#endif
+  }
+  if ( *stamp == 0.0 )
+    *stamp = time_now();
+
+  return n;
+#else /*O_RECV_TIMESTAMP*/
+  ssize_t n;
+
+  if ( (n=nbio_recvfrom(socket, buf, bufSize, flags, from, fromlen)) >= 0 )
+    *stamp = time_now();
+
   return n;
+#endif /*O_RECV_TIMESTAMP*/
 }
 
 
@@ -1697,5 +2461,6 @@ nbio_sendto(nbio_sock_t socket, void *buf, size_t bufSize, int flags,
     break;
   }
 
+  idle_touch(socket);
   return n;
 }
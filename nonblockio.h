@@ -98,7 +98,11 @@ typedef enum				/* nbio_setopt() commands */
   UDP_BROADCAST,
   SCK_BINDTODEVICE,
   NBIO_END,
-  TCP_SNDBUF
+  TCP_SNDBUF,
+  TCP_FAST_OPEN,
+  TCP_FAST_OPEN_CONNECT,
+  TCP_IDLE_TIMEOUT,
+  TCP_ACCEPT_DEFER
 } nbio_option;
 
 typedef enum
@@ -129,20 +133,42 @@ typedef struct _plsocket *nbio_sock_t;	/* socket handle */
 #define PLSOCK_WAITING	  0x0400	/* using nbio_wait() */
 #define PLSOCK_VIRGIN	  0x0800	/* created, but not opened */
 #define PLSOCK_SHUTDOWN	  0x1000	/* shutdown, but not freed */
+#define PLSOCK_TIMESTAMP  0x2000	/* kernel receive timestamps enabled */
 
 		 /*******************************
 		 *	 BASIC FUNCTIONS	*
 		 *******************************/
 
+typedef struct nbio_stats
+{ size_t	allocated;		/* Slots in the socket table */
+  size_t	open;			/* Open sockets */
+  size_t	listening;		/* ... listening */
+  size_t	accepted;		/* ... accepted connections */
+  size_t	connected;		/* ... client connections */
+  size_t	streams;		/* ... with Prolog streams */
+  size_t	idle_timeout;		/* ... with an idle timeout */
+} nbio_stats;
+
+typedef struct nbio_listen_info
+{ int		backlog;		/* Backlog passed to nbio_listen() */
+  int		max_queue;		/* Effective max accept queue or -1 */
+  int		queued;			/* Connections waiting or -1 */
+} nbio_listen_info;
+
 extern void	nbio_set_symbol(nbio_sock_t socket, atom_t symbol);
-extern int	is_nbio_socket(nbio_sock_t socket);
-extern void	freeSocket(nbio_sock_t s);
+extern void	nbio_release_symbol(nbio_sock_t socket,
+				    unsigned int generation);
+extern unsigned int nbio_generation(nbio_sock_t socket);
+extern int	is_nbio_socket(nbio_sock_t socket, unsigned int generation);
+extern nbio_sock_t nbio_fd_socket(SOCKET fd);
+extern void	nbio_statistics(nbio_stats *stats);
 
 extern int	nbio_init(const char *module);
 extern int	nbio_cleanup(void);
 extern int	nbio_debug(int level);
 
 extern nbio_sock_t nbio_socket(int domain, int type, int protocol);
+extern nbio_sock_t nbio_adopt_socket(SOCKET sock);
 extern int	nbio_connect(nbio_sock_t socket,
 			     const struct sockaddr *serv_addr,
 			     socklen_t addrlen);
@@ -163,6 +189,10 @@ extern int	nbio_close_output(nbio_sock_t socket);
 extern ssize_t	nbio_recvfrom(nbio_sock_t socket, void *buf, size_t bufSize,
 			      int flags,
 			      struct sockaddr *from, socklen_t *fromlen);
+extern ssize_t	nbio_recvfrom_stamp(nbio_sock_t socket,
+				    void *buf, size_t bufSize, int flags,
+				    struct sockaddr *from, socklen_t *fromlen,
+				    double *stamp);
 extern ssize_t	nbio_sendto(nbio_sock_t socket, void *buf, size_t bufSize,
 			    int flags,
 			    const struct sockaddr *to, socklen_t tolen);
@@ -181,6 +211,9 @@ extern const char*
 		nbio_last_error(nbio_sock_t socket);
 extern int	nbio_setopt(nbio_sock_t socket, nbio_option opt, ...);
 extern int	nbio_get_flags(nbio_sock_t socket);
+extern int	nbio_get_listen_info(nbio_sock_t socket,
+				     nbio_listen_info *info);
+extern int	nbio_listen_overflows(int64_t *overflows, int64_t *drops);
 
 
 		 /*******************************
@@ -92,9 +92,19 @@ static atom_t ATOM_bindtodevice;
 static atom_t ATOM_broadcast;
 static atom_t ATOM_codes;
 static atom_t ATOM_dgram;
+static atom_t ATOM_seqpacket;
 static atom_t ATOM_dispatch;
 static atom_t ATOM_domain;
 static atom_t ATOM_encoding;
+static atom_t ATOM_fastopen;
+static atom_t ATOM_fastopen_connect;
+static atom_t ATOM_idle_timeout;
+static atom_t ATOM_defer_accept;
+static atom_t ATOM_backlog;
+static atom_t ATOM_accept_queue;
+static atom_t ATOM_accept_queue_max;
+static atom_t ATOM_listen_overflows;
+static atom_t ATOM_listen_drops;
 static atom_t ATOM_file_no;
 static atom_t ATOM_host;
 static atom_t ATOM_inet6;
@@ -104,6 +114,7 @@ static atom_t ATOM_ip_add_membership;
 static atom_t ATOM_ip_drop_membership;
 static atom_t ATOM_local;
 static atom_t ATOM_max_message_size;
+static atom_t ATOM_timestamp;
 static atom_t ATOM_nodelay;
 static atom_t ATOM_nonblock;
 static atom_t ATOM_reuseaddr;
@@ -116,45 +127,62 @@ static atom_t ATOM_type;
 static atom_t ATOM_unix;
 
 static int get_socket_from_stream(term_t t, IOSTREAM **s, nbio_sock_t *sp);
+#ifdef AF_UNIX
+static int af_unix_address(term_t Address,
+			   struct sockaddr_un *sockaddr, int *addrlen,
+			   int flags);
+#endif
 
 
 		 /*******************************
 		 *	      SYMBOL		*
 		 *******************************/
 
+/* The blob holds the socket and its generation.  The generation tells
+   a stale handle from a new socket in a recycled slot of the socket
+   table.
+*/
+
+typedef struct socket_ref
+{ nbio_sock_t	socket;			/* the nbio socket */
+  unsigned int	generation;		/* its generation */
+} socket_ref;
+
 static void
 acquire_socket_symbol(atom_t symbol)
-{ nbio_sock_t s = *(nbio_sock_t*)PL_blob_data(symbol, NULL, NULL);
+{ socket_ref *ref = PL_blob_data(symbol, NULL, NULL);
 
-  nbio_set_symbol(s, symbol);
+  if ( is_nbio_socket(ref->socket, ref->generation) )
+    nbio_set_symbol(ref->socket, symbol);
 }
 
 static int
 release_socket_symbol(atom_t symbol)
-{ nbio_sock_t s = *(nbio_sock_t*)PL_blob_data(symbol, NULL, NULL);
+{ socket_ref *ref = PL_blob_data(symbol, NULL, NULL);
 
-  nbio_closesocket(s);			/* no-op if already done */
-  freeSocket(s);
+  nbio_release_symbol(ref->socket, ref->generation);
 
   return TRUE;
 }
 
 static int
 compare_socket_symbols(atom_t a, atom_t b)
-{ nbio_sock_t sa = *(nbio_sock_t*)PL_blob_data(a, NULL, NULL);
-  nbio_sock_t sb = *(nbio_sock_t*)PL_blob_data(b, NULL, NULL);
+{ socket_ref *ra = PL_blob_data(a, NULL, NULL);
+  socket_ref *rb = PL_blob_data(b, NULL, NULL);
 
-  return ( sa > sb ?  1 :
-	   sa < sb ? -1 : 0
+  return ( ra->socket > rb->socket ?  1 :
+	   ra->socket < rb->socket ? -1 :
+	   ra->generation > rb->generation ?  1 :
+	   ra->generation < rb->generation ? -1 : 0
 	 );
 }
 
 
 static int
 write_socket_symbol(IOSTREAM *s, atom_t symbol, int flags)
-{ nbio_sock_t sock = *(nbio_sock_t*)PL_blob_data(symbol, NULL, NULL);
+{ socket_ref *ref = PL_blob_data(symbol, NULL, NULL);
 
-  Sfprintf(s, "<socket>(%p)", sock);
+  Sfprintf(s, "<socket>(%p)", ref->socket);
   return TRUE;
 }
 
@@ -172,7 +200,12 @@ static PL_blob_t socket_blob =
 
 static int
 tcp_unify_socket(term_t handle, nbio_sock_t socket)
-{ if ( PL_unify_blob(handle, &socket, sizeof(socket), &socket_blob) )
+{ socket_ref ref;
+
+  memset(&ref, 0, sizeof(ref));		/* blobs are compared bytewise */
+  ref.socket = socket;
+  ref.generation = nbio_generation(socket);
+  if ( PL_unify_blob(handle, &ref, sizeof(ref), &socket_blob) )
     return TRUE;
 
   if ( !PL_is_variable(handle) )
@@ -188,12 +221,12 @@ tcp_get_socket(term_t handle, nbio_sock_t *sp)
   void *data;
 
   if ( PL_get_blob(handle, &data, NULL, &type) && type == &socket_blob)
-  { nbio_sock_t s = *(nbio_sock_t*)data;
+  { socket_ref *ref = data;
 
-    if ( !is_nbio_socket(s) )
+    if ( !is_nbio_socket(ref->socket, ref->generation) )
       return PL_existence_error("socket", handle),false;
 
-    *sp = s;
+    *sp = ref->socket;
 
     return true;
   }
@@ -469,6 +502,69 @@ pl_setopt(term_t Socket, term_t opt)
       if ( rc == -2 )
 	goto not_implemented;
 
+      return FALSE;
+    } else if ( a == ATOM_fastopen && arity == 1 )
+    { int qlen;
+      int rc;
+      term_t a = PL_new_term_ref();
+
+      _PL_get_arg(1, opt, a);
+      if ( !PL_get_integer(a, &qlen) || qlen < 0 )
+	return pl_error(NULL, 0, NULL, ERR_DOMAIN, a, "nonneg");
+      if ( (rc=nbio_setopt(socket, TCP_FAST_OPEN, qlen)) == 0 )
+	return TRUE;
+      if ( rc == -2 )
+	goto not_implemented;
+
+      return FALSE;
+    } else if ( a == ATOM_fastopen_connect && arity <= 1 )
+    { int enable, rc;
+
+      if ( arity == 0 )
+      { enable = TRUE;
+      } else
+      { term_t a = PL_new_term_ref();
+
+	_PL_get_arg(1, opt, a);
+	if ( !PL_get_bool(a, &enable) )
+	  return pl_error(NULL, 0, NULL, ERR_DOMAIN, a, "boolean");
+      }
+
+      if ( (rc=nbio_setopt(socket, TCP_FAST_OPEN_CONNECT, enable)) == 0 )
+	return TRUE;
+      if ( rc == -2 )
+	goto not_implemented;
+
+      return FALSE;
+    } else if ( a == ATOM_idle_timeout && arity == 1 )
+    { double t;
+      int secs, rc;
+      term_t a = PL_new_term_ref();
+
+      _PL_get_arg(1, opt, a);
+      if ( !PL_get_float(a, &t) || t < 0 || t > 1e9 )
+	return pl_error(NULL, 0, NULL, ERR_DOMAIN, a, "nonneg");
+      if ( (double)(secs = (int)t) < t )	/* round up to whole seconds */
+	secs++;
+      if ( (rc=nbio_setopt(socket, TCP_IDLE_TIMEOUT, secs)) == 0 )
+	return TRUE;
+      if ( rc == -2 )
+	goto not_implemented;
+
+      return FALSE;
+    } else if ( a == ATOM_defer_accept && arity == 1 )
+    { int secs;
+      int rc;
+      term_t a = PL_new_term_ref();
+
+      _PL_get_arg(1, opt, a);
+      if ( !PL_get_integer(a, &secs) || secs < 0 )
+	return pl_error(NULL, 0, NULL, ERR_DOMAIN, a, "nonneg");
+      if ( (rc=nbio_setopt(socket, TCP_ACCEPT_DEFER, secs)) == 0 )
+	return TRUE;
+      if ( rc == -2 )
+	goto not_implemented;
+
       return FALSE;
     }
   }
@@ -497,9 +593,31 @@ pl_getopt(term_t Socket, term_t opt)
       if ( s != -1 )
 	return PL_unify_integer(a1, s);
       return FALSE;
+    } else if ( (a == ATOM_backlog || a == ATOM_accept_queue ||
+		 a == ATOM_accept_queue_max) && arity == 1 )
+    { nbio_listen_info info;
+      int val;
+
+      if ( nbio_get_listen_info(socket, &info) != 0 )
+	return PL_permission_error(PL_atom_chars(a), "socket", Socket);
+      val = ( a == ATOM_backlog      ? info.backlog :
+	      a == ATOM_accept_queue ? info.queued :
+				       info.max_queue );
+
+      return val >= 0 && PL_unify_integer(a1, val);
+    } else if ( (a == ATOM_listen_overflows || a == ATOM_listen_drops) &&
+		arity == 1 )
+    { int64_t overflows, drops;
+
+      if ( nbio_listen_overflows(&overflows, &drops) != 0 )
+	goto not_implemented;
+
+      return PL_unify_int64(a1, a == ATOM_listen_overflows ? overflows
+							   : drops);
     }
   }
 
+not_implemented:
   return pl_error(NULL, 0, NULL, ERR_DOMAIN, opt, "socket_option");
 }
 
@@ -532,14 +650,17 @@ sizeof_sockaddr(struct sockaddr_storage *sockaddr)
 udp_receive(+Socket, -String, -From, +Options)
 udp_send(+String, +String, +To, +Options)
 
-From/To are of the format <Host>:<Port>
+From/To are of the format <Host>:<Port>.  These predicates are also used
+for AF_UNIX  datagram  and  seqpacket  sockets,  where  the  address is
+a file name.  From is `af_unix` if the  sender is not bound to a name or
+the socket is connected.  On a connected socket To may be unbound.
 - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 
 #define UDP_MAXDATA         65535
 #define UDP_DEFAULT_BUFSIZE  4096
 
 static int
-unify_address(term_t t, struct sockaddr_storage *addr)
+unify_address(term_t t, struct sockaddr_storage *addr, socklen_t alen)
 { term_t av = PL_new_term_refs(2);
 
   switch ( addr->ss_family )
@@ -550,8 +671,30 @@ unify_address(term_t t, struct sockaddr_storage *addr)
 	return FALSE;
       break;
     }
+    case AF_INET6:
+    { struct sockaddr_in6 *addr6 = (struct sockaddr_in6*)addr;
+      if ( !nbio_unify_addr(av+0, (struct sockaddr*)addr) ||
+	   !PL_unify_integer(av+1, ntohs(addr6->sin6_port)) )
+	return FALSE;
+      break;
+    }
+#ifdef AF_UNIX
+    case AF_UNIX:
+    { struct sockaddr_un *addru = (struct sockaddr_un*)addr;
+      size_t off = offsetof(struct sockaddr_un, sun_path);
+
+      if ( alen <= off || !addru->sun_path[0] ) /* unnamed or abstract */
+	return PL_unify_atom(t, ATOM_af_unix);
+      return PL_unify_chars(t, PL_ATOM|REP_FN,
+			    strnlen(addru->sun_path, alen-off),
+			    addru->sun_path);
+    }
+#endif
+    case AF_UNSPEC:			/* connected: no address */
+      return PL_unify_atom(t, ATOM_af_unix);
     default:
-      assert(0);
+      return ( PL_put_integer(av+0, addr->ss_family) &&
+	       PL_domain_error("address_family", av+0) );
   }
 
   return PL_unify_term(t, PL_FUNCTOR_CHARS, ":", 2,
@@ -621,6 +764,8 @@ udp_receive(term_t Socket, term_t Data, term_t From, term_t options)
   int as = PL_STRING;
   int rc;
   int rep = REP_ISO_LATIN_1;
+  term_t Stamp = 0;
+  double stamp;
 
   if ( !PL_get_nil(options) )
   { term_t tail = PL_copy_term_ref(options);
@@ -645,6 +790,8 @@ udp_receive(term_t Socket, term_t Data, term_t From, term_t options)
 	} else if ( name == ATOM_encoding )
 	{ if ( !get_representation(arg, &rep) )
 	    return FALSE;
+	} else if ( name == ATOM_timestamp )
+	{ Stamp = PL_copy_term_ref(arg);
 	}
       } else
 	return PL_type_error("option", head);
@@ -661,8 +808,14 @@ udp_receive(term_t Socket, term_t Data, term_t From, term_t options)
       return pl_error(NULL, 0, NULL, ERR_RESOURCE, "memory");
   }
 
-  if ( (n=nbio_recvfrom(socket, buf, bufsize, flags,
-			(struct sockaddr*)&sockaddr, &alen)) == -1 )
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  if ( Stamp )
+    n = nbio_recvfrom_stamp(socket, buf, bufsize, flags,
+			    (struct sockaddr*)&sockaddr, &alen, &stamp);
+  else
+    n = nbio_recvfrom(socket, buf, bufsize, flags,
+		      (struct sockaddr*)&sockaddr, &alen);
+  if ( n == -1 )
   { rc = nbio_error(GET_ERRNO, TCP_ERRNO);
     goto out;
   }
@@ -677,7 +830,9 @@ udp_receive(term_t Socket, term_t Data, term_t From, term_t options)
   { rc = PL_unify_chars(Data, as|rep, n, buf);
   }
 
-  rc = rc && unify_address(From, &sockaddr);
+  rc = rc && unify_address(From, &sockaddr, alen);
+  if ( Stamp )
+    rc = rc && PL_unify_float(Stamp, stamp);
 
 out:
   if ( buf != smallbuf )
@@ -690,6 +845,7 @@ out:
 static foreign_t
 udp_send(term_t Socket, term_t Data, term_t To, term_t options)
 { struct sockaddr_storage sockaddr;
+  socklen_t alen;
   nbio_sock_t socket;
   int flags = 0L;
   char *data;
@@ -737,15 +893,31 @@ udp_send(term_t Socket, term_t Data, term_t To, term_t options)
   if ( !PL_get_nchars(Data, &dlen, &data, cvt|CVT_EXCEPTION|rep) )
     return FALSE;
 
-  if ( !tcp_get_socket(Socket, &socket) ||
-       !nbio_get_sockaddr(socket, To, &sockaddr, NULL) )
+  if ( !tcp_get_socket(Socket, &socket) )
     return FALSE;
 
+  if ( PL_is_variable(To) )		/* connected socket */
+  { alen = 0;
+  } else
+#ifdef AF_UNIX
+  if ( nbio_domain(socket) == AF_UNIX )
+  { int len;
+
+    if ( !af_unix_address(To, (struct sockaddr_un*)&sockaddr, &len, 0) )
+      return FALSE;
+    alen = len;
+  } else
+#endif
+  { if ( !nbio_get_sockaddr(socket, To, &sockaddr, NULL) )
+      return FALSE;
+    alen = sizeof_sockaddr(&sockaddr);
+  }
+
   if ( (n=nbio_sendto(socket, data,
 		      (int)dlen,
 		      flags,
-		      (struct sockaddr*)&sockaddr,
-		      sizeof_sockaddr(&sockaddr))) == -1 )
+		      alen ? (struct sockaddr*)&sockaddr : NULL,
+		      alen)) == -1 )
     return nbio_error(GET_ERRNO, TCP_ERRNO);;
 
   return TRUE;
@@ -799,6 +971,10 @@ socket_create(term_t socket, term_t options)
     type = SOCK_STREAM;
   else if ( a_type == ATOM_dgram )
     type = SOCK_DGRAM;
+#if defined(SOCK_SEQPACKET) && defined(AF_UNIX)
+  else if ( a_type == ATOM_seqpacket && domain == AF_UNIX )
+    type = SOCK_SEQPACKET;
+#endif
   else
     return atom_domain_error("socket_type", a_type);
 
@@ -825,6 +1001,28 @@ tcp_socket(term_t socket)
 }
 
 
+static foreign_t
+pl_socket_from_fd(term_t Fd, term_t Socket)
+{ int fd;
+  nbio_sock_t sock;
+
+  if ( !PL_get_integer_ex(Fd, &fd) )
+    return FALSE;
+  if ( fd < 0 )
+    return PL_domain_error("file_no", Fd);
+  if ( nbio_fd_socket((SOCKET)fd) )
+    return PL_permission_error("adopt", "socket", Fd);
+
+  if ( !(sock = nbio_adopt_socket((SOCKET)fd)) )
+    return FALSE;
+  if ( tcp_unify_socket(Socket, sock) )
+    return TRUE;
+
+  nbio_closesocket(sock);
+  return FALSE;
+}
+
+
 static foreign_t
 udp_socket(term_t socket)
 { return create_socket(AF_INET, SOCK_DGRAM, socket);
@@ -977,12 +1175,12 @@ pl_accept(term_t Master, term_t Slave, term_t Peer)
       return FALSE;
   } else
 #endif
-  { struct sockaddr_in addr;
+  { struct sockaddr_storage addr;
     socklen_t addrlen = sizeof(addr);
 
     if ( !(slave = nbio_accept(master, (struct sockaddr*)&addr, &addrlen)) )
       return FALSE;
-    if ( !nbio_unify_ip4(Peer, ntohl(addr.sin_addr.s_addr)) )
+    if ( !nbio_unify_addr(Peer, (struct sockaddr*)&addr) )
       goto failure;
   }
 
@@ -1025,6 +1223,38 @@ pl_gethostname(term_t name)
 }
 
 
+static foreign_t
+pl_socket_statistics(term_t stats)
+{ static const char *names[] =
+  { "allocated", "open", "listening", "accepted", "connected",
+    "streams", "idle_timeout", NULL
+  };
+  nbio_stats st;
+  size_t values[7];
+  term_t tail = PL_copy_term_ref(stats);
+  term_t head = PL_new_term_ref();
+  int i;
+
+  nbio_statistics(&st);
+  values[0] = st.allocated;
+  values[1] = st.open;
+  values[2] = st.listening;
+  values[3] = st.accepted;
+  values[4] = st.connected;
+  values[5] = st.streams;
+  values[6] = st.idle_timeout;
+
+  for(i=0; names[i]; i++)
+  { if ( !PL_unify_list(tail, head, tail) ||
+	 !PL_unify_term(head, PL_FUNCTOR_CHARS, names[i], 1,
+			        PL_INT64, (int64_t)values[i]) )
+      return FALSE;
+  }
+
+  return PL_unify_nil(tail);
+}
+
+
 #ifdef O_DEBUG
 static foreign_t
 pl_debug(term_t val)
@@ -1053,9 +1283,19 @@ install_socket(void)
   MKATOM(broadcast);
   MKATOM(codes);
   MKATOM(dgram);
+  MKATOM(seqpacket);
   MKATOM(dispatch);
   MKATOM(domain);
   MKATOM(encoding);
+  MKATOM(fastopen);
+  MKATOM(fastopen_connect);
+  MKATOM(idle_timeout);
+  MKATOM(defer_accept);
+  MKATOM(backlog);
+  MKATOM(accept_queue);
+  MKATOM(accept_queue_max);
+  MKATOM(listen_overflows);
+  MKATOM(listen_drops);
   MKATOM(file_no);
   MKATOM(host);
   MKATOM(inet);
@@ -1065,6 +1305,7 @@ install_socket(void)
   MKATOM(ip_drop_membership);
   MKATOM(local);
   MKATOM(max_message_size);
+  MKATOM(timestamp);
   MKATOM(nodelay);
   MKATOM(nonblock);
   MKATOM(reuseaddr);
@@ -1082,11 +1323,13 @@ install_socket(void)
   PL_register_foreign("tcp_listen",           2, pl_listen,           0);
   PL_register_foreign("tcp_open_socket",      3, pl_open_socket,      0);
   PL_register_foreign("tcp_socket",           1, tcp_socket,          0);
+  PL_register_foreign("tcp_socket_from_fd",   2, pl_socket_from_fd,   0);
   PL_register_foreign("tcp_close_socket",     1, pl_close_socket,     0);
   PL_register_foreign("tcp_setopt",           2, pl_setopt,           0);
   PL_register_foreign("tcp_getopt",           2, pl_getopt,           0);
   PL_register_foreign("$host_address",        3, pl_host_address,     0);
   PL_register_foreign("gethostname",          1, pl_gethostname,      0);
+  PL_register_foreign("socket_statistics",    1, pl_socket_statistics, 0);
 
   PL_register_foreign("socket_create",        2, socket_create,       0);
   PL_register_foreign("udp_socket",           1, udp_socket,          0);
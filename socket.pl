@@ -38,6 +38,8 @@
 :- module(socket,
           [ socket_create/2,		% -Socket, +Options
 	    tcp_socket/1,               % -Socket
+            tcp_socket_from_fd/2,       % +FileNo, -Socket
+            tcp_inherited_sockets/1,    % -Sockets
             tcp_close_socket/1,         % +Socket
             tcp_open_socket/3,          % +Socket, -Read, -Write
             tcp_connect/2,              % +Socket, +Address
@@ -53,6 +55,7 @@
             tcp_host_to_address/2,      % ?HostName, ?Ip-nr
             tcp_select/3,               % +Inputs, -Ready, +Timeout
             gethostname/1,              % -HostName
+            socket_statistics/1,        % -Stats
 
             ip_name/2,			% ?Ip, ?Name
 
@@ -65,7 +68,7 @@
             negotiate_socks_connection/2% +DesiredEndpoint, +StreamPair
           ]).
 :- use_module(library(debug), [assertion/1, debug/3]).
-:- autoload(library(lists), [last/2, member/2, append/3, append/2]).
+:- autoload(library(lists), [last/2, member/2, append/3, append/2, nth0/3]).
 :- autoload(library(apply), [maplist/3, maplist/2]).
 :- autoload(library(error),
             [instantiation_error/1, syntax_error/1, must_be/2, domain_error/2]).
@@ -209,6 +212,7 @@ representation and the above defined address terms.
 :- predicate_options(tcp_connect/3, 3,
                      [ bypass_proxy(boolean),
                        nodelay(boolean),
+                       fastopen(boolean),
                        domain(oneof([inet,inet6]))
                      ]).
 
@@ -228,7 +232,12 @@ representation and the above defined address terms.
 %       as `unix`)
 %     - type(+Type)
 %       One of `stream` (default) to create a TCP connection or
-%       `dgram` to create a UDP socket.
+%       `dgram` to create a UDP socket.  For the `unix` domain,
+%       `dgram` and `seqpacket` create message oriented sockets
+%       that preserve message boundaries.  `seqpacket` sockets
+%       are connection oriented and reliable, using tcp_listen/2,
+%       tcp_accept/3 and tcp_connect/2.  Messages are exchanged
+%       on both types using udp_send/4 and udp_receive/4.
 %
 %   This   predicate    subsumes   tcp_socket/1,    udp_socket/1   and
 %   unix_domain_socket/1.
@@ -253,6 +262,85 @@ representation and the above defined address terms.
 %   represented as multiple  bytes. If the length limit  is exceeded a
 %   representation_error(af_unix_name) exception is raised.
 
+%!  tcp_socket_from_fd(+FileNo, -SocketId) is det.
+%
+%   Create SocketId for  an  existing  OS   socket  FileNo  that  was
+%   inherited from the parent process.  If the socket is listening,
+%   tcp_accept/3 may be called on SocketId immediately.  This allows a
+%   supervisor to keep the listening socket of a server open while
+%   the server restarts.  Raises a `permission_error` if FileNo is
+%   already wrapped by a SocketId.  See also tcp_inherited_sockets/1.
+
+%!  tcp_inherited_sockets(-Sockets:list(pair)) is det.
+%
+%   Sockets is a list Name-SocketId for the sockets passed using the
+%   systemd socket activation protocol. These are the file descriptors
+%   3 ... 3+`LISTEN_FDS`-1, provided `LISTEN_PID` is the pid of this
+%   process. Name is taken from `LISTEN_FDNAMES` and is `unknown` if
+%   no name is provided.  The environment variables are removed after
+%   the sockets have been adopted, so they are not passed on to
+%   child processes.  Subsequent calls return the same list.  A
+%   typical server does:
+%
+%     ```
+%     server(Port) :-
+%         (   tcp_inherited_sockets([_-Socket|_])
+%         ->  true
+%         ;   tcp_socket(Socket),
+%             tcp_setopt(Socket, reuseaddr),
+%             tcp_bind(Socket, Port),
+%             tcp_listen(Socket, 64)
+%         ),
+%         accept_loop(Socket).
+%     ```
+
+:- dynamic
+    inherited_socket/2,                 % Name, Socket
+    inherited_sockets_done/0.
+:- volatile
+    inherited_socket/2,
+    inherited_sockets_done/0.
+
+tcp_inherited_sockets(Sockets) :-
+    (   inherited_sockets_done
+    ->  true
+    ;   with_mutex(socket, inherit_sockets)
+    ),
+    findall(Name-Socket, inherited_socket(Name, Socket), Sockets).
+
+inherit_sockets :-
+    inherited_sockets_done,
+    !.
+inherit_sockets :-
+    (   getenv('LISTEN_PID', PidAtom),
+        atom_number(PidAtom, Pid),
+        current_prolog_flag(pid, Pid),
+        getenv('LISTEN_FDS', CountAtom),
+        atom_number(CountAtom, Count),
+        Count > 0
+    ->  (   getenv('LISTEN_FDNAMES', NamesAtom)
+        ->  atomic_list_concat(Names, :, NamesAtom)
+        ;   Names = []
+        ),
+        Last is 3+Count-1,
+        forall(between(3, Last, Fd),
+               inherit_socket(Fd, Names)),
+        unsetenv('LISTEN_PID'),
+        unsetenv('LISTEN_FDS'),
+        unsetenv('LISTEN_FDNAMES')
+    ;   true
+    ),
+    assertz(inherited_sockets_done).
+
+inherit_socket(Fd, Names) :-
+    I is Fd-3,
+    (   nth0(I, Names, Name)
+    ->  true
+    ;   Name = unknown
+    ),
+    tcp_socket_from_fd(Fd, Socket),
+    assertz(inherited_socket(Name, Socket)).
+
 %!  tcp_close_socket(+SocketId) is det.
 %
 %   Closes the indicated socket, making  SocketId invalid. Normally,
@@ -434,6 +522,14 @@ tcp_connect(Socket, Address, Read, Write) :-
 %        Defaults to =false=. If =true=, set nodelay on the
 %        resulting socket using tcp_setopt(Socket, nodelay)
 %
+%      * fastopen(+Boolean)
+%        Defaults to =false=. If =true=, use TCP Fast Open, such that
+%        the first flush of the output stream is sent with the SYN
+%        packet if the server supports it.  See the `fastopen_connect`
+%        option of tcp_setopt/2.  This option is silently ignored if
+%        the OS does not support TCP Fast Open.  It has no effect on
+%        connections realised through a proxy.
+%
 %      * domain(+Domain)
 %        One of `inet' or `inet6`.  When omitted we use host_address/2
 %        with type(stream) and try the returned addresses in order.
@@ -510,6 +606,7 @@ tcp_connect_direct(Host0:Port, Socket, StreamPair, Options) :-
             IP = Address.address
         ),
 	socket_create(Socket, [domain(Domain)]),
+	connect_options(Socket, IP:Port, Options),
 	E = error(_,_),
 	catch(connect_or_discard_socket(Socket, IP:Port, StreamPair),
 	      E, store_error_and_fail(State, E)),
@@ -521,8 +618,22 @@ tcp_connect_direct(Host0:Port, Socket, StreamPair, Options) :-
     ).
 tcp_connect_direct(Address, Socket, StreamPair, Options) :-
     make_socket(Address, Socket, Options),
+    connect_options(Socket, Address, Options),
     connect_or_discard_socket(Socket, Address, StreamPair).
 
+%!  connect_options(+Socket, +Address, +Options) is det.
+%
+%   Apply options of tcp_connect/3  that  must   be  set  before  the
+%   socket is connected.  These only apply to TCP sockets.
+
+connect_options(Socket, _Host:_Port, Options) :-
+    option(fastopen(true), Options),
+    !,
+    catch(tcp_setopt(Socket, fastopen_connect(true)),
+          error(domain_error(socket_option, _), _),
+          true).
+connect_options(_, _, _).
+
 is_ip(ip(_,_,_,_), inet).
 is_ip(ip(_,_,_,_, _,_,_,_), inet6).
 
@@ -579,12 +690,8 @@ tcp_select(ListOfStreams, ReadyList, TimeOut) :-
                  *******************************/
 
 try_a_proxy(Address, Result) :-
-    format(atom(URL), 'socket://~w', [Address]),
-    (   Address = Host:_
-    ->  true
-    ;   Host = Address
-    ),
-    proxy_for_url(URL, Host, Proxy),
+    address_proxies(Address, Proxies),
+    member(Proxy, Proxies),
     debug(socket(proxy), 'Socket connecting via ~w~n', [Proxy]),
     (   catch(try_proxy(Proxy, Address, Socket, Stream), E, true)
     ->  (   var(E)
@@ -595,6 +702,66 @@ try_a_proxy(Address, Result) :-
     ),
     debug(socket(proxy), 'Socket: ~w: ~p', [Proxy, Result]).
 
+%!  address_proxies(+Address, -Proxies:list) is det.
+%
+%   Proxies is the list of proxies proxy_for_url/3 returns for Address.
+%   If there are no hooks we  do  not   even  create  the URL. Otherwise
+%   the  result  is  cached  per  address  for  the  number  of  seconds
+%   specified by the flag `socket_proxy_cache_ttl`  (default 60, 0 does
+%   not cache).  The cache is invalidated if  the clauses for the hook
+%   are modified, for example by loading library(http/http_proxy).
+
+:- create_prolog_flag(socket_proxy_cache_ttl, 60, [keep(true)]).
+
+:- dynamic
+    proxy_cache/4.                      % Address, Generation, Expires, Proxies
+:- volatile
+    proxy_cache/4.
+
+address_proxies(Address, Proxies) :-
+    proxy_hook_generation(Generation),
+    !,
+    current_prolog_flag(socket_proxy_cache_ttl, TTL),
+    get_time(Now),
+    (   TTL > 0,
+        proxy_cache(Address, Generation, Expires, Proxies0),
+        Expires > Now
+    ->  Proxies = Proxies0
+    ;   findall(Proxy, address_proxy(Address, Proxy), Proxies),
+        (   TTL > 0,
+            ground(Address)
+        ->  Expires is Now+TTL,
+            cache_proxies(Address, Generation, Expires, Proxies)
+        ;   true
+        )
+    ).
+address_proxies(_, []).
+
+proxy_hook_generation(Generation) :-
+    predicate_property(proxy_for_url(_,_,_), number_of_clauses(Count)),
+    Count > 0,
+    (   predicate_property(proxy_for_url(_,_,_),
+                           last_modified_generation(Generation))
+    ->  true
+    ;   Generation = 0
+    ).
+
+address_proxy(Address, Proxy) :-
+    format(atom(URL), 'socket://~w', [Address]),
+    (   Address = Host:_
+    ->  true
+    ;   Host = Address
+    ),
+    proxy_for_url(URL, Host, Proxy).
+
+cache_proxies(Address, Generation, Expires, Proxies) :-
+    (   predicate_property(proxy_cache(_,_,_,_), number_of_clauses(Count)),
+        Count >= 1000
+    ->  retractall(proxy_cache(_,_,_,_))
+    ;   retractall(proxy_cache(Address, _, _, _))
+    ),
+    assertz(proxy_cache(Address, Generation, Expires, Proxies)).
+
 %!  try_proxy(+Proxy, +TargetAddress, -Socket, -StreamPair) is semidet.
 %
 %   Attempt  a  socket-level  connection  via  the  given  proxy  to
@@ -649,6 +816,11 @@ try_proxy(socks(Host, Port), Address, Socket, StreamPair) :-
 %   auto-config](http://en.wikipedia.org/wiki/Proxy_auto-config).
 %   Additional methods can  be  returned   if  suitable  clauses for
 %   http:http_connection_over_proxy/6 or try_proxy/4 are defined.
+%
+%   tcp_connect/3 caches the proxies  returned   for  an  address for
+%   `socket_proxy_cache_ttl` seconds (default 60).  Hooks whose answer
+%   depends on state other than  their   own  clauses should set this
+%   flag to 0.
 
 :- multifile
     proxy_for_url/3.
@@ -676,6 +848,14 @@ try_proxy(socks(Host, Port), Address, Socket, StreamPair) :-
 %     Specify  the  maximum  number  of  bytes  to  read  from  a  UDP
 %     datagram. Size must be within the range 0-65535. If unspecified,
 %     a maximum of 4096 bytes will be read.
+%     - timestamp(-Time)
+%     Unify Time with the time the  datagram arrived as a float in
+%     seconds since the Unix epoch, i.e., comparable with get_time/1.
+%     The time is provided by the kernel (SO_TIMESTAMPNS on Linux or
+%     SO_TIMESTAMP), so `get_time(Now), Delay is Now-Time` is the time
+%     the datagram waited in the socket queue.  The first use enables
+%     timestamps on Socket.  If the OS does not provide timestamps,
+%     Time is the time the datagram was read.
 %
 %   For example:
 %
@@ -723,6 +903,12 @@ try_proxy(socks(Host, Port), Address, Socket, StreamPair) :-
 %   A  broadcast is  achieved by  using tcp_setopt(Socket,  broadcast)
 %   prior  to  sending  the  datagram  and  using  the  local  network
 %   broadcast address as a ip/4 term.
+%
+%   For `unix` domain `dgram` and `seqpacket` sockets (see
+%   socket_create/2), To is a file name and the From argument of
+%   udp_receive/4 is the file name of the sender or `af_unix` if the
+%   sender is not bound or the socket is connected.  If Socket is
+%   connected, To may be unbound.
 
 
                  /*******************************
@@ -783,6 +969,41 @@ try_proxy(socks(Host, Port), Address, Socket, StreamPair) :-
 %     =true=. Only very specific situations require setting
 %     this to =false=.
 %
+%     - fastopen(+QueueLength)
+%     Enable TCP Fast Open (RFC 7413) on a listening socket.  This
+%     allows clients that obtained a cookie in an earlier connection
+%     to send their first data with the SYN packet, saving a round
+%     trip.  QueueLength is the maximum number of pending Fast Open
+%     requests.  Must be called before tcp_listen/2.  Raises a
+%     `domain_error` if the OS does not support TCP Fast Open.
+%
+%     - fastopen_connect
+%     - fastopen_connect(+Boolean)
+%     Enable TCP Fast Open for a client socket.  Must be called
+%     before tcp_connect/2.  The connection is established on the
+%     first write, which is sent together with the SYN packet.  Only
+%     supported on Linux (TCP_FASTOPEN_CONNECT).  See also the
+%     fastopen(Boolean) option of tcp_connect/3.
+%
+%     - idle_timeout(+Seconds)
+%     Shut down the connection if there has been no successful read
+%     or write for Seconds (rounded up to whole seconds).  A thread
+%     blocked on the socket is woken up and subsequent I/O raises
+%     socket_error(etimedout, _).  The timeout is handled by a
+%     single background thread, avoiding the cost of an alarm per
+%     read as with call_with_time_limit/2.  Setting the option on a
+%     listening socket applies it to all sockets accepted from it;
+%     the listening socket itself is never shut down.  For UDP
+%     sockets, udp_send/4 and udp_receive/4 count as I/O.
+%     Seconds = 0 disables the timeout.  Not supported on Windows.
+%
+%     - defer_accept(+Seconds)
+%     Listening sockets only.  Do not complete tcp_accept/3 for a new
+%     connection until the client has sent data, or until Seconds
+%     have passed.  This avoids waking an accept thread for clients
+%     that connect without sending a request.  Uses TCP_DEFER_ACCEPT
+%     and raises a `domain_error` where this is not supported.
+%
 %     - sndbuf(+Integer)
 %     Sets the send buffer size to Integer (bytes). On Windows this defaults
 %     (now) to 64kb. Higher latency links may benefit from increasing this
@@ -817,6 +1038,32 @@ tcp_fcntl(Socket, setfl, nonblock) :-
 %     - file_no(-File)
 %     Get the OS file handle as an integer.  This may be used for
 %     debugging and integration.
+%
+%     - backlog(-Count)
+%     The backlog passed to tcp_listen/2.
+%
+%     - accept_queue(-Count)
+%     The number of connections that have completed the handshake and
+%     are waiting for tcp_accept/3.
+%
+%     - accept_queue_max(-Count)
+%     The effective maximum length of the accept queue.  This is the
+%     backlog, limited by the system (e.g., `net.core.somaxconn` on
+%     Linux).
+%
+%     - listen_overflows(-Count)
+%     - listen_drops(-Count)
+%     Number of times a connection was dropped because an accept
+%     queue was full (`ListenOverflows`) and the total number of
+%     dropped connection requests (`ListenDrops`).  These counters are
+%     __system wide__, i.e., not specific to Socket.
+%
+%   The options backlog, accept_queue and accept_queue_max apply to
+%   listening sockets only and raise a `permission_error` otherwise.
+%   The accept_queue options use TCP_INFO and the listen counters
+%   read `/proc/net/netstat`.  Both are only available on Linux.
+%   Where not available, the accept_queue options fail and the
+%   listen counters raise a `domain_error`.
 
 %!  host_address(+HostName, -Address, +Options) is nondet.
 %!  host_address(-HostName, +Address, +Options) is det.
@@ -881,6 +1128,13 @@ tcp_host_to_address(Host, Address), ground(Host) =>
 %   achieved by calling gethostname() and  return the canonical name
 %   returned by getaddrinfo().
 
+%!  socket_statistics(-Stats:list) is det.
+%
+%   Stats is a list of Name(Count) terms   describing the socket table.
+%   The names are `allocated` (slots in  the table), `open` (sockets in
+%   use) and the number of open sockets that are `listening`, `accepted`
+%   or `connected`, have Prolog `streams` or have an `idle_timeout`.
+
 
 %!  ip_name(?IP, ?Name) is det.
 %
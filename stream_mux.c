@@ -0,0 +1,1081 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <config.h>
+#include <SWI-Stream.h>
+#include <SWI-Prolog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Multiplex logical channels over  a   single  stream  pair, typically a TCP
+connection. The wire format follows yamux: each frame has a 12 byte header
+holding the version, type, flags, channel id and length in network byte
+order, optionally followed by data.
+
+Each channel has a receive window.  A  peer may send at most that number
+of bytes before it receives a WINDOW_UPDATE  frame. This bounds the data
+buffered for each channel.  A single reader thread per multiplexer (see
+stream_mux.pl) reads all frames and   dispatches  them to their channel.
+As the reader never blocks on a  channel,   a  slow  channel cannot stall
+the others. Writers take a ticket such that  frames are sent in FIFO order.
+Large writes are split in frames of  at most max_frame bytes, so channels
+sharing the connection get a fair share.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#define MUX_VERSION	   0
+#define MUX_HDR_SIZE	  12
+
+#define MUX_TYPE_DATA	   0
+#define MUX_TYPE_WINDOW	   1
+#define MUX_TYPE_PING	   2
+#define MUX_TYPE_GOAWAY	   3
+
+#define MUX_FLAG_SYN	 0x1
+#define MUX_FLAG_ACK	 0x2
+#define MUX_FLAG_FIN	 0x4
+#define MUX_FLAG_RST	 0x8
+
+#define MUX_INITIAL_WINDOW (256*1024)	/* Implicit window of a new channel */
+#define MUX_MAX_WINDOW	   (64*1024*1024)
+#define MUX_DEFAULT_FRAME  (16*1024)
+#define MUX_HASH_SIZE	   64
+#define MUX_BACKLOG	   128		/* Default max unaccepted channels */
+
+					/* stream_mux flags */
+#define MUX_CLOSED	0x01		/* stream_mux_close/1 was called */
+#define MUX_GOAWAY	0x02		/* peer sent GOAWAY */
+#define MUX_EOF		0x04		/* reader reached end of input */
+#define MUX_ERROR	0x08		/* I/O or protocol error */
+#define MUX_OUT_CLOSED	0x10		/* parent output is closed */
+#define MUX_DESTROYED	0x20		/* being destroyed */
+
+					/* mux_channel flags */
+#define CH_REMOTE_FIN	0x01		/* peer closed its output */
+#define CH_RESET	0x02		/* channel was reset */
+#define CH_IN_CLOSED	0x04		/* our input stream is closed */
+#define CH_OUT_CLOSED	0x08		/* our output stream is closed */
+
+#define MUX_BROKEN (MUX_EOF|MUX_ERROR)
+
+typedef struct mux_channel
+{ struct stream_mux *mux;		/* Multiplexer I belong to */
+  uint32_t	    id;			/* Channel id */
+  int		    flags;		/* CH_* */
+  struct mux_channel *next;		/* Next in hash bucket */
+  struct mux_channel *next_accept;	/* Next in accept queue */
+  char		   *buf;		/* Received data */
+  size_t	    bufsize;		/* Allocated size of buf */
+  size_t	    start;		/* Start of unread data */
+  size_t	    end;		/* End of unread data */
+  uint32_t	    recv_window;	/* Bytes the peer may send */
+  uint32_t	    consumed;		/* Read, but not yet credited */
+  uint32_t	    send_window;	/* Bytes we may send */
+} mux_channel;
+
+typedef struct stream_mux
+{ IOSTREAM	   *in;			/* Parent input */
+  IOSTREAM	   *out;		/* Parent output */
+  pthread_mutex_t   mutex;		/* Lock for all fields */
+  pthread_cond_t    cond;		/* Signals any state change */
+  int		    flags;		/* MUX_* */
+  int		    refs;		/* Handle and reader */
+  uint64_t	    next_ticket;	/* Next write ticket */
+  uint64_t	    serving;		/* Ticket allowed to write */
+  uint32_t	    next_id;		/* Id for next channel we open */
+  uint32_t	    window;		/* Receive window per channel */
+  uint32_t	    max_frame;		/* Max data per frame */
+  size_t	    backlog;		/* Max unaccepted channels */
+  size_t	    nchannels;		/* Channels in the table */
+  mux_channel	   *channels[MUX_HASH_SIZE];
+  mux_channel	   *accept_head;	/* Queue of unaccepted channels */
+  mux_channel	   *accept_tail;
+  size_t	    accept_len;
+  char		   *scratch;		/* Reader frame buffer */
+  size_t	    scratch_size;
+} stream_mux;
+
+static atom_t ATOM_role;
+static atom_t ATOM_client;
+static atom_t ATOM_server;
+static atom_t ATOM_window;
+static atom_t ATOM_max_frame;
+static atom_t ATOM_backlog;
+
+#define LOCK(m)   pthread_mutex_lock(&(m)->mutex)
+#define UNLOCK(m) pthread_mutex_unlock(&(m)->mutex)
+
+
+		 /*******************************
+		 *	       FRAMES		*
+		 *******************************/
+
+static void
+put32(unsigned char *p, uint32_t v)
+{ p[0] = (v>>24)&0xff;
+  p[1] = (v>>16)&0xff;
+  p[2] = (v>>8)&0xff;
+  p[3] = v&0xff;
+}
+
+static uint32_t
+get32(const unsigned char *p)
+{ return ((uint32_t)p[0]<<24)|((uint32_t)p[1]<<16)|((uint32_t)p[2]<<8)|p[3];
+}
+
+/* mux_send() sends a frame.  It must be called with the mutex locked
+   and returns with the mutex locked.  The mutex is released while
+   writing.  If close is TRUE, the parent output is closed after the
+   frame has been written.
+*/
+
+static int
+mux_send(stream_mux *m, int type, int flags, uint32_t id,
+	 uint32_t length, const char *data, size_t dlen, int close)
+{ uint64_t ticket = m->next_ticket++;
+  unsigned char hdr[MUX_HDR_SIZE];
+  IOSTREAM *out;
+  int rc = 0;
+
+  while ( m->serving != ticket )
+    pthread_cond_wait(&m->cond, &m->mutex);
+
+  if ( (m->flags & (MUX_ERROR|MUX_OUT_CLOSED)) )
+  { m->serving++;
+    pthread_cond_broadcast(&m->cond);
+    errno = EPIPE;
+    return -1;
+  }
+  out = m->out;
+  if ( close )
+    m->flags |= MUX_OUT_CLOSED;
+  UNLOCK(m);
+
+  hdr[0] = MUX_VERSION;
+  hdr[1] = type;
+  hdr[2] = (flags>>8)&0xff;
+  hdr[3] = flags&0xff;
+  put32(hdr+4, id);
+  put32(hdr+8, length);
+
+  if ( Sfwrite(hdr, 1, MUX_HDR_SIZE, out) != MUX_HDR_SIZE ||
+       (dlen > 0 && Sfwrite(data, 1, dlen, out) != dlen) ||
+       Sflush(out) < 0 )
+    rc = -1;
+  if ( close )
+  { if ( Sclose(out) < 0 )
+      rc = -1;
+  }
+
+  LOCK(m);
+  if ( close )
+    m->out = NULL;
+  if ( rc < 0 )
+  { m->flags |= MUX_ERROR;
+    errno = EPIPE;
+  }
+  m->serving++;
+  pthread_cond_broadcast(&m->cond);
+
+  return rc;
+}
+
+/* mux_wait() waits for a state change.  It must be called with the
+   mutex locked.  While waiting, Prolog signals are processed.  Returns
+   FALSE if signal handling raised an exception.
+*/
+
+static int
+mux_wait(stream_mux *m)
+{ struct timespec deadline;
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  deadline.tv_sec  = now.tv_sec;
+  deadline.tv_nsec = (now.tv_usec+250000)*1000;
+  if ( deadline.tv_nsec >= 1000000000 )
+  { deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  if ( pthread_cond_timedwait(&m->cond, &m->mutex, &deadline) == ETIMEDOUT )
+  { int rc;
+
+    UNLOCK(m);
+    rc = PL_handle_signals();
+    LOCK(m);
+    if ( rc < 0 )
+    { errno = EPLEXCEPTION;
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+
+		 /*******************************
+		 *	      CHANNELS		*
+		 *******************************/
+
+static mux_channel *
+lookup_channel(stream_mux *m, uint32_t id)
+{ mux_channel *ch;
+
+  for(ch = m->channels[id%MUX_HASH_SIZE]; ch; ch = ch->next)
+  { if ( ch->id == id )
+      return ch;
+  }
+
+  return NULL;
+}
+
+static mux_channel *
+add_channel(stream_mux *m, uint32_t id)
+{ mux_channel *ch;
+  int key = id%MUX_HASH_SIZE;
+
+  if ( !(ch = calloc(1, sizeof(*ch))) )
+    return NULL;
+  ch->mux	  = m;
+  ch->id	  = id;
+  ch->recv_window = MUX_INITIAL_WINDOW;
+  ch->send_window = MUX_INITIAL_WINDOW;
+  ch->next	  = m->channels[key];
+  m->channels[key] = ch;
+  m->nchannels++;
+
+  return ch;
+}
+
+static void
+free_channel(stream_mux *m, mux_channel *ch)
+{ mux_channel **p = &m->channels[ch->id%MUX_HASH_SIZE];
+
+  for(; *p; p = &(*p)->next)
+  { if ( *p == ch )
+    { *p = ch->next;
+      break;
+    }
+  }
+  m->nchannels--;
+  if ( ch->buf )
+    free(ch->buf);
+  free(ch);
+}
+
+/* shutdown_output() sends GOAWAY and closes the parent output after
+   stream_mux_close/1 if no channels remain.
+*/
+
+static void
+shutdown_output(stream_mux *m)
+{ if ( (m->flags & MUX_CLOSED) && m->nchannels == 0 &&
+       !(m->flags & (MUX_OUT_CLOSED|MUX_ERROR)) )
+    mux_send(m, MUX_TYPE_GOAWAY, 0, 0, 0, NULL, 0, TRUE);
+}
+
+/* Free the channel if both our streams are closed and the peer is done
+   with it.  Called with the mutex locked.
+*/
+
+static void
+release_channel(stream_mux *m, mux_channel *ch)
+{ if ( (ch->flags & CH_IN_CLOSED) && (ch->flags & CH_OUT_CLOSED) &&
+       ((ch->flags & (CH_REMOTE_FIN|CH_RESET)) || (m->flags & MUX_BROKEN)) )
+  { free_channel(m, ch);
+    shutdown_output(m);
+  }
+}
+
+static int
+append_data(mux_channel *ch, const char *data, size_t len)
+{ if ( ch->end + len > ch->bufsize )
+  { if ( ch->start > 0 )		/* compact */
+    { memmove(ch->buf, ch->buf+ch->start, ch->end-ch->start);
+      ch->end -= ch->start;
+      ch->start = 0;
+    }
+    if ( ch->end + len > ch->bufsize )
+    { size_t newsize = ch->bufsize ? ch->bufsize : 4096;
+      char *nb;
+
+      while ( newsize < ch->end + len )
+	newsize *= 2;
+      if ( !(nb = realloc(ch->buf, newsize)) )
+	return FALSE;
+      ch->buf = nb;
+      ch->bufsize = newsize;
+    }
+  }
+
+  memcpy(ch->buf+ch->end, data, len);
+  ch->end += len;
+
+  return TRUE;
+}
+
+
+static void
+destroy_mux(stream_mux *m)
+{ int i;
+
+  for(i=0; i<MUX_HASH_SIZE; i++)
+  { mux_channel *ch, *next;
+
+    for(ch=m->channels[i]; ch; ch=next)
+    { next = ch->next;
+      if ( ch->buf )
+	free(ch->buf);
+      free(ch);
+    }
+  }
+  if ( m->out )
+    Sclose(m->out);
+  if ( m->in )
+    Sclose(m->in);
+  if ( m->scratch )
+    free(m->scratch);
+  pthread_cond_destroy(&m->cond);
+  pthread_mutex_destroy(&m->mutex);
+  free(m);
+}
+
+/* Destroy the multiplexer if neither the handle, the reader nor any
+   channel uses it.  Must be called without holding the mutex.
+*/
+
+static void
+check_destroy(stream_mux *m)
+{ int destroy;
+
+  LOCK(m);
+  destroy = ( m->refs == 0 && m->nchannels == 0 &&
+	      !(m->flags & MUX_DESTROYED) );
+  if ( destroy )
+    m->flags |= MUX_DESTROYED;
+  UNLOCK(m);
+
+  if ( destroy )
+    destroy_mux(m);
+}
+
+
+		 /*******************************
+		 *	  CHANNEL STREAMS	*
+		 *******************************/
+
+static ssize_t
+chan_read(void *handle, char *buf, size_t size)
+{ mux_channel *ch = handle;
+  stream_mux *m = ch->mux;
+  ssize_t rc;
+
+  LOCK(m);
+  for(;;)
+  { if ( ch->end > ch->start )
+    { size_t n = ch->end - ch->start;
+
+      if ( n > size )
+	n = size;
+      memcpy(buf, ch->buf+ch->start, n);
+      ch->start += n;
+      if ( ch->start == ch->end )
+	ch->start = ch->end = 0;
+      ch->consumed += n;
+      if ( ch->consumed >= m->window/2 &&
+	   !(ch->flags & (CH_REMOTE_FIN|CH_RESET)) )
+      { uint32_t delta = ch->consumed;
+
+	ch->consumed = 0;
+	ch->recv_window += delta;
+	mux_send(m, MUX_TYPE_WINDOW, 0, ch->id, delta, NULL, 0, FALSE);
+      }
+      rc = n;
+      break;
+    }
+    if ( ch->flags & CH_REMOTE_FIN )
+    { rc = 0;
+      break;
+    }
+    if ( (ch->flags & CH_RESET) || (m->flags & MUX_BROKEN) )
+    { errno = ECONNRESET;
+      rc = -1;
+      break;
+    }
+    if ( !mux_wait(m) )
+    { rc = -1;
+      break;
+    }
+  }
+  UNLOCK(m);
+
+  return rc;
+}
+
+
+static ssize_t
+chan_write(void *handle, char *buf, size_t size)
+{ mux_channel *ch = handle;
+  stream_mux *m = ch->mux;
+  size_t done = 0;
+  ssize_t rc = size;
+
+  LOCK(m);
+  while ( done < size )
+  { size_t n;
+
+    if ( (ch->flags & CH_RESET) || (m->flags & (MUX_ERROR|MUX_OUT_CLOSED)) )
+    { errno = (ch->flags & CH_RESET) ? ECONNRESET : EPIPE;
+      rc = -1;
+      break;
+    }
+    if ( ch->send_window == 0 )
+    { if ( !mux_wait(m) )
+      { rc = -1;
+	break;
+      }
+      continue;
+    }
+
+    n = size - done;
+    if ( n > ch->send_window )
+      n = ch->send_window;
+    if ( n > m->max_frame )
+      n = m->max_frame;
+    ch->send_window -= (uint32_t)n;
+    if ( mux_send(m, MUX_TYPE_DATA, 0, ch->id, (uint32_t)n,
+		  buf+done, n, FALSE) < 0 )
+    { rc = -1;
+      break;
+    }
+    done += n;
+  }
+  UNLOCK(m);
+
+  return rc;
+}
+
+
+static int
+chan_close_input(void *handle)
+{ mux_channel *ch = handle;
+  stream_mux *m = ch->mux;
+
+  LOCK(m);
+  ch->flags |= CH_IN_CLOSED;
+  if ( !(ch->flags & (CH_REMOTE_FIN|CH_RESET)) && !(m->flags & MUX_BROKEN) )
+  { uint32_t delta = ch->consumed + (uint32_t)(ch->end - ch->start);
+
+    if ( delta > 0 )			/* credit unread data; later data */
+    { ch->recv_window += delta;		/* is discarded by the reader */
+      mux_send(m, MUX_TYPE_WINDOW, 0, ch->id, delta, NULL, 0, FALSE);
+    }
+  }
+  ch->start = ch->end = 0;
+  ch->consumed = 0;
+  release_channel(m, ch);
+  UNLOCK(m);
+  check_destroy(m);
+
+  return 0;
+}
+
+
+static int
+chan_close_output(void *handle)
+{ mux_channel *ch = handle;
+  stream_mux *m = ch->mux;
+  int rc = 0;
+
+  LOCK(m);
+  ch->flags |= CH_OUT_CLOSED;
+  if ( !(ch->flags & CH_RESET) && !(m->flags & (MUX_ERROR|MUX_OUT_CLOSED)) )
+    rc = mux_send(m, MUX_TYPE_DATA, MUX_FLAG_FIN, ch->id, 0, NULL, 0, FALSE);
+  release_channel(m, ch);
+  UNLOCK(m);
+  check_destroy(m);
+
+  return rc;
+}
+
+
+static IOFUNCTIONS chan_input_functions =
+{ chan_read,
+  NULL,					/* write */
+  NULL,					/* seek */
+  chan_close_input,
+  NULL,					/* control */
+  NULL					/* seek64 */
+};
+
+static IOFUNCTIONS chan_output_functions =
+{ NULL,					/* read */
+  chan_write,
+  NULL,					/* seek */
+  chan_close_output,
+  NULL,					/* control */
+  NULL					/* seek64 */
+};
+
+
+#define COPY_FLAGS (SIO_TEXT|SIO_RECORDPOS)
+
+/* Create the Prolog streams for a channel.  On failure the channel is
+   marked closed and released.  Must be called without holding the
+   mutex.
+*/
+
+static int
+unify_channel_streams(stream_mux *m, mux_channel *ch, term_t In, term_t Out)
+{ IOSTREAM *in = NULL, *out = NULL;
+
+  if ( !(in = Snew(ch, SIO_INPUT|SIO_FBUF|(m->in->flags&COPY_FLAGS),
+		   &chan_input_functions)) ||
+       !(out = Snew(ch, SIO_OUTPUT|SIO_FBUF|(m->in->flags&COPY_FLAGS),
+		    &chan_output_functions)) )
+  { if ( in )
+      Sclose(in);
+    else
+      chan_close_input(ch);
+    chan_close_output(ch);
+
+    return PL_resource_error("memory");
+  }
+  in->encoding  = m->in->encoding;
+  out->encoding = m->out ? m->out->encoding : m->in->encoding;
+
+  if ( PL_unify_stream(In, in) &&
+       PL_unify_stream(Out, out) )
+    return TRUE;
+
+  Sclose(in);
+  Sclose(out);
+  return FALSE;
+}
+
+
+		 /*******************************
+		 *	       READER		*
+		 *******************************/
+
+/* Process a frame.  Called with the mutex locked.  Returns FALSE on a
+   protocol error.
+*/
+
+static int
+dispatch_frame(stream_mux *m, int type, int flags, uint32_t id,
+	       uint32_t length, const char *data)
+{ mux_channel *ch;
+
+  if ( type == MUX_TYPE_PING )
+  { if ( (flags & MUX_FLAG_SYN) )
+      mux_send(m, MUX_TYPE_PING, MUX_FLAG_ACK, 0, length, NULL, 0, FALSE);
+    return TRUE;
+  }
+  if ( type == MUX_TYPE_GOAWAY )
+  { m->flags |= MUX_GOAWAY;
+    pthread_cond_broadcast(&m->cond);
+    return TRUE;
+  }
+  if ( type != MUX_TYPE_DATA && type != MUX_TYPE_WINDOW )
+    return FALSE;
+
+  ch = lookup_channel(m, id);
+  if ( (flags & MUX_FLAG_SYN) )
+  { if ( ch || id == 0 )
+      return FALSE;
+    if ( (m->flags & MUX_CLOSED) || m->accept_len >= m->backlog ||
+	 !(ch = add_channel(m, id)) )
+    { mux_send(m, MUX_TYPE_WINDOW, MUX_FLAG_RST, id, 0, NULL, 0, FALSE);
+      return TRUE;
+    }
+    if ( m->accept_tail )
+      m->accept_tail->next_accept = ch;
+    else
+      m->accept_head = ch;
+    m->accept_tail = ch;
+    m->accept_len++;
+  }
+  if ( !ch )				/* late frame for a freed channel */
+    return TRUE;
+
+  if ( type == MUX_TYPE_WINDOW )
+  { if ( (uint64_t)ch->send_window + length > UINT32_MAX )
+      return FALSE;
+    ch->send_window += length;
+  } else if ( length > 0 )
+  { if ( length > ch->recv_window )
+      return FALSE;			/* peer violates flow control */
+    ch->recv_window -= length;
+    if ( (ch->flags & CH_IN_CLOSED) )
+    { ch->recv_window += length;	/* discard and credit */
+      mux_send(m, MUX_TYPE_WINDOW, 0, id, length, NULL, 0, FALSE);
+    } else if ( !append_data(ch, data, length) )
+    { return FALSE;
+    }
+  }
+
+  if ( (flags & MUX_FLAG_FIN) )
+    ch->flags |= CH_REMOTE_FIN;
+  if ( (flags & MUX_FLAG_RST) )
+    ch->flags |= CH_RESET;
+  pthread_cond_broadcast(&m->cond);
+  if ( (flags & (MUX_FLAG_FIN|MUX_FLAG_RST)) )
+    release_channel(m, ch);
+
+  return TRUE;
+}
+
+
+/* Read and dispatch frames until the parent input is exhausted.  Run
+   by the reader thread.
+*/
+
+static int
+run_reader(stream_mux *m)
+{ unsigned char hdr[MUX_HDR_SIZE];
+  int rc = TRUE;
+
+  for(;;)
+  { int type, flags;
+    uint32_t id, length;
+
+    if ( Sfread(hdr, 1, MUX_HDR_SIZE, m->in) != MUX_HDR_SIZE )
+    { if ( Sferror(m->in) )
+	rc = FALSE;
+      break;
+    }
+    if ( hdr[0] != MUX_VERSION )
+    { rc = FALSE;
+      break;
+    }
+    type   = hdr[1];
+    flags  = (hdr[2]<<8)|hdr[3];
+    id     = get32(hdr+4);
+    length = get32(hdr+8);
+
+    if ( type == MUX_TYPE_DATA && length > 0 )
+    { if ( length > m->window )
+      { rc = FALSE;
+	break;
+      }
+      if ( length > m->scratch_size )
+      { char *nb;
+
+	if ( !(nb = realloc(m->scratch, length)) )
+	{ rc = FALSE;
+	  break;
+	}
+	m->scratch = nb;
+	m->scratch_size = length;
+      }
+      if ( Sfread(m->scratch, 1, length, m->in) != length )
+      { rc = FALSE;
+	break;
+      }
+    }
+
+    LOCK(m);
+    if ( !dispatch_frame(m, type, flags, id, length,
+			 type == MUX_TYPE_DATA ? m->scratch : NULL) )
+    { UNLOCK(m);
+      rc = FALSE;
+      break;
+    }
+    UNLOCK(m);
+  }
+
+  LOCK(m);
+  m->flags |= (rc ? MUX_EOF : MUX_EOF|MUX_ERROR);
+  { int i;				/* free finished channels */
+
+    for(i=0; i<MUX_HASH_SIZE; i++)
+    { mux_channel *ch, *next;
+
+      for(ch=m->channels[i]; ch; ch=next)
+      { next = ch->next;
+	if ( (ch->flags & CH_IN_CLOSED) && (ch->flags & CH_OUT_CLOSED) )
+	  free_channel(m, ch);
+      }
+    }
+  }
+  shutdown_output(m);
+  m->refs--;
+  pthread_cond_broadcast(&m->cond);
+  UNLOCK(m);
+
+  return rc;
+}
+
+
+		 /*******************************
+		 *	       BLOB		*
+		 *******************************/
+
+typedef struct mux_ref
+{ stream_mux *mux;
+  int	      handle_released;		/* stream_mux_close/1 was called */
+} mux_ref;
+
+/* Drop the handle reference.  Unaccepted channels are reset and the
+   connection is shut down as soon as all channels are closed.
+*/
+
+static void
+close_mux_handle(mux_ref *ref)
+{ stream_mux *m = ref->mux;
+
+  LOCK(m);
+  if ( !ref->handle_released )
+  { ref->handle_released = TRUE;
+    m->flags |= MUX_CLOSED;
+    m->refs--;
+    while ( m->accept_head )
+    { mux_channel *ch = m->accept_head;
+
+      m->accept_head = ch->next_accept;
+      m->accept_len--;
+      mux_send(m, MUX_TYPE_WINDOW, MUX_FLAG_RST, ch->id, 0, NULL, 0, FALSE);
+      ch->flags |= CH_IN_CLOSED|CH_OUT_CLOSED|CH_RESET;
+      release_channel(m, ch);
+    }
+    m->accept_tail = NULL;
+    shutdown_output(m);
+    pthread_cond_broadcast(&m->cond);
+  }
+  UNLOCK(m);
+  check_destroy(m);
+}
+
+static int
+release_mux(atom_t symbol)
+{ mux_ref *ref = PL_blob_data(symbol, NULL, NULL);
+
+  close_mux_handle(ref);
+  PL_free(ref);
+
+  return TRUE;
+}
+
+static int
+write_mux(IOSTREAM *s, atom_t symbol, int flags)
+{ mux_ref *ref = PL_blob_data(symbol, NULL, NULL);
+
+  Sfprintf(s, "<stream_mux>(%p)", ref->mux);
+  return TRUE;
+}
+
+static PL_blob_t mux_blob =
+{ PL_BLOB_MAGIC,
+  PL_BLOB_NOCOPY,
+  "stream_mux",
+  release_mux,
+  NULL,
+  write_mux,
+  NULL
+};
+
+static int
+get_mux_ref(term_t t, mux_ref **rp)
+{ void *data;
+  PL_blob_t *type;
+
+  if ( PL_get_blob(t, &data, NULL, &type) && type == &mux_blob )
+  { *rp = data;
+    return TRUE;
+  }
+
+  return PL_type_error("stream_mux", t);
+}
+
+static int
+get_mux(term_t t, stream_mux **mp)
+{ mux_ref *ref;
+
+  if ( !get_mux_ref(t, &ref) )
+    return FALSE;
+  if ( ref->handle_released )
+    return PL_existence_error("stream_mux", t);
+  *mp = ref->mux;
+
+  return TRUE;
+}
+
+
+		 /*******************************
+		 *	  PROLOG CONNECTION	*
+		 *******************************/
+
+static foreign_t
+pl_stream_mux_create(term_t Pair, term_t Mux, term_t options)
+{ term_t tail = PL_copy_term_ref(options);
+  term_t head = PL_new_term_ref();
+  term_t arg  = PL_new_term_ref();
+  term_t blob = PL_new_term_ref();
+  int server = FALSE;
+  int64_t window = MUX_INITIAL_WINDOW;
+  int64_t max_frame = MUX_DEFAULT_FRAME;
+  int64_t backlog = MUX_BACKLOG;
+  IOSTREAM *in, *out;
+  stream_mux *m;
+  mux_ref *ref;
+
+  while(PL_get_list_ex(tail, head, tail))
+  { atom_t name;
+    size_t arity;
+
+    if ( !PL_get_name_arity(head, &name, &arity) || arity != 1 )
+      return PL_type_error("option", head);
+    _PL_get_arg(1, head, arg);
+
+    if ( name == ATOM_role )
+    { atom_t a;
+
+      if ( !PL_get_atom_ex(arg, &a) )
+	return FALSE;
+      if ( a == ATOM_server )
+	server = TRUE;
+      else if ( a == ATOM_client )
+	server = FALSE;
+      else
+	return PL_domain_error("stream_mux_role", arg);
+    } else if ( name == ATOM_window )
+    { if ( !PL_get_int64_ex(arg, &window) )
+	return FALSE;
+      if ( window < MUX_INITIAL_WINDOW || window > MUX_MAX_WINDOW )
+	return PL_domain_error("stream_mux_window", arg);
+    } else if ( name == ATOM_max_frame )
+    { if ( !PL_get_int64_ex(arg, &max_frame) )
+	return FALSE;
+      if ( max_frame < 1 || max_frame > MUX_INITIAL_WINDOW )
+	return PL_domain_error("stream_mux_frame_size", arg);
+    } else if ( name == ATOM_backlog )
+    { if ( !PL_get_int64_ex(arg, &backlog) )
+	return FALSE;
+      if ( backlog < 0 )
+	return PL_domain_error("not_less_than_zero", arg);
+    }
+  }
+  if ( !PL_get_nil_ex(tail) )
+    return FALSE;
+
+  if ( !PL_get_stream(Pair, &in, SIO_INPUT) )
+    return FALSE;
+  if ( !PL_get_stream(Pair, &out, SIO_OUTPUT) )
+  { PL_release_stream(in);
+    return FALSE;
+  }
+
+  if ( !(m = calloc(1, sizeof(*m))) ||
+       !(ref = PL_malloc(sizeof(*ref))) )
+  { if ( m )
+      free(m);
+    PL_release_stream(in);
+    PL_release_stream(out);
+    return PL_resource_error("memory");
+  }
+  pthread_mutex_init(&m->mutex, NULL);
+  pthread_cond_init(&m->cond, NULL);
+  m->in        = in;
+  m->out       = out;
+  m->refs      = 2;			/* handle and reader */
+  m->next_id   = server ? 2 : 1;
+  m->window    = (uint32_t)window;
+  m->max_frame = (uint32_t)max_frame;
+  m->backlog   = (size_t)backlog;
+  ref->mux = m;
+  ref->handle_released = FALSE;
+  PL_release_stream(in);
+  PL_release_stream(out);
+
+  if ( !PL_put_blob(blob, ref, sizeof(*ref), &mux_blob) )
+  { pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->mutex);
+    free(m);
+    PL_free(ref);
+    return FALSE;
+  }
+  if ( PL_unify(Mux, blob) )
+    return TRUE;
+
+  /* The blob now owns ref.  As the reader will never run and the
+     streams remain with the caller, detach them and drop the reader
+     reference, so releasing the blob destroys the multiplexer.
+  */
+  LOCK(m);
+  m->in  = NULL;
+  m->out = NULL;
+  m->flags |= MUX_OUT_CLOSED;
+  m->refs--;
+  UNLOCK(m);
+
+  return FALSE;
+}
+
+
+/* The reader owns a reference, so it must run even if the handle was
+   closed before the reader thread started.  A protocol or I/O error is
+   not raised here: the channels see it as a reset connection.
+*/
+
+static foreign_t
+pl_stream_mux_run(term_t Mux)
+{ mux_ref *ref;
+  stream_mux *m;
+
+  if ( !get_mux_ref(Mux, &ref) )
+    return FALSE;
+  m = ref->mux;
+
+  run_reader(m);
+  check_destroy(m);
+
+  return TRUE;
+}
+
+
+static foreign_t
+pl_stream_mux_open_channel(term_t Mux, term_t In, term_t Out)
+{ stream_mux *m;
+  mux_channel *ch;
+  uint32_t id;
+
+  if ( !get_mux(Mux, &m) )
+    return FALSE;
+
+  LOCK(m);
+  if ( (m->flags & (MUX_CLOSED|MUX_GOAWAY|MUX_BROKEN|MUX_OUT_CLOSED)) )
+  { UNLOCK(m);
+    return PL_permission_error("open_channel", "stream_mux", Mux);
+  }
+  id = m->next_id;
+  m->next_id += 2;
+  if ( !(ch = add_channel(m, id)) )
+  { UNLOCK(m);
+    return PL_resource_error("memory");
+  }
+  ch->recv_window = m->window;
+  if ( mux_send(m, MUX_TYPE_WINDOW, MUX_FLAG_SYN, id,
+		m->window - MUX_INITIAL_WINDOW, NULL, 0, FALSE) < 0 )
+  { ch->flags |= CH_IN_CLOSED|CH_OUT_CLOSED|CH_RESET;
+    release_channel(m, ch);
+    UNLOCK(m);
+    return PL_permission_error("open_channel", "stream_mux", Mux);
+  }
+  UNLOCK(m);
+
+  return unify_channel_streams(m, ch, In, Out);
+}
+
+
+static foreign_t
+pl_stream_mux_accept_channel(term_t Mux, term_t In, term_t Out)
+{ stream_mux *m;
+  mux_channel *ch;
+
+  if ( !get_mux(Mux, &m) )
+    return FALSE;
+
+  LOCK(m);
+  while ( !m->accept_head )
+  { if ( (m->flags & (MUX_CLOSED|MUX_GOAWAY|MUX_BROKEN)) )
+    { UNLOCK(m);
+      return FALSE;
+    }
+    if ( !mux_wait(m) )
+    { UNLOCK(m);
+      return FALSE;
+    }
+  }
+  ch = m->accept_head;
+  if ( !(m->accept_head = ch->next_accept) )
+    m->accept_tail = NULL;
+  m->accept_len--;
+  ch->next_accept = NULL;
+  if ( m->window > MUX_INITIAL_WINDOW )
+    ch->recv_window += m->window - MUX_INITIAL_WINDOW;
+  mux_send(m, MUX_TYPE_WINDOW, MUX_FLAG_ACK, ch->id,
+	   m->window - MUX_INITIAL_WINDOW, NULL, 0, FALSE);
+  UNLOCK(m);
+
+  return unify_channel_streams(m, ch, In, Out);
+}
+
+
+static foreign_t
+pl_stream_mux_close(term_t Mux)
+{ mux_ref *ref;
+
+  if ( !get_mux_ref(Mux, &ref) )
+    return FALSE;
+  close_mux_handle(ref);
+
+  return TRUE;
+}
+
+
+		 /*******************************
+		 *	       INSTALL		*
+		 *******************************/
+
+#define MKATOM(n) ATOM_ ## n = PL_new_atom(#n);
+
+install_t
+install_stream_mux(void)
+{ MKATOM(role);
+  MKATOM(client);
+  MKATOM(server);
+  MKATOM(window);
+  MKATOM(max_frame);
+  MKATOM(backlog);
+
+  PL_register_foreign("$stream_mux_create",	    3,
+		      pl_stream_mux_create,	    0);
+  PL_register_foreign("$stream_mux_run",	    1,
+		      pl_stream_mux_run,	    0);
+  PL_register_foreign("$stream_mux_open_channel",   3,
+		      pl_stream_mux_open_channel,   0);
+  PL_register_foreign("$stream_mux_accept_channel", 3,
+		      pl_stream_mux_accept_channel, 0);
+  PL_register_foreign("stream_mux_close",	    1,
+		      pl_stream_mux_close,	    0);
+}
@@ -0,0 +1,139 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+:- module(stream_mux,
+          [ stream_mux_open/3,          % +StreamPair, -Mux, +Options
+            stream_mux_open_channel/2,  % +Mux, -StreamPair
+            stream_mux_accept_channel/2,% +Mux, -StreamPair
+            stream_mux_close/1          % +Mux
+          ]).
+:- autoload(library(error), [must_be/2]).
+
+:- use_foreign_library(foreign(stream_mux)).
+
+:- predicate_options(stream_mux_open/3, 3,
+                     [ role(oneof([client,server])),
+                       window(positive_integer),
+                       max_frame(positive_integer),
+                       backlog(nonneg)
+                     ]).
+
+/** <module> Multiplex logical channels over a single connection
+
+This library runs multiple independent,  bi-directional channels over a
+single stream pair, typically a TCP  connection. Each channel appears as
+an ordinary Prolog stream pair. The wire protocol is modelled after
+_yamux_:
+
+  - Data is sent as frames of at most `max_frame` bytes.  Concurrent
+    writers take turns in FIFO order, so a channel that sends a lot of
+    data does not starve the other channels.
+  - Each channel has a _receive window_.  The peer may not send more
+    data than the window allows before the receiver has consumed
+    the data.  This bounds the memory used by a channel that is not
+    being read and prevents a slow channel from blocking the others.
+  - Each side may open channels.  Closing the output of a channel
+    sends end-of-file to the peer; the channel is released if both
+    sides closed their output.
+
+Both ends must use this library. One end uses role(client) and the other
+role(server) such that the channel identifiers they allocate do not
+clash. A typical server is below.
+
+  ```
+  serve_mux(Socket) :-
+      tcp_accept(Socket, Client, _Peer),
+      tcp_open_socket(Client, Pair),
+      stream_mux_open(Pair, Mux, [role(server)]),
+      forall(stream_mux_accept_channel(Mux, Channel),
+             thread_create(serve_channel(Channel), _, [detached(true)])).
+  ```
+*/
+
+%!  stream_mux_open(+StreamPair, -Mux, +Options) is det.
+%
+%   Create a multiplexer on top of StreamPair. The multiplexer takes
+%   ownership of StreamPair: it is closed when the multiplexer is
+%   closed and all channels are closed. StreamPair must not be used
+%   otherwise after this call. A thread is created that reads frames
+%   from the connection and dispatches them to the channels. Options:
+%
+%     - role(+Role)
+%       One of `client` (default) or `server`.  The two ends of the
+%       connection must use a different role.
+%     - window(+Bytes)
+%       Receive window per channel.  Default and minimum is 256Kb.
+%     - max_frame(+Bytes)
+%       Maximum amount of data in a single frame.  Default is 16Kb.
+%       Smaller frames improve fairness between channels at the
+%       price of more overhead.
+%     - backlog(+Count)
+%       Maximum number of channels opened by the peer that are not
+%       yet accepted using stream_mux_accept_channel/2.  If more
+%       channels are opened they are reset.  Default is 128.
+
+stream_mux_open(StreamPair, Mux, Options) :-
+    must_be(list, Options),
+    '$stream_mux_create'(StreamPair, Mux, Options),
+    thread_create('$stream_mux_run'(Mux), _, [detached(true)]).
+
+%!  stream_mux_open_channel(+Mux, -StreamPair) is det.
+%
+%   Open a new channel on Mux.  StreamPair is a stream pair that is
+%   connected to the stream pair returned by
+%   stream_mux_accept_channel/2 at the other end.
+%
+%   @error permission_error(open_channel, stream_mux, Mux) if the
+%   multiplexer is closed or the connection is lost.
+
+stream_mux_open_channel(Mux, StreamPair) :-
+    '$stream_mux_open_channel'(Mux, In, Out),
+    stream_pair(StreamPair, In, Out).
+
+%!  stream_mux_accept_channel(+Mux, -StreamPair) is semidet.
+%
+%   Wait for the peer to open a channel.  Fails if Mux is closed,
+%   the peer announced it will not open channels anymore or the
+%   connection is lost.
+
+stream_mux_accept_channel(Mux, StreamPair) :-
+    '$stream_mux_accept_channel'(Mux, In, Out),
+    stream_pair(StreamPair, In, Out).
+
+%!  stream_mux_close(+Mux) is det.
+%
+%   Close the multiplexer.  Channels that are opened by the peer and
+%   not yet accepted are reset.  Channels that are in use remain
+%   functional.  The underlying connection is closed after all
+%   channels are closed.
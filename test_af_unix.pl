@@ -53,7 +53,10 @@ test_af_unix :-
         assertion(Status == exception(stop))
     ;   thread_join(Tid, Status),
         assertion(Status == true)
-    ).
+    ),
+    dgram,
+    dgram_connected,
+    seqpacket.
 
 server(File, Thread) :-
     (   access_file(File, exist)
@@ -113,6 +116,75 @@ ping(Stream, Data) :-
     read_line_to_string(Stream, Reply),
     assertion(Data == Reply).
 
+%!  dgram
+%
+%   Exchange a message  between  two  bound   AF_UNIX  datagram  sockets
+%   using udp_send/4 and udp_receive/4.
+
+dgram :-
+    tmp_file(af_unix_dgram, ServerFile),
+    tmp_file(af_unix_dgram, ClientFile),
+    socket_create(Server, [domain(unix), type(dgram)]),
+    socket_create(Client, [domain(unix), type(dgram)]),
+    tcp_bind(Server, ServerFile),
+    tcp_bind(Client, ClientFile),
+    udp_send(Client, "Hello world", ServerFile, []),
+    udp_receive(Server, Data, From, [as(string)]),
+    assertion(Data == "Hello world"),
+    assertion(From == ClientFile),
+    udp_send(Server, "bye", From, []),
+    udp_receive(Client, Reply, _, [as(atom)]),
+    assertion(Reply == bye),
+    tcp_close_socket(Server),
+    tcp_close_socket(Client),
+    delete_file(ServerFile),
+    delete_file(ClientFile).
+
+%!  dgram_connected
+%
+%   Use udp_send/4 with an unbound To on a connected datagram socket.
+
+dgram_connected :-
+    tmp_file(af_unix_dgram, ServerFile),
+    socket_create(Server, [domain(unix), type(dgram)]),
+    socket_create(Client, [domain(unix), type(dgram)]),
+    tcp_bind(Server, ServerFile),
+    tcp_connect(Client, ServerFile),
+    udp_send(Client, "Hello world", _, []),
+    udp_receive(Server, Data, From, [as(string)]),
+    assertion(Data == "Hello world"),
+    assertion(From == af_unix),
+    tcp_close_socket(Server),
+    tcp_close_socket(Client),
+    delete_file(ServerFile).
+
+%!  seqpacket
+%
+%   Exchange messages over a connected AF_UNIX seqpacket socket.  Each
+%   udp_send/4 must arrive as a single message.
+
+seqpacket :-
+    tmp_file(af_unix_seqpacket, File),
+    socket_create(Listener, [domain(unix), type(seqpacket)]),
+    tcp_bind(Listener, File),
+    tcp_listen(Listener, 5),
+    socket_create(Client, [domain(unix), type(seqpacket)]),
+    tcp_connect(Client, File),
+    tcp_accept(Listener, Server, _Peer),
+    udp_send(Client, "Hello", _, []),
+    udp_send(Client, "world", _, []),
+    udp_receive(Server, Data1, From, [as(string)]),
+    udp_receive(Server, Data2, _, [as(string)]),
+    assertion(Data1-Data2 == "Hello"-"world"),
+    assertion(From == af_unix),
+    udp_send(Server, bye, _, []),
+    udp_receive(Client, Reply, _, [as(atom)]),
+    assertion(Reply == bye),
+    tcp_close_socket(Server),
+    tcp_close_socket(Client),
+    tcp_close_socket(Listener),
+    delete_file(File).
+
 :- else.
 
 test_af_unix.
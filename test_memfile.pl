@@ -73,6 +73,41 @@ test(simple, Atom == Atom2) :-
 test(wide, Atom == Atom2) :-
     atom_codes(Atom, [97,98,1080,1081]),
     wr_atom(Atom, Atom2).
+test(shrink, [ true(A == 'Hello, World'),
+               cleanup(free_memory_file(MF))
+             ]) :-
+    new_memory_file(MF, [capacity(100000)]),
+    setup_call_cleanup(
+        open_memory_file(MF, write, Out),
+        write(Out, 'Hello World'),
+        close(Out)),
+    memory_file_shrink(MF),
+    insert_memory_file(MF, 5, ','),
+    memory_file_shrink(MF),
+    memory_file_to_atom(MF, A).
+test(memfd, [ condition(has_memfd),
+              true(S-E-T == "Hello World"-permission-"Hello World"),
+              cleanup(free_memory_file(MF))
+            ]) :-
+    new_memory_file(MF, [backend(memfd)]),
+    setup_call_cleanup(
+        memory_file_open_fd(MF, write, Out),
+        write(Out, 'Hello World'),
+        close(Out)),
+    memory_file_to_string(MF, S),
+    memory_file_seal(MF),
+    catch(insert_memory_file(MF, 0, x),
+          error(permission_error(_,_,_),_), E = permission),
+    setup_call_cleanup(
+        memory_file_open_fd(MF, read, In),
+        ( stream_property(In, file_no(_)),
+          read_string(In, _, T)
+        ),
+        close(In)).
+
+has_memfd :-
+    catch(new_memory_file(MF, [backend(memfd)]), _, fail),
+    free_memory_file(MF).
 
 :- end_tests(mf_write).
 
@@ -122,6 +157,116 @@ test(insert, cleanup(free_memory_file(MF))) :-
         read(In2, Term2),
         close(In2)),
     assertion(Term2 == hello(world)).
+test(rope, cleanup(free_memory_file(MF))) :-
+    new_memory_file(MF, [backend(rope)]),
+    numlist(1, 2000, L),
+    atomic_list_concat(L, '\n', Text),
+    insert_memory_file(MF, 0, Text),
+    insert_memory_file(MF, 4, 'a\u00e8b\n'),
+    delete_memory_file(MF, 2, 2),
+    memory_file_to_atom(MF, A0),
+    sub_atom(A0, 0, 20, _, Start),
+    assertion(Start == '1\na\u00e8b\n3\n4\n5\n6\n7\n8\n9\n'),
+    size_memory_file(MF, Size),
+    assertion(atom_length(A0, Size)),
+    memory_file_line_position(MF, 5, 0, Offset),
+    assertion(Offset == 10),
+    memory_file_substring(MF, 2, 3, _, Sub),
+    assertion(Sub == "a\u00e8b"),
+    delete_memory_file(MF, 100, 5000),  % spans multiple chunks
+    memory_file_to_atom(MF, A1),
+    sub_atom(A0, 0, 100, _, Prefix),
+    sub_atom(A0, 5100, _, 0, Postfix),
+    assertion(atom_concat(Prefix, Postfix, A1)).
+test(file, cleanup((free_memory_file(MF), delete_file(File)))) :-
+    tmp_file_stream(binary, File, Out),
+    format(Out, 'Hello world!', []),
+    close(Out),
+    file_to_memory_file(File, MF, []),
+    memory_file_to_atom(MF, A0),
+    assertion(A0 == 'Hello world!'),
+    insert_memory_file(MF, 6, 'nice '),
+    memory_file_save(MF, File),
+    read_file_to_codes(File, Codes, []),
+    assertion(Codes == `Hello nice world!`).
+test(read_stream, cleanup(free_memory_file(MF))) :-
+    mf_format(MF, write, 'Hello ', []),
+    atom_to_memory_file('world!', Src),
+    setup_call_cleanup(
+        open_memory_file(Src, read, In, [encoding(octet)]),
+        ( get_char(In, C),
+          memory_file_read_stream(MF, In, 3, Count1),
+          memory_file_read_stream(MF, In, infinite, Count2)
+        ),
+        close(In)),
+    assertion(C-Count1-Count2 == w-3-2),
+    memory_file_to_codes(MF, Codes),
+    assertion(Codes == `Hello orld!`).
+test(read_stream_position, [ true(Pos == 6-3-0),
+                             cleanup(free_memory_file(MF))
+                           ]) :-
+    new_memory_file(MF),
+    setup_call_cleanup(
+        open_string("ab\ncd\n", In),
+        ( memory_file_read_stream(MF, In, infinite, _),
+          character_count(In, C),
+          line_count(In, L),
+          line_position(In, P)
+        ),
+        close(In)),
+    Pos = C-L-P.
+test(snapshot, [ forall(member(Backend, [gap, rope])),
+                 cleanup((free_memory_file(MF), free_memory_file(Snap)))
+               ]) :-
+    new_memory_file(MF, [backend(Backend)]),
+    insert_memory_file(MF, 0, 'Hello world'),
+    memory_file_snapshot(MF, Snap),
+    insert_memory_file(MF, 5, ' nice'),
+    delete_memory_file(MF, 0, 1),
+    memory_file_to_atom(MF, A),
+    assertion(A == 'ello nice world'),
+    setup_call_cleanup(
+        ( open_memory_file(Snap, read, In1),
+          open_memory_file(Snap, read, In2)
+        ),
+        ( get_char(In1, C1),
+          read_string(In2, _, S2),
+          read_string(In1, _, S1)
+        ),
+        ( close(In1),
+          close(In2)
+        )),
+    assertion(C1-S1 == 'H'-"ello world"),
+    assertion(S2 == "Hello world"),
+    catch(insert_memory_file(Snap, 0, x), E, true),
+    assertion(subsumes_term(error(permission_error(_,_,_),_), E)).
+test(tail, [ condition(current_prolog_flag(threads, true)),
+             cleanup(free_memory_file(MF))
+           ]) :-
+    new_memory_file(MF, [append_only(true)]),
+    open_memory_file(MF, append, Out),
+    open_memory_file(MF, read, In),
+    thread_self(Me),
+    thread_create(( read_terms(In, Terms),
+                    close(In),
+                    thread_send_message(Me, terms(Terms))
+                  ), Id, []),
+    forall(between(1, 100, I),
+           ( format(Out, '~q.~n', [t(I)]),
+             flush_output(Out)
+           )),
+    open_memory_file(MF, read, In2),
+    set_stream(In2, timeout(0.1)),
+    read(In2, T1),
+    catch(read_string(In2, _, _), E, true),
+    close(In2),
+    close(Out),
+    thread_get_message(terms(Terms)),
+    thread_join(Id),
+    assertion(T1 == t(1)),
+    assertion(subsumes_term(error(timeout_error(read, _), _), E)),
+    findall(t(I), between(1, 100, I), Expected),
+    assertion(Terms == Expected).
 test(insert, cleanup(free_memory_file(MF))) :-
     new_memory_file(MF),
     insert_memory_file(MF, 0, '0123456789'),
@@ -129,6 +274,70 @@ test(insert, cleanup(free_memory_file(MF))) :-
     assertion(A1 == 7),
     memory_file_substring(MF, 4, 5, A2, S2),
     assertion(A2-S2 == 1-"45678").
+test(copy_to_stream, [ true(S1-S2 == "H\u00e9llo world"-"world"),
+                       cleanup(free_memory_file(MF))
+                     ]) :-
+    new_memory_file(MF),
+    insert_memory_file(MF, 0, 'H\u00e9llo world'),
+    with_output_to(string(S1),
+                   ( current_output(Out1),
+                     memory_file_copy_to_stream(MF, Out1)
+                   )),
+    new_memory_file(MF2),
+    setup_call_cleanup(
+        open_memory_file(MF2, write, Out2),
+        memory_file_copy_to_stream(MF, Out2, 6, 100),
+        close(Out2)),
+    memory_file_to_string(MF2, S2),
+    free_memory_file(MF2).
+test(copy_position, [ true(Counts == [6-3, 20006-3]),
+                      cleanup(free_memory_file(MF))
+                    ]) :-
+    new_memory_file(MF),
+    insert_memory_file(MF, 0, 'ab\ncd\n'),
+    new_memory_file(MF2),
+    setup_call_cleanup(
+        open_memory_file(MF2, write, Out),
+        ( memory_file_copy_to_stream(MF, Out),          % buffered
+          character_count(Out, C1), line_count(Out, L1),
+          length(Codes, 20000), maplist(=(0'x), Codes),
+          atom_codes(Long, Codes),
+          insert_memory_file(MF, 6, Long),
+          memory_file_copy_to_stream(MF, Out, 6, 20000),  % direct write
+          character_count(Out, C2), line_count(Out, L2)
+        ),
+        close(Out)),
+    free_memory_file(MF2),
+    Counts = [C1-L1, C2-L2].
+test(search, [ true(Matches == [0-0, 6-8, 8-10]),
+               forall(member(Backend, [gap, rope])),
+               cleanup(free_memory_file(MF))
+             ]) :-
+    new_memory_file(MF, [backend(Backend)]),
+    insert_memory_file(MF, 0, 'ab \u00e9\u00e9 b'),
+    insert_memory_file(MF, 6, aba),     % gap splits the last match
+    findall(C-B, memory_file_search(MF, ab, C, B), Matches).
+test(hash, [ true(H1-H2 == Expected-Expected),
+             forall(member(Backend, [gap, rope])),
+             cleanup(free_memory_file(MF))
+           ]) :-
+    Expected = ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad,
+    new_memory_file(MF, [backend(Backend)]),
+    insert_memory_file(MF, 0, xxbcxx),
+    insert_memory_file(MF, 2, a),       % gap inside the range
+    memory_file_hash(MF, H1, [algorithm(sha256), offset(2), length(3)]),
+    delete_memory_file(MF, 5, 2),
+    delete_memory_file(MF, 0, 2),
+    memory_file_hash(MF, H2, [algorithm(sha256)]).
+
+read_terms(In, Terms) :-
+    read(In, T0),
+    read_terms(T0, In, Terms).
+
+read_terms(end_of_file, _, []) :- !.
+read_terms(T, In, [T|Ts]) :-
+    read(In, T1),
+    read_terms(T1, In, Ts).
 
 :- end_tests(mf_update).
 
@@ -176,6 +385,20 @@ test(pos) :-
     assertion(CodeSize == 3),       % size in characters
     assertion(Here == 3),
     assertion(Size == 5).
+test(invalid_utf8, [ true(Size == Len),
+                     cleanup(free_memory_file(MF))
+                   ]) :-
+    new_memory_file(MF),
+    setup_call_cleanup(
+        open_memory_file(MF, write, Out, [encoding(octet)]),
+        forall(member(B, [0xe2, 0x82, 0x61, 0x62]), put_byte(Out, B)),
+        close(Out)),
+    size_memory_file(MF, Size, utf8),
+    setup_call_cleanup(
+        open_memory_file(MF, read, In, [encoding(utf8)]),
+        read_string(In, _, String),
+        close(In)),
+    string_length(String, Len).
 test(line, cleanup(free_memory_file(MF))) :-
     mf_format(MF, write, '1-0123456789\n2-0123456789', []),
     memory_file_line_position(MF, 1, 4, Offset1),
@@ -206,6 +429,21 @@ test(end_no_nl, cleanup(free_memory_file(MF))) :-
     assertion(Line:LinePos == 1:3).
 
 
+test(line_index, cleanup(free_memory_file(MF))) :-
+    new_memory_file(MF),
+    setup_call_cleanup(
+        open_memory_file(MF, write, Out),
+        forall(between(1, 50000, I),
+               format(Out, '~|~`0t~d~6+~n', [I])),
+        close(Out)),
+    memory_file_line_position(MF, 40000, 2, Offset),
+    assertion(Offset =:= 39999*7+2),
+    insert_memory_file(MF, 0, '\u00e8\n'),
+    memory_file_line_position(MF, Line, LinePos, Offset),
+    assertion(Line:LinePos == 40001:0),
+    memory_file_substring(MF, Offset, 6, _, Sub),
+    assertion(Sub == "040000").
+
 :- end_tests(mf_position).
 
 :- begin_tests(mf_encoding).
@@ -230,6 +468,21 @@ test(enc2) :-
     size_memory_file(MF, Size, octet),
     phrase(utf8_codes(String), Codes),
     assertion(length(Codes, Size)).
+test(enc3, Codes == Codes2) :-          % Bulk UTF-8 decoding
+    findall(C, ( between(1, 1000, I),
+                 (   I mod 7 =:= 0
+                 ->  member(C, [0x20ac, 0x1f600, 0xe8])
+                 ;   C is 0'a + I mod 26
+                 )
+               ), Codes),
+    new_memory_file(MF),
+    open_memory_file(MF, write, Out, [encoding(utf8)]),
+    format(Out, '~s', [Codes]),
+    close(Out),
+    size_memory_file(MF, Size),
+    memory_file_to_codes(MF, Codes2),
+    free_memory_file(MF),
+    assertion(length(Codes, Size)).
 
 :- end_tests(mf_encoding).
 
@@ -41,6 +41,7 @@
 :- use_module(library(streampool)).
 :- use_module(library(debug)).
 :- use_module(library(plunit)).
+:- use_module(library(unix)).
 
 test_socket :-
     run_tests([udp, tcp, ip_name]).
@@ -63,6 +64,131 @@ tcp_test_run(Test) :-
     client(quit, localhost:Port),
     thread_join(Server).
 
+test(fastopen, Reply == hello) :-
+    tcp_socket(Socket),
+    catch(tcp_setopt(Socket, fastopen(5)),
+          error(domain_error(socket_option, _), _),
+          true),
+    tcp_bind(Socket, localhost:Port),
+    tcp_listen(Socket, 5),
+    thread_create(echo_once(Socket), Server, []),
+    setup_call_cleanup(
+        tcp_connect(localhost:Port, Stream, [fastopen(true)]),
+        ( tcp_send(Stream, hello),
+          read(Stream, Reply)
+        ),
+        close(Stream)),
+    thread_join(Server).
+
+test(idle_timeout, error(socket_error(etimedout, _), _)) :-
+    tcp_socket(Socket),
+    tcp_bind(Socket, localhost:Port),
+    tcp_listen(Socket, 5),
+    thread_create(echo_once(Socket), Server, []),
+    tcp_socket(Client),
+    tcp_setopt(Client, idle_timeout(1)),
+    tcp_connect(Client, localhost:Port),
+    setup_call_cleanup(
+        tcp_open_socket(Client, Stream),
+        read(Stream, _),
+        ( close(Stream, [force(true)]),
+          thread_join(Server)
+        )).
+
+test(idle_listener, Reply == hello) :-
+    tcp_socket(Socket),
+    tcp_setopt(Socket, idle_timeout(1)),
+    tcp_bind(Socket, localhost:Port),
+    tcp_listen(Socket, 5),
+    sleep(2),                           % the listener must not be reaped
+    thread_create(echo_once(Socket), Server, []),
+    setup_call_cleanup(
+        tcp_connect(localhost:Port, Stream, []),
+        ( tcp_send(Stream, hello),
+          read(Stream, Reply)
+        ),
+        close(Stream)),
+    thread_join(Server).
+
+test(stale_handle, error(existence_error(socket, Socket), _)) :-
+    tcp_socket(Socket),
+    tcp_close_socket(Socket),
+    tcp_socket(Socket2),                % Socket is alive: no recycling
+    call_cleanup(tcp_setopt(Socket, reuseaddr),
+                 tcp_close_socket(Socket2)).
+
+test(close_accept, true(subsumes_term(error(_,_), E))) :-
+    tcp_socket(Socket),
+    tcp_bind(Socket, localhost:_),
+    tcp_listen(Socket, 5),
+    thread_create(tcp_accept(Socket, _, _), Acceptor, []),
+    sleep(0.2),                         % Acceptor is blocked in accept()
+    tcp_close_socket(Socket),
+    findall(S, (between(1, 10, _), tcp_socket(S)), Sockets),
+    call_cleanup(thread_join(Acceptor, exception(E)),
+                 maplist(tcp_close_socket, Sockets)).
+
+test(from_fd, [ condition(exists_directory('/proc/self/fd')),
+                Reply == hello
+              ]) :-
+    tcp_socket(Socket0),
+    tcp_bind(Socket0, localhost:Port),
+    tcp_listen(Socket0, 5),
+    tcp_getopt(Socket0, file_no(Fd0)),
+    free_fd(Fd),
+    dup(Fd0, Fd),
+    tcp_close_socket(Socket0),          % must not affect the duplicate
+    tcp_socket_from_fd(Fd, Socket),
+    catch(tcp_socket_from_fd(Fd, _), E, true),
+    assertion(subsumes_term(error(permission_error(adopt, socket, Fd), _), E)),
+    thread_create(echo_once(Socket), Server, []),
+    setup_call_cleanup(
+        tcp_connect(localhost:Port, Stream, []),
+        ( tcp_send(Stream, hello),
+          read(Stream, Reply)
+        ),
+        close(Stream)),
+    thread_join(Server).
+
+test(inherited_other_pid, Sockets == []) :-
+    current_prolog_flag(pid, Me),
+    Other is Me+1,
+    retractall(socket:inherited_sockets_done),
+    setenv('LISTEN_PID', Other),
+    setenv('LISTEN_FDS', 1),
+    call_cleanup(tcp_inherited_sockets(Sockets),
+                 ( unsetenv('LISTEN_PID'),
+                   unsetenv('LISTEN_FDS')
+                 )).
+
+test(backlog, Backlog == 5) :-
+    tcp_socket(Socket),
+    call_cleanup(
+        ( tcp_bind(Socket, localhost:_),
+          tcp_listen(Socket, 5),
+          tcp_getopt(Socket, backlog(Backlog))
+        ),
+        tcp_close_socket(Socket)).
+
+%   free_fd(-Fd)
+%
+%   Find a file descriptor that is not open, so dup/2 does not close
+%   a descriptor that is in use.
+
+free_fd(Fd) :-
+    between(64, 1000, Fd),
+    format(atom(Path), '/proc/self/fd/~d', [Fd]),
+    \+ catch(read_link(Path, _, _), _, fail),
+    !.
+
+echo_once(Socket) :-
+    tcp_accept(Socket, Slave, _Peer),
+    tcp_open_socket(Slave, Stream),
+    read(Stream, Term),
+    tcp_send(Stream, Term),
+    close(Stream),
+    tcp_close_socket(Socket).
+
 :- end_tests(tcp).
 
                  /*******************************
@@ -236,6 +362,34 @@ udp_ping(S, Port, Msg) :-
 
 test(udp) :-
     run_udp.
+test(timestamp) :-
+    udp_socket(S),
+    call_cleanup(
+        ( tcp_bind(S, '127.0.0.1':Port),
+          get_time(T0),
+          udp_send(S, hello, '127.0.0.1':Port, []),
+          udp_receive(S, Data, _From, [as(atom), timestamp(T)]),
+          get_time(T1)
+        ),
+        tcp_close_socket(S)),
+    assertion(Data == hello),
+    assertion(float(T)),
+    assertion(T >= T0-0.01),
+    assertion(T =< T1+0.01).
+test(idle_timeout, Data == hello) :-
+    udp_socket(S),
+    call_cleanup(
+        ( tcp_setopt(S, idle_timeout(1)),
+          tcp_bind(S, '127.0.0.1':Port),
+          forall(between(1, 4, _),      % busy for 2 seconds
+                 ( udp_send(S, ping, '127.0.0.1':Port, []),
+                   udp_receive(S, _, _, [as(atom)]),
+                   sleep(0.5)
+                 )),
+          udp_send(S, hello, '127.0.0.1':Port, []),
+          udp_receive(S, Data, _From, [as(atom)])
+        ),
+        tcp_close_socket(S)).
 
 :- end_tests(udp).
 
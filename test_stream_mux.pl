@@ -0,0 +1,126 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+:- module(test_stream_mux,
+          [ test_stream_mux/0
+          ]).
+:- use_module(library(plunit)).
+:- use_module(library(socket)).
+:- use_module(library(stream_mux)).
+:- use_module(library(lists)).
+:- use_module(library(apply)).
+
+test_stream_mux :-
+    run_tests([stream_mux]).
+
+:- begin_tests(stream_mux).
+
+test(channels, Replies == Terms) :-
+    numlist(1, 10, Terms),
+    with_mux(Mux,
+             ( maplist(ask(Mux), Terms, Ids),
+               maplist(thread_join_reply, Ids, Replies)
+             )).
+test(large, Len == 1000000) :-
+    with_mux(Mux,
+             setup_call_cleanup(
+                 stream_mux_open_channel(Mux, Pair),
+                 ( stream_pair(Pair, In, Out),
+                   set_stream(In, type(binary)),
+                   set_stream(Out, type(binary)),
+                   thread_create(send_bytes(Out, 1000000), Sender, []),
+                   read_stream_to_codes(In, Codes),
+                   thread_join(Sender),
+                   length(Codes, Len)
+                 ),
+                 close(Pair))).
+
+:- end_tests(stream_mux).
+
+ask(Mux, Term, Id) :-
+    thread_create(ask(Mux, Term), Id, []).
+
+ask(Mux, Term) :-
+    setup_call_cleanup(
+        stream_mux_open_channel(Mux, Pair),
+        ( stream_pair(Pair, In, Out),
+          format(Out, '~q.~n', [Term]),
+          close(Out),
+          read(In, Reply)
+        ),
+        close(Pair)),
+    thread_exit(Reply).
+
+thread_join_reply(Id, Reply) :-
+    thread_join(Id, exited(Reply)).
+
+send_bytes(Out, Count) :-
+    forall(between(1, Count, I),
+           put_byte(Out, I /\ 0xff)),
+    close(Out).
+
+%!  with_mux(-Mux, :Goal)
+%
+%   Run Goal with Mux connected over TCP to an echo server that
+%   handles each channel in a separate thread.
+
+with_mux(Mux, Goal) :-
+    tcp_socket(Socket),
+    tcp_bind(Socket, localhost:Port),
+    tcp_listen(Socket, 5),
+    thread_create(mux_server(Socket), Server, []),
+    tcp_connect(localhost:Port, Pair, []),
+    stream_mux_open(Pair, Mux, [role(client)]),
+    call_cleanup(Goal,
+                 ( stream_mux_close(Mux),
+                   thread_join(Server)
+                 )).
+
+mux_server(Socket) :-
+    tcp_accept(Socket, Client, _Peer),
+    tcp_close_socket(Socket),
+    tcp_open_socket(Client, Pair),
+    stream_mux_open(Pair, Mux, [role(server)]),
+    findall(Id,
+            ( stream_mux_accept_channel(Mux, Channel),
+              thread_create(echo(Channel), Id, [])
+            ),
+            Ids),
+    maplist(thread_join, Ids),
+    stream_mux_close(Mux).
+
+echo(Pair) :-
+    stream_pair(Pair, In, Out),
+    call_cleanup(copy_stream_data(In, Out),
+                 close(Pair)).
@@ -0,0 +1,90 @@
+/*  Part of SWI-Prolog
+
+    Author:        SWI-Prolog contributors
+    WWW:           http://www.swi-prolog.org
+    Copyright (c)  2026, SWI-Prolog contributors
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in
+       the documentation and/or other materials provided with the
+       distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+    "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+    LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+    FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+    COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+    BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+    CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+    ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+*/
+
+:- module(test_udp_broadcast,
+          [ test_udp_broadcast/0
+          ]).
+:- use_module(library(plunit)).
+:- use_module(library(socket)).
+:- use_module(library(broadcast)).
+:- use_module(library(aggregate)).
+:- use_module(library(udp_broadcast)).
+
+test_udp_broadcast :-
+    run_tests([ udp_broadcast
+              ]).
+
+:- begin_tests(udp_broadcast).
+
+test(peer_index, true(Indexed == [1, 1, 0])) :-
+    Scope = test_peer_index,
+    IP = ip(10, 0, 0, 1),
+    udp_peer_add(Scope, IP:1000),
+    peer_index_count(Scope, IP, I1),
+    udp_peer_add(Scope, IP:1001),       % same IP, different port
+    peer_index_count(Scope, IP, I2),
+    udp_peer_del(Scope, IP:1000),
+    assertion(udp_broadcast:in_scope(unicast(1001), Scope, IP:4242)),
+    udp_peer_del(Scope, IP:1001),
+    peer_index_count(Scope, IP, I3),
+    assertion(\+ udp_broadcast:in_scope(unicast(1001), Scope, IP:4242)),
+    Indexed = [I1, I2, I3].
+test(dispatch_pool, [ true(Xs == [1, 2, 3]),
+                      cleanup(( unlisten(test_udp_broadcast),
+                                udp_broadcast_close(test_pool)
+                              ))
+                    ]) :-
+    free_udp_port(Port),
+    udp_broadcast_initialize(ip(127, 0, 0, 1),
+                             [ method(unicast),
+                               scope(test_pool),
+                               port(Port),
+                               dispatch_threads(2)
+                             ]),
+    aggregate_all(count, udp_broadcast:udp_dispatcher(_), Threads),
+    assertion(Threads == 2),
+    udp_peer_add(test_pool, ip(127, 0, 0, 1)),  % talk to ourselves
+    listen(test_udp_broadcast, ping(Y), between(1, 3, Y)),
+    findall(X, broadcast_request(udp(test_pool, ping(X), 1)), Xs0),
+    msort(Xs0, Xs).
+
+:- end_tests(udp_broadcast).
+
+peer_index_count(Scope, IP, Count) :-
+    term_hash(IP, Hash),
+    aggregate_all(count, udp_broadcast:udp_peer_index(Hash, Scope, IP), Count).
+
+free_udp_port(Port) :-
+    udp_socket(S),
+    tcp_bind(S, '127.0.0.1':Port),
+    tcp_close_socket(S).
@@ -98,6 +98,21 @@ test(resolve, URI == 'http://a/b/g')         :- resolve('../g', URI).
 test(resolve, URI == 'http://a/')            :- resolve('../..', URI).
 test(resolve, URI == 'http://a/')            :- resolve('../../', URI).
 test(resolve, URI == 'http://a/g')           :- resolve('../../g', URI).
+test(resolve_memo, [ true(URIs == ['http://a/b/c/g', 'http://x/g']),
+                     cleanup(uri_resolve_memo(false))
+                   ]) :-
+    uri_resolve_memo(true),
+    uri_resolve_cache_statistics(S0),
+    findall(URI,
+            ( member(Base, ['http://a/b/c/d;p?q', 'http://x/']),
+              between(1, 3, _),
+              uri_resolve(g, Base, URI)
+            ), All),
+    sort(All, URIs),
+    uri_resolve_cache_statistics(S1),
+    memberchk(memo_hits(H0), S0),
+    memberchk(memo_hits(H1), S1),
+    assertion(H1-H0 >= 4).
 
 :- end_tests(uri).
 
@@ -107,6 +122,10 @@ test(normalise_uri, NormalURI == 'example://a/b/c/%7Bfoo%7D') :-
     uri_normalized('eXAMPLE://a/./b/../b/%63/%7bfoo%7d', NormalURI).
 test(normalise_iri, NormalIRI == 'example://a/b/c/%7Bfoo%7D') :-
     uri_normalized_iri('eXAMPLE://a/./b/../b/%63/%7bfoo%7d', NormalIRI).
+test(normalise_long, NormalURI == 'http://a.b/abcdefghijklmnopqrstuvwxyz/\
+0123456789/%7Bx%7D/ABCDEFGHIJKLMNOP%20z') :-
+    uri_normalized('http://a.b/abcdefghijklmnopqrstuvwxyz/\
+0123456789/%7bx%7d/ABCDEFGHIJKLMNOP%20z', NormalURI).
 test(normalise_iri, NormalIRI == 'http://a.b/a%3F?x') :-        % 3F = '?'
     uri_normalized_iri('http://a.b/a%3f?x', NormalIRI).
 test(normalise_iri, NormalIRI == 'http://a.b/a?x=1&y=2') :-
@@ -41,6 +41,7 @@
             udp_peer_del/2,                     % +Scope, ?IP
             udp_peer/2                          % +Scope, -IP
           ]).
+:- autoload(library(aggregate),[aggregate_all/3]).
 :- autoload(library(apply),[maplist/2,maplist/3]).
 :- autoload(library(backcomp),[thread_at_exit/1]).
 :- autoload(library(broadcast),
@@ -48,7 +49,7 @@
 :- use_module(library(debug),[debug/3]).
 :- autoload(library(error),
 	    [must_be/2,syntax_error/1,domain_error/2,existence_error/2]).
-:- autoload(library(option),[option/3]).
+:- autoload(library(option),[option/2,option/3]).
 :- autoload(library(socket),
 	    [ tcp_close_socket/1,
 	      udp_socket/1,
@@ -178,10 +179,14 @@ Host A Process 2:
    Xs = [1, 2, 3, 4, 5].
 ==
 
-All incomming trafic is handled  by  a   single  thread  with  the alias
-`udp_inbound_proxy`. This thread also performs  the internal dispatching
-using broadcast/1 and broadcast_request/1. Future   versions may provide
-for handling these requests in separate threads.
+All incomming trafic is received by a single thread with the alias
+`udp_inbound_proxy`. By default, this  thread   also  performs  the
+internal dispatching using broadcast/1 and broadcast_request/1. Using
+the option dispatch_threads(Count) of udp_broadcast_initialize/2, the
+received datagrams are handed to a pool  of   threads  that  does the
+deserialization, scope check and dispatching,   such that a slow
+listener does not stall the node.  There is a single pool for the
+process that serves all scopes.
 
 
 ## Caveats {#udp-broadcase-caveats}
@@ -320,10 +325,12 @@ udp_broadcast_address(IPAddress, Subnet, BroadcastAddress) :-
 
 :- dynamic
     udp_scope/2,
-    udp_scope_peer/2.
+    udp_scope_peer/2,
+    udp_peer_index/3.                           % Hash, Scope, IP
 :- volatile
     udp_scope/2,
-    udp_scope_peer/2.
+    udp_scope_peer/2,
+    udp_peer_index/3.
 %
 %  Here's a UDP proxy to Prolog's broadcast library
 %
@@ -350,7 +357,10 @@ udp_broadcast_address(IPAddress, Subnet, BroadcastAddress) :-
 :- dynamic
     udp_private_socket/3,                       % Port, Socket, FileNo
     udp_public_socket/4,                        % Scope, Port, Socket, FileNo
-    udp_closed/1.				% Scope
+    udp_closed/1,				% Scope
+    udp_dispatch_threads/1,                     % Count (process-wide)
+    udp_dispatch_queue/1,                       % Queue
+    udp_dispatcher/1.                           % ThreadId
 
 udp_inbound_proxy(Master) :-
     thread_at_exit(inbound_proxy_died),
@@ -452,6 +462,9 @@ udp_socket_file_no(FileNo) :-
 %   internal broadcast service. For an  incomming broadcast _request_ we
 %   send the reply only to the  requester   and  therefore we must use a
 %   socket that is not in broadcast mode.
+%
+%   If a dispatcher pool is running, the  received datagrams are queued
+%   for the pool and this thread only reads the sockets.
 
 dispatch_inbound(FileNos) :-
     debug(udp(broadcast), 'Waiting for ~p', [FileNos]),
@@ -465,18 +478,45 @@ dispatch_ready(FileNo) :-
     !,
     udp_receive(Private, Data, From, [max_message_size(65535)]),
     debug(udp(broadcast), 'Inbound on private port', []),
-    (   in_scope(Scope, From),
-        udp_term_string(Scope, Term, Data) % only accept valid data
-    ->  ld_dispatch(Private, Term, From, Scope)
-    ;   true
-    ).
+    dispatch_datagram(datagram(private, Data, From)).
 dispatch_ready(FileNo) :-
     udp_public_socket(Scope, _PublicPort, Public, FileNo),
     !,
     udp_receive(Public, Data, From, [max_message_size(65535)]),
     debug(udp(broadcast), 'Inbound on public port from ~p for scope ~p',
           [From, Scope]),
-    (   in_scope(Scope, From),
+    dispatch_datagram(datagram(public(Scope), Data, From)).
+
+%!  dispatch_datagram(+Datagram) is det.
+%
+%   Hand a received datagram to the  dispatcher pool or, if there is no
+%   pool, process it in the calling thread.
+
+dispatch_datagram(Datagram) :-
+    udp_dispatch_threads(Count),
+    Count > 0,
+    udp_dispatch_queue(Queue),
+    !,
+    thread_send_message(Queue, Datagram).
+dispatch_datagram(Datagram) :-
+    handle_datagram(Datagram).
+
+%!  handle_datagram(+Datagram) is det.
+%
+%   Deserialize, scope-check and dispatch  a   datagram  received on our
+%   private port or the public port of a scope.
+
+handle_datagram(datagram(private, Data, From)) :-
+    !,
+    (   udp_private_socket(_Port, Private, _FileNo),
+        in_scope(Scope, From),
+        udp_term_string(Scope, Term, Data) % only accept valid data
+    ->  ld_dispatch(Private, Term, From, Scope)
+    ;   true
+    ).
+handle_datagram(datagram(public(Scope), Data, From)) :-
+    (   udp_public_socket(Scope, _PublicPort, Public, _FileNo),
+        in_scope(Scope, From),
         udp_term_string(Scope, Term, Data) % only accept valid data
     ->  (   udp_scope(Scope, unicast(_))
         ->  ld_dispatch(Public, Term, From, Scope)
@@ -503,7 +543,9 @@ in_scope(broadcast(Subnet, Broadcast, _PublicPort), _Scope, IP:_FromPort) :-
     udp_broadcast_address(IP, Subnet, Broadcast).
 in_scope(multicast(_Group, _Port), _Scope, _From).
 in_scope(unicast(_PublicPort), Scope, IP:_) :-
-    udp_peer(Scope, IP:_).
+    term_hash(IP, Hash),
+    udp_peer_index(Hash, Scope, IP),
+    !.
 
 
 %!  ld_dispatch(+PrivateSocket, +Term, +From, +Scope)
@@ -551,6 +593,7 @@ blacklisted(reply(_,Term))   :- black_list(Term).
 
 reload_udp_proxy :-
     reload_outbound_proxy,
+    reload_dispatchers,
     reload_inbound_proxy.
 
 reload_outbound_proxy :-
@@ -604,6 +647,66 @@ done_status_message_level(exception(unwind(abort)), silent) :- !.
 done_status_message_level(_, informational).
 
 
+%!  reload_dispatchers
+%
+%   Grow or shrink the pool  of   dispatcher  threads  to the requested
+%   udp_dispatch_threads/1. Threads are stopped by  sending them `stop`,
+%   which they find after processing the datagrams queued before it.
+%
+%   The queue is bounded, such that  under overload the inbound proxy
+%   blocks and the kernel drops datagrams rather than us growing the
+%   queue without limit.
+
+reload_dispatchers :-
+    with_mutex(udp_broadcast, reload_dispatchers_sync).
+
+reload_dispatchers_sync :-
+    (   udp_dispatch_threads(Count)
+    ->  true
+    ;   Count = 0
+    ),
+    aggregate_all(count, udp_dispatcher(_), Running),
+    (   Running < Count
+    ->  dispatch_queue(Queue),
+        Add is Count-Running,
+        forall(between(1, Add, _),
+               create_dispatcher(Queue))
+    ;   Running > Count
+    ->  dispatch_queue(Queue),
+        Stop is Running-Count,
+        forall(between(1, Stop, _),
+               thread_send_message(Queue, stop))
+    ;   true
+    ).
+
+dispatch_queue(Queue) :-
+    udp_dispatch_queue(Queue),
+    !.
+dispatch_queue(Queue) :-
+    message_queue_create(Queue, [max_size(1000)]),
+    assertz(udp_dispatch_queue(Queue)).
+
+create_dispatcher(Queue) :-
+    thread_create(udp_dispatcher_loop(Queue), Id,
+                  [ detached(true)
+                  ]),
+    assertz(udp_dispatcher(Id)).
+
+udp_dispatcher_loop(Queue) :-
+    thread_self(Me),
+    thread_at_exit(retractall(udp_dispatcher(Me))),
+    dispatch_queued(Queue).
+
+dispatch_queued(Queue) :-
+    thread_get_message(Queue, Datagram),
+    (   Datagram == stop
+    ->  true
+    ;   catch(ignore(handle_datagram(Datagram)),
+              E, dispatch_exception(E)),
+        dispatch_queued(Queue)
+    ).
+
+
 %!  udp_broadcast_close(+Scope)
 %
 %   Close a UDP broadcast scope.
@@ -743,6 +846,15 @@ udp_br_collect_replies(Queue, Timeout, Reply) :-
 %       provided the intermediate routers understand multicast.
 %       - unicast
 %       Send the messages individually to all registered peers.
+%     - dispatch_threads(+Count)
+%     Number of threads that deserialize and dispatch incomming
+%     messages.  Default is 0, which dispatches in the thread that
+%     receives the messages.  Using multiple threads, a slow
+%     broadcast_request/1 handler does not delay other messages.
+%     This is a process-wide setting rather than a property of the
+%     scope: a single pool serves all scopes and its size is the
+%     value of the last udp_broadcast_initialize/2 call that
+%     specifies this option.
 %
 %   For compatibility reasons Options may be the subnet mask.
 
@@ -760,6 +872,12 @@ udp_broadcast_initialize_sync(IP, Options) :-
     option(method(Method), Options, broadcast),
     must_be(oneof([broadcast, multicast, unicast]), Method),
     udp_broadcast_initialize_sync(Method, IPAddress, Options),
+    (   option(dispatch_threads(Count), Options)
+    ->  must_be(nonneg, Count),
+        retractall(udp_dispatch_threads(_)),
+        assertz(udp_dispatch_threads(Count))
+    ;   true
+    ),
     reload_udp_proxy.
 
 udp_broadcast_initialize_sync(broadcast, IPAddress, Options) :-
@@ -836,6 +954,11 @@ multicast_address(IP) :-
 %   Address is either a term  IP:Port  or   a  plain  IP address. In the
 %   latter case the default port registered with the scope is used.
 %
+%   Besides udp_scope_peer/2, the IP addresses   of the peers are kept in
+%   udp_peer_index/3, indexed on the term_hash/2  of the IP, such that
+%   checking whether an incomming message  is   in  scope does not scan
+%   the peer list.
+%
 %   @arg Address has canonical form ip(A,B,C,D):Port.
 
 udp_peer_add(Scope, Address) :-
@@ -843,12 +966,22 @@ udp_peer_add(Scope, Address) :-
     peer_address(Address, Scope, Canonical),
     (   udp_scope_peer(Scope, Canonical)
     ->  true
-    ;   assertz(udp_scope_peer(Scope, Canonical))
+    ;   assertz(udp_scope_peer(Scope, Canonical)),
+        Canonical = IP:_,
+        term_hash(IP, Hash),
+        (   udp_peer_index(Hash, Scope, IP)
+        ->  true
+        ;   assertz(udp_peer_index(Hash, Scope, IP))
+        )
     ).
 
 udp_peer_del(Scope, Address) :-
     peer_address(Address, Scope, Canonical),
-    retractall(udp_scope_peer(Scope, Canonical)).
+    retractall(udp_scope_peer(Scope, Canonical)),
+    forall(( udp_peer_index(Hash, Scope, IP),
+             \+ udp_scope_peer(Scope, IP:_)
+           ),
+           retractall(udp_peer_index(Hash, Scope, IP))).
 
 udp_peer(Scope, IPAddress) :-
     udp_scope_peer(Scope, IPAddress).
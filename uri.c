@@ -44,6 +44,7 @@
 #include <stdio.h>
 #include <wchar.h>
 #include <wctype.h>
+#include <stdint.h>
 #include <assert.h>
 #include "utf8.h"
 
@@ -107,6 +108,8 @@ static functor_t FUNCTOR_uri_authority4;
 static int  charflags[128] = {0};
 static bool flags_done = 0;
 
+static void add_char_class(int flags);
+
 static void
 set_flags(const char *from, int flag)
 { for(; *from; from++)
@@ -138,6 +141,16 @@ fill_flags(void)
 
     set_flags("/:?#&=", CH_URL);
 
+    add_char_class(ESC_PATH);
+    add_char_class(ESC_SEGMENT);
+    add_char_class(ESC_QUERY);
+    add_char_class(ESC_QVALUE);
+    add_char_class(ESC_FRAGMENT);
+    add_char_class(ESC_QNAME);
+    add_char_class(ESC_SCHEME);
+    add_char_class(ESC_PORT);
+    add_char_class(ESC_HOST);
+
     flags_done = true;
   }
 }
@@ -148,6 +161,299 @@ fill_flags(void)
 	(((c) >= 128) || (c) == '%' || (charflags[(int)c] & (f)))
 
 
+		 /*******************************
+		 *	 VECTORIZED SCANNING	*
+		 *******************************/
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Most URIs need no escaping or unescaping.  Instead of classifying the
+characters one by one we find the first character that needs attention
+and copy the clean prefix as a block.
+
+A char_class represents the characters that need no escape for a flags
+combination as a 128-bit map of the ASCII characters.  Characters >= 128
+are clean in IRI mode only.  The maps for the ESC_* combinations are
+computed by fill_flags().
+
+The SSE2 kernels are part of the x86-64 baseline and skip alphanumerical
+runs, four characters at a time.  The AVX2 kernels look up eight
+characters at a time in the map and are selected by init_scanners() if
+the CPU supports them.  Other platforms use the portable C kernels.
+These kernels assume 32-bit wide characters.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    (defined(__GNUC__) || defined(__clang__)) && WCHAR_MAX > 0xffff
+#define O_SSE2 1
+#include <emmintrin.h>
+#if defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define O_AVX2 1
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef struct char_class
+{ int		flags;			/* ESC_* flags */
+  bool		alnum;			/* All alphanumerical chars are clean */
+  uint32_t	map[4];			/* Clean ASCII characters */
+  uint32_t	iri_map[4];		/* Same, for IRIs (adds %) */
+} char_class;
+
+#define MAX_CHAR_CLASSES 16
+
+static char_class char_classes[MAX_CHAR_CLASSES];
+static int	  char_class_count = 0;
+
+#define in_map(map, c) ((map)[(c)>>5] & ((uint32_t)1<<((c)&31)))
+
+static void
+init_char_class(char_class *cc, int flags)
+{ int c;
+
+  memset(cc, 0, sizeof(*cc));
+  cc->flags = flags;
+  for(c=0; c<128; c++)
+  { if ( charflags[c] & flags )
+    { cc->map[c>>5]     |= (uint32_t)1<<(c&31);
+      cc->iri_map[c>>5] |= (uint32_t)1<<(c&31);
+    }
+  }
+  cc->iri_map['%'>>5] |= (uint32_t)1<<('%'&31);
+  cc->alnum = (flags&(CH_ALPHA|CH_DIGIT)) == (CH_ALPHA|CH_DIGIT);
+}
+
+
+static void
+add_char_class(int flags)
+{ int i;
+
+  for(i=0; i<char_class_count; i++)
+  { if ( char_classes[i].flags == flags )
+      return;
+  }
+  assert(char_class_count < MAX_CHAR_CLASSES);
+  init_char_class(&char_classes[char_class_count++], flags);
+}
+
+
+/* Find the char_class for flags.  Flags for which no class was created
+   by fill_flags() are computed in tmp.
+*/
+
+static const char_class *
+get_char_class(int flags, char_class *tmp)
+{ int i;
+
+  for(i=0; i<char_class_count; i++)
+  { if ( char_classes[i].flags == flags )
+      return &char_classes[i];
+  }
+
+  init_char_class(tmp, flags);
+  return tmp;
+}
+
+
+typedef struct scanners
+{ const pl_wchar_t *(*find2)(const pl_wchar_t *s, const pl_wchar_t *e,
+			     int c1, int c2);
+  const pl_wchar_t *(*clean)(const pl_wchar_t *s, const pl_wchar_t *e,
+			     const uint32_t *map, bool high, bool alnum);
+} scanners;
+
+
+static inline bool
+is_clean(int c, const uint32_t *map, bool high)
+{ return c < 128 ? in_map(map, c) != 0 : high;
+}
+
+
+static const pl_wchar_t *
+find2_c(const pl_wchar_t *s, const pl_wchar_t *e, int c1, int c2)
+{ for(; s<e; s++)
+  { if ( s[0] == c1 || s[0] == c2 )
+      return s;
+  }
+
+  return e;
+}
+
+
+static const pl_wchar_t *
+clean_c(const pl_wchar_t *s, const pl_wchar_t *e,
+	const uint32_t *map, bool high, bool alnum)
+{ for(; s<e; s++)
+  { if ( !is_clean(s[0], map, high) )
+      return s;
+  }
+
+  return e;
+}
+
+
+#ifdef O_SSE2
+
+static const pl_wchar_t *
+find2_sse2(const pl_wchar_t *s, const pl_wchar_t *e, int c1, int c2)
+{ const __m128i v1 = _mm_set1_epi32(c1);
+  const __m128i v2 = _mm_set1_epi32(c2);
+
+  for(; e-s >= 4; s += 4)
+  { __m128i v = _mm_loadu_si128((const __m128i*)s);
+    int m = _mm_movemask_ps(_mm_castsi128_ps(
+			      _mm_or_si128(_mm_cmpeq_epi32(v, v1),
+					   _mm_cmpeq_epi32(v, v2))));
+
+    if ( m )
+      return s + __builtin_ctz(m);
+  }
+
+  return find2_c(s, e, c1, c2);
+}
+
+
+static const pl_wchar_t *
+clean_sse2(const pl_wchar_t *s, const pl_wchar_t *e,
+	   const uint32_t *map, bool high, bool alnum)
+{ if ( alnum )
+  { const __m128i a = _mm_set1_epi32('a'-1), z = _mm_set1_epi32('z'+1);
+    const __m128i d0 = _mm_set1_epi32('0'-1), d9 = _mm_set1_epi32('9'+1);
+    const __m128i lwr = _mm_set1_epi32(0x20);
+
+    while( e-s >= 4 )
+    { __m128i v = _mm_loadu_si128((const __m128i*)s);
+      __m128i l = _mm_or_si128(v, lwr);
+      __m128i ok = _mm_or_si128(
+		     _mm_and_si128(_mm_cmpgt_epi32(l, a), _mm_cmpgt_epi32(z, l)),
+		     _mm_and_si128(_mm_cmpgt_epi32(v, d0), _mm_cmpgt_epi32(d9, v)));
+
+      if ( _mm_movemask_ps(_mm_castsi128_ps(ok)) != 0xf )
+      { int i;
+
+	for(i=0; i<4; i++)
+	{ if ( !is_clean(s[i], map, high) )
+	    return s+i;
+	}
+      }
+      s += 4;
+    }
+  }
+
+  return clean_c(s, e, map, high, alnum);
+}
+
+#endif /*O_SSE2*/
+
+
+#ifdef O_AVX2
+
+static AVX2 const pl_wchar_t *
+find2_avx2(const pl_wchar_t *s, const pl_wchar_t *e, int c1, int c2)
+{ const __m256i v1 = _mm256_set1_epi32(c1);
+  const __m256i v2 = _mm256_set1_epi32(c2);
+
+  for(; e-s >= 8; s += 8)
+  { __m256i v = _mm256_loadu_si256((const __m256i*)s);
+    int m = _mm256_movemask_ps(_mm256_castsi256_ps(
+				 _mm256_or_si256(_mm256_cmpeq_epi32(v, v1),
+						 _mm256_cmpeq_epi32(v, v2))));
+
+    if ( m )
+      return s + __builtin_ctz(m);
+  }
+
+  return find2_c(s, e, c1, c2);
+}
+
+
+/* Look up 8 characters in the 128-bit map: the word is selected using
+   c>>5 and the bit using a variable shift by c&31.
+*/
+
+static AVX2 const pl_wchar_t *
+clean_avx2(const pl_wchar_t *s, const pl_wchar_t *e,
+	   const uint32_t *map, bool high, bool alnum)
+{ const __m256i table = _mm256_setr_epi32(map[0], map[1], map[2], map[3],
+					  map[0], map[1], map[2], map[3]);
+  const __m256i k128 = _mm256_set1_epi32(128);
+  const __m256i k31  = _mm256_set1_epi32(31);
+  const __m256i one  = _mm256_set1_epi32(1);
+  const __m256i hv   = _mm256_set1_epi32(high ? -1 : 0);
+
+  for(; e-s >= 8; s += 8)
+  { __m256i v = _mm256_loadu_si256((const __m256i*)s);
+    __m256i ascii = _mm256_cmpgt_epi32(k128, v);
+    __m256i word = _mm256_permutevar8x32_epi32(table, _mm256_srli_epi32(v, 5));
+    __m256i bit = _mm256_and_si256(
+		    _mm256_srlv_epi32(word, _mm256_and_si256(v, k31)), one);
+    __m256i ok = _mm256_or_si256(
+		   _mm256_and_si256(ascii, _mm256_cmpeq_epi32(bit, one)),
+		   _mm256_andnot_si256(ascii, hv));
+    int m = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+
+    if ( m != 0xff )
+      return s + __builtin_ctz(~m);
+  }
+
+  return clean_c(s, e, map, high, alnum);
+}
+
+#endif /*O_AVX2*/
+
+
+#ifdef O_SSE2
+static scanners scan = { find2_sse2, clean_sse2 };
+#else
+static scanners scan = { find2_c, clean_c };
+#endif
+
+/* Select the best kernels for the running CPU.  Called when loading
+   the library.
+*/
+
+static void
+init_scanners(void)
+{
+#ifdef O_AVX2
+  static const scanners avx2 = { find2_avx2, clean_avx2 };
+
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports("avx2") )
+    scan = avx2;
+#endif
+}
+
+
+/* First character in [s,e) that is % or, if plus is true, + */
+
+static inline const pl_wchar_t *
+find_escape(const pl_wchar_t *s, const pl_wchar_t *e, bool plus)
+{ return (*scan.find2)(s, e, '%', plus ? '+' : '%');
+}
+
+
+/* First character in [s,e) that must be escaped according to cc.  In
+   IRI mode, characters >= 128 and % are not escaped.
+*/
+
+static inline const pl_wchar_t *
+clean_prefix(const pl_wchar_t *s, const pl_wchar_t *e,
+	     const char_class *cc, bool iri)
+{ return (*scan.clean)(s, e, iri ? cc->iri_map : cc->map, iri, cc->alnum);
+}
+
+/* First character in [s,e) that is not copied verbatim when normalizing
+   the %-encoding.  This is clean_prefix(), but also stops at %.
+*/
+
+static inline const pl_wchar_t *
+verbatim_prefix(const pl_wchar_t *s, const pl_wchar_t *e,
+		const char_class *cc, bool iri)
+{ return (*scan.clean)(s, e, cc->map, iri, cc->alnum);
+}
+
+
 /* hex(const pl_wchar_t *in, int digits, int *value)
 
    Get <digits> characters from in and interpret them as a hexadecimal
@@ -289,24 +595,31 @@ init_charbuf_at_size(charbuf *cb, size_t size)
 }
 
 
-static bool
-add_charbuf(charbuf *cb, int c)
-{ if ( cb->here < cb->end )
-  { *cb->here++ = c;
-  } else
-  { size_t len = (cb->end-cb->base);
+static void
+grow_charbuf(charbuf *cb, size_t min)
+{ size_t size = (cb->end-cb->base);
+  size_t len  = (cb->here-cb->base);
 
-    if ( cb->base == cb->tmp )
-    { pl_wchar_t *n = PL_malloc(len*2*sizeof(pl_wchar_t));
-      memcpy(n, cb->base, sizeof(cb->tmp));
-      cb->base = n;
-    } else
-    { cb->base = PL_realloc(cb->base, len*2*sizeof(pl_wchar_t));
-    }
-    cb->here = &cb->base[len];
-    cb->end = &cb->base[len*2];
-    *cb->here++ = c;
+  while ( size < len+min )
+    size *= 2;
+
+  if ( cb->base == cb->tmp )
+  { pl_wchar_t *n = PL_malloc(size*sizeof(pl_wchar_t));
+    memcpy(n, cb->base, len*sizeof(pl_wchar_t));
+    cb->base = n;
+  } else
+  { cb->base = PL_realloc(cb->base, size*sizeof(pl_wchar_t));
   }
+  cb->here = &cb->base[len];
+  cb->end = &cb->base[size];
+}
+
+
+static bool
+add_charbuf(charbuf *cb, int c)
+{ if ( cb->here >= cb->end )
+    grow_charbuf(cb, 1);
+  *cb->here++ = c;
 
   return true;
 }
@@ -360,15 +673,10 @@ iri_add_encoded_charbuf(charbuf *cb, int c, int flags)
 
 static bool
 add_nchars_charbuf(charbuf *cb, size_t len, const pl_wchar_t *s)
-{ if ( cb->here+len <= cb->end )
-  { wcsncpy(cb->here, s, len);
-    cb->here += len;
-  } else
-  { size_t n;
-
-    for(n=0; n<len; n++)
-      add_charbuf(cb, s[n]);
-  }
+{ if ( cb->here+len > cb->end )
+    grow_charbuf(cb, len);
+  memcpy(cb->here, s, len*sizeof(pl_wchar_t));
+  cb->here += len;
 
   return true;
 }
@@ -376,30 +684,38 @@ add_nchars_charbuf(charbuf *cb, size_t len, const pl_wchar_t *s)
 
 static bool
 range_has_escape(const range *r, int flags)
-{ const pl_wchar_t *s = r->start;
+{ return find_escape(r->start, r->end, flags == ESC_QVALUE) < r->end;
+}
 
-  for(; s<r->end; s++)
-  { if ( s[0] == '%' || (s[0] == '+' && flags == ESC_QVALUE) )
-      return true;
-  }
 
-  return false;
+static bool
+range_is_unreserved(const range *r, int iri, int flags)
+{ char_class tmp;
+  const char_class *cc = get_char_class(flags, &tmp);
+
+  return clean_prefix(r->start, r->end, cc, iri) == r->end;
 }
 
 
+/* Add a range, escaping the characters that need to be escaped.  The
+   clean runs between these characters are copied as a block.
+*/
+
 static bool
-range_is_unreserved(const range *r, int iri, int flags)
-{ const pl_wchar_t *s = r->start;
+add_encoded_range_charbuf(charbuf *cb, const range *r, bool iri, int flags)
+{ char_class tmp;
+  const char_class *cc = get_char_class(flags, &tmp);
+  const pl_wchar_t *s = r->start;
 
-  if ( iri )
-  { for(; s<r->end; s++)
-    { if ( !iri_no_escape(s[0], flags) )
-	return false;
-    }
-  } else
-  { for(; s<r->end; s++)
-    { if ( !no_escape(s[0], flags) )
-	return false;
+  while(s<r->end)
+  { const pl_wchar_t *e = clean_prefix(s, r->end, cc, iri);
+
+    add_nchars_charbuf(cb, e-s, s);
+    if ( (s=e) < r->end )
+    { if ( iri )
+	iri_add_encoded_charbuf(cb, *s++, flags);
+      else
+	add_encoded_charbuf(cb, *s++, flags);
     }
   }
 
@@ -446,10 +762,19 @@ add_decoded_range_charbuf(charbuf *cb, const range *r, int flags)
 
 static bool
 add_normalized_range_charbuf(charbuf *cb, const range *r, bool iri, int flags)
-{ const pl_wchar_t *s = r->start;
+{ char_class tmp;
+  const char_class *cc = get_char_class(flags, &tmp);
+  const pl_wchar_t *s = r->start;
 
   while(s<r->end)
-  { int c;
+  { const pl_wchar_t *e = verbatim_prefix(s, r->end, cc, iri);
+    int c;
+
+    if ( e > s )
+    { add_nchars_charbuf(cb, e-s, s);
+      if ( (s=e) == r->end )
+	break;
+    }
 
     if ( *s == '%' )
     { const pl_wchar_t *e;
@@ -499,21 +824,9 @@ static bool
 add_range_charbuf(charbuf *cb, const range *r, bool unesc, bool iri, int flags)
 { if ( unesc && range_has_escape(r, flags) )
   { return add_normalized_range_charbuf(cb, r, iri, flags);
-  } else if ( range_is_unreserved(r, iri, flags) )
-  { add_nchars_charbuf(cb, r->end-r->start, r->start);
   } else
-  { const pl_wchar_t *s = r->start;
-
-    if ( iri )
-    { while(s<r->end)
-	iri_add_encoded_charbuf(cb, *s++, flags);
-    } else
-    { while(s<r->end)
-	add_encoded_charbuf(cb, *s++, flags);
-    }
+  { return add_encoded_range_charbuf(cb, r, iri, flags);
   }
-
-  return true;
 }
 
 
@@ -935,16 +1248,8 @@ add_encoded_term_charbuf(charbuf *cb, term_t value, bool iri, int flags)
 
   r.start = s;
   r.end = r.start+len;
-  if ( range_is_unreserved(&r, iri, flags) )
-  { add_nchars_charbuf(cb, r.end-r.start, r.start);
-  } else
-  { const pl_wchar_t *s = r.start;
-
-    while(s<r.end)
-      add_encoded_charbuf(cb, *s++, flags);
-  }
 
-  return true;
+  return add_encoded_range_charbuf(cb, &r, iri, flags);
 }
 
 
@@ -1336,11 +1641,74 @@ ranges_in_charbuf(charbuf *cb, uri_component_ranges *ranges)
 }
 
 
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+Resolving many URIs against the same few bases (e.g., loading RDF from
+several documents) is dominated by parsing the base.  Each thread keeps
+the BASE_CACHE_SIZE most recently used parsed bases.  If the base is an
+atom we keep a reference to it, so a hit is found by comparing handles.
+
+If enabled using uri_resolve_memo/1, we also remember the result of
+resolving an atom against an atom base in a direct-mapped table of
+RESOLVE_MEMO_SIZE entries.  As resolving is a function of its input, the
+memo never needs to be invalidated.
+- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+#define BASE_CACHE_SIZE   8
+#define RESOLVE_MEMO_SIZE 256
+
 typedef struct
-{ pl_wchar_t	      *text;
-  uri_component_ranges ranges;
+{ atom_t	       atom;		/* Base as atom (or 0) */
+  pl_wchar_t	      *text;		/* Base as text (PL_malloc'ed) */
+  size_t	       len;		/* Length of text */
+  unsigned int	       used;		/* LRU stamp */
+  uri_component_ranges ranges;		/* Parsed base */
+} base_entry;
+
+typedef struct
+{ atom_t	       rel;		/* Relative URI */
+  atom_t	       base;		/* Base URI */
+  atom_t	       result;		/* Resolved URI */
+  int		       mode;		/* RESOLVE_* flags */
+} resolve_entry;
+
+#define RESOLVE_UNESC	  0x1
+#define RESOLVE_NORMALIZE 0x2
+#define RESOLVE_IRI	  0x4
+
+typedef struct
+{ base_entry	       bases[BASE_CACHE_SIZE];
+  unsigned int	       clock;		/* LRU clock */
+  resolve_entry	      *memo;		/* RESOLVE_MEMO_SIZE entries */
+  int64_t	       base_hits;
+  int64_t	       base_misses;
+  int64_t	       memo_hits;
+  int64_t	       memo_misses;
 } base_cache;
 
+static int resolve_memo = false;	/* Use the memo */
+
+
+static void
+clear_base_entry(base_entry *e)
+{ if ( e->atom )
+    PL_unregister_atom(e->atom);
+  if ( e->text )
+    PL_free(e->text);
+  memset(e, 0, sizeof(*e));
+}
+
+
+static void
+clear_resolve_entry(resolve_entry *e)
+{ if ( e->result )
+  { PL_unregister_atom(e->rel);
+    PL_unregister_atom(e->base);
+    PL_unregister_atom(e->result);
+  }
+  memset(e, 0, sizeof(*e));
+}
+
+
 #ifdef _REENTRANT
 #include <pthread.h>
 static pthread_key_t base_key;
@@ -1348,12 +1716,18 @@ static pthread_key_t base_key;
 static void
 free_base_cache(void *cache)
 { base_cache *base = cache;
+  int i;
 
   if ( PL_query(PL_QUERY_HALTING) )
     return;
 
-  if ( base->text )
-    PL_free(base->text);
+  for(i=0; i<BASE_CACHE_SIZE; i++)
+    clear_base_entry(&base->bases[i]);
+  if ( base->memo )
+  { for(i=0; i<RESOLVE_MEMO_SIZE; i++)
+      clear_resolve_entry(&base->memo[i]);
+    PL_free(base->memo);
+  }
 
   PL_free(base);
 }
@@ -1377,26 +1751,86 @@ static base_cache base_store;
 #endif
 
 
+static base_entry *
+lru_base_entry(base_cache *base)
+{ base_entry *e = &base->bases[0];
+  int i;
+
+  for(i=1; i<BASE_CACHE_SIZE; i++)
+  { if ( base->bases[i].used < e->used )
+      e = &base->bases[i];
+  }
+
+  return e;
+}
+
+
 static const uri_component_ranges *
 base_ranges(term_t t)
-{ size_t len;
+{ base_cache *base = myBase();
+  base_entry *e = NULL;
+  atom_t a = 0;
+  size_t len;
   pl_wchar_t *s;
+  int i;
 
-  if ( PL_get_wchars(t, &len, &s, CVT_ATOM|CVT_STRING|BUF_MALLOC|CVT_EXCEPTION) )
-  { base_cache *base = myBase();
-
-    if ( !base->text || wcscmp(base->text, s) != 0 )
-    { if ( base->text )
-      { PL_free(base->text);
-	base->text = NULL;
+  if ( PL_get_atom(t, &a) )
+  { for(i=0; i<BASE_CACHE_SIZE; i++)
+    { if ( base->bases[i].atom == a )
+      { e = &base->bases[i];
+	goto hit;
       }
-      base->text = s;
-      parse_uri(&base->ranges, len, s);
     }
+  }
 
-    return &base->ranges;
-  } else
-    return false;
+  if ( !PL_get_wchars(t, &len, &s, CVT_ATOM|CVT_STRING|CVT_EXCEPTION) )
+    return NULL;
+
+  for(i=0; i<BASE_CACHE_SIZE; i++)
+  { base_entry *be = &base->bases[i];
+
+    if ( be->text && be->len == len &&
+	 memcmp(be->text, s, len*sizeof(pl_wchar_t)) == 0 )
+    { e = be;
+      goto hit;
+    }
+  }
+
+  base->base_misses++;
+  e = lru_base_entry(base);
+  clear_base_entry(e);
+  e->text = PL_malloc((len+1)*sizeof(pl_wchar_t));
+  memcpy(e->text, s, len*sizeof(pl_wchar_t));
+  e->text[len] = 0;
+  e->len = len;
+  if ( a )
+  { e->atom = a;
+    PL_register_atom(a);
+  }
+  parse_uri(&e->ranges, len, e->text);
+  e->used = ++base->clock;
+
+  return &e->ranges;
+
+hit:
+  base->base_hits++;
+  e->used = ++base->clock;
+  return &e->ranges;
+}
+
+
+static resolve_entry *
+memo_entry(base_cache *base, atom_t rel, atom_t b, int mode)
+{ size_t h = ((size_t)rel>>7) * 31 + ((size_t)b>>7) * 7 + (size_t)mode;
+
+  if ( !base->memo )
+  { size_t size = RESOLVE_MEMO_SIZE*sizeof(*base->memo);
+
+    base->memo = PL_malloc(size);
+    memset(base->memo, 0, size);
+  }
+
+  return &base->memo[h%RESOLVE_MEMO_SIZE];
 }
 
 
@@ -1487,16 +1921,84 @@ resolve_guarded(term_t Rel, term_t Base, term_t URI,
 
 static bool
 resolve(term_t Rel, term_t Base, term_t URI, int unesc, int normalize, int iri)
-{ bool rc;
+{ resolve_entry *memo = NULL;
+  atom_t rel, b;
+  bool rc;
+
+  if ( resolve_memo && PL_get_atom(Rel, &rel) && PL_get_atom(Base, &b) )
+  { base_cache *base = myBase();
+    int mode = ( (unesc ? RESOLVE_UNESC : 0) |
+		 (normalize ? RESOLVE_NORMALIZE : 0) |
+		 (iri ? RESOLVE_IRI : 0) );
+
+    memo = memo_entry(base, rel, b, mode);
+    if ( memo->result && memo->rel == rel && memo->base == b &&
+	 memo->mode == mode )
+    { base->memo_hits++;
+      return PL_unify_atom(URI, memo->result);
+    }
+    base->memo_misses++;
+    clear_resolve_entry(memo);
+    memo->rel  = rel;
+    memo->base = b;
+    memo->mode = mode;
+  }
 
   PL_STRINGS_MARK();
   rc = resolve_guarded(Rel, Base, URI, unesc, normalize, iri);
   PL_STRINGS_RELEASE();
 
+  if ( rc && memo && PL_get_atom(URI, &memo->result) )
+  { PL_register_atom(memo->rel);
+    PL_register_atom(memo->base);
+    PL_register_atom(memo->result);
+  } else if ( memo )
+  { memset(memo, 0, sizeof(*memo));
+  }
+
   return rc;
 }
 
 
+/** uri_resolve_memo(+Bool) is det.
+*/
+
+static foreign_t
+uri_resolve_memo(term_t on)
+{ int val;
+
+  if ( !PL_get_bool_ex(on, &val) )
+    return false;
+  resolve_memo = val;
+
+  return true;
+}
+
+
+static bool
+unify_statistic(term_t tail, term_t head, const char *name, int64_t value)
+{ return ( PL_unify_list(tail, head, tail) &&
+	   PL_unify_term(head, PL_FUNCTOR_CHARS, name, 1, PL_INT64, value) );
+}
+
+
+/** uri_resolve_cache_statistics(-Stats) is det.
+*/
+
+static foreign_t
+uri_resolve_cache_statistics(term_t stats)
+{ base_cache *base = myBase();
+  term_t tail = PL_copy_term_ref(stats);
+  term_t head = PL_new_term_ref();
+
+  return ( unify_statistic(tail, head, "base_hits",   base->base_hits) &&
+	   unify_statistic(tail, head, "base_misses", base->base_misses) &&
+	   unify_statistic(tail, head, "memo_hits",   base->memo_hits) &&
+	   unify_statistic(tail, head, "memo_misses", base->memo_misses) &&
+	   PL_unify_nil(tail) );
+}
+
+
 /** uri_resolve(+Relative, +Base, -Absolute) is det.
 */
 
@@ -1645,7 +2147,10 @@ uri_iri(term_t URI, term_t IRI)
 
 install_t
 install_uri()
-{ MKATOM(query_value);
+{ init_scanners();
+  fill_flags();
+
+  MKATOM(query_value);
   MKATOM(fragment);
   MKATOM(path);
   MKATOM(segment);
@@ -1674,6 +2179,9 @@ install_uri()
 					      2, uri_authority_components, 0);
   PL_register_foreign("uri_encoded",	      3, uri_encoded,	       0);
   PL_register_foreign("uri_iri",	      2, uri_iri,	       0);
+  PL_register_foreign("uri_resolve_memo",     1, uri_resolve_memo,     0);
+  PL_register_foreign("uri_resolve_cache_statistics",
+					      1, uri_resolve_cache_statistics, 0);
 }
 
 
@@ -46,6 +46,8 @@
             iri_normalized/3,           % +IRI, +Base, -NormalizedIRI
             uri_normalized_iri/3,       % +URI, +Base, -NormalizedIRI
             uri_resolve/3,              % +URI, +Base, -AbsURI
+            uri_resolve_memo/1,         % +Bool
+            uri_resolve_cache_statistics/1, % -Stats
             uri_is_global/1,            % +URI
             uri_query_components/2,     % ?QueryString, ?NameValueList
             uri_authority_components/2, % ?Authority, ?Components
@@ -217,6 +219,24 @@ uri_data(Field,     _, _N, _New) =>
 %   Resolve a possibly local URI relative   to Base. This implements
 %   http://labs.apache.org/webarch/uri/rfc/rfc3986.html#relative-transform
 
+%!  uri_resolve_memo(+Bool) is det.
+%
+%   If `true`, remember the result of uri_resolve/3 and the normalizing
+%   variants such as uri_normalized/3 if both URI and Base are atoms.
+%   Each thread has its own table of 256 results.  Only recent results
+%   survive.  This speeds up resolving the same relative URIs against
+%   the same bases, as is common when loading RDF data.  It does keep
+%   the remembered atoms from being garbage collected. Default is
+%   `false`.  Independent of this setting, each thread caches the
+%   8 most recently used parsed bases.
+
+%!  uri_resolve_cache_statistics(-Stats) is det.
+%
+%   Stats is a list `[base_hits(H), base_misses(M), memo_hits(MH),
+%   memo_misses(MM)]` describing the effectiveness of the caches of the
+%   calling thread used by uri_resolve/3 and friends.  See also
+%   uri_resolve_memo/1.
+
 %!  uri_normalized(+URI, +Base, -NormalizedGlobalURI:atom) is det.
 %
 %   NormalizedGlobalURI is the normalized global version of URI.